@@ -0,0 +1,389 @@
+#include <openssl/evp.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+#endif
+
+enum Backend
+{
+    BACKEND_AUTO,
+    BACKEND_OPENSSL,
+    BACKEND_AFALG
+};
+
+struct Algorithm
+{
+    const char* name;    // command-line / kernel name
+    const char* evpName; // OpenSSL fetch name
+    const char* label;   // output label, as printed by the sha2xx examples
+};
+
+static const Algorithm ALGORITHMS[] = {
+    { "sha224", "SHA224", "SHA-224" },
+    { "sha256", "SHA256", "SHA-256" },
+    { "sha384", "SHA384", "SHA-384" },
+    { "sha512", "SHA512", "SHA-512" },
+};
+
+static const char* DEFAULT_CALIBRATION = "afalg_calibration.txt";
+static const long long NEVER = -1;
+
+static double cpuSeconds()
+{
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6 + ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+static double wallSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool hashOpenSSL(int fd, const EVP_MD* md, unsigned char* out, unsigned int* outLen)
+{
+    static std::vector<unsigned char> buffer(256 * 1024);
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, md, NULL);
+    off_t off = 0;
+    for (;;)
+    {
+        ssize_t n = pread(fd, &buffer[0], buffer.size(), off);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            EVP_MD_CTX_free(ctx);
+            return false;
+        }
+        EVP_DigestUpdate(ctx, &buffer[0], (size_t)n);
+        off += n;
+    }
+    EVP_DigestFinal_ex(ctx, out, outLen);
+    EVP_MD_CTX_free(ctx);
+    return true;
+}
+
+#ifdef __linux__
+// Bound "hash" transform socket; accept() on it yields one operation socket
+// per digest.  -1 when the kernel has no AF_ALG or no such algorithm.
+static int afalgOpen(const char* name)
+{
+    int tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (tfm < 0) return -1;
+    struct sockaddr_alg sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy(reinterpret_cast<char*>(sa.salg_type), "hash");
+    strncpy(reinterpret_cast<char*>(sa.salg_name), name, sizeof(sa.salg_name) - 1);
+    if (bind(tfm, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0)
+    {
+        close(tfm);
+        return -1;
+    }
+    return tfm;
+}
+
+// File pages go file -> pipe -> hash socket with splice, so the data is
+// never copied into user space.  SPLICE_F_MORE keeps the kernel hash open
+// until the final empty send, after which read() returns the digest.
+static bool hashAfalg(int tfm, int fd, unsigned int digestLen, unsigned char* out, unsigned int* outLen)
+{
+    int op = accept(tfm, NULL, 0);
+    if (op < 0) return false;
+    int pipes[2];
+    if (pipe(pipes) != 0)
+    {
+        close(op);
+        return false;
+    }
+    bool ok = true;
+    loff_t off = 0;
+    for (;;)
+    {
+        ssize_t in = splice(fd, &off, pipes[1], NULL, 64 * 1024, SPLICE_F_MOVE);
+        if (in == 0) break;
+        if (in < 0)
+        {
+            if (errno == EINTR) continue;
+            ok = false;
+            break;
+        }
+        while (in > 0)
+        {
+            ssize_t sent = splice(pipes[0], NULL, op, NULL, (size_t)in, SPLICE_F_MOVE | SPLICE_F_MORE);
+            if (sent < 0 && errno == EINTR) continue;
+            if (sent <= 0)
+            {
+                ok = false;
+                break;
+            }
+            in -= sent;
+        }
+        if (!ok) break;
+    }
+    if (ok && send(op, NULL, 0, 0) < 0) ok = false;
+    if (ok) ok = read(op, out, digestLen) == (ssize_t)digestLen;
+    *outLen = digestLen;
+    close(pipes[0]);
+    close(pipes[1]);
+    close(op);
+    return ok;
+}
+#else
+static int afalgOpen(const char*)
+{
+    return -1;
+}
+
+static bool hashAfalg(int, int, unsigned int, unsigned char*, unsigned int*)
+{
+    return false;
+}
+#endif
+
+// Calibration file lines: "<algorithm> <min_bytes>", where inputs of at
+// least min_bytes go to AF_ALG and -1 means always OpenSSL.
+static long long loadThreshold(const std::string& file, const char* name)
+{
+    FILE* f = fopen(file.c_str(), "r");
+    if (!f) return NEVER;
+    char alg[32];
+    long long threshold;
+    long long result = NEVER;
+    while (fscanf(f, "%31s %lld", alg, &threshold) == 2)
+    {
+        if (strcmp(alg, name) == 0) result = threshold;
+    }
+    fclose(f);
+    return result;
+}
+
+// Temporary file of the given size, already unlinked.
+static int scratchFile(long long size)
+{
+    char path[] = "/tmp/sha2_afalgXXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) return -1;
+    unlink(path);
+    std::vector<unsigned char> block(64 * 1024, 0xa5);
+    for (long long done = 0; done < size;)
+    {
+        size_t n = (size_t)std::min<long long>((long long)block.size(), size - done);
+        if (write(fd, &block[0], n) != (ssize_t)n)
+        {
+            close(fd);
+            return -1;
+        }
+        done += (long long)n;
+    }
+    return fd;
+}
+
+// Times both backends on warm scratch files from 1 KiB to 64 MiB and records
+// the smallest size from which AF_ALG is consistently faster.
+static int calibrate(const std::string& file)
+{
+    FILE* out = fopen(file.c_str(), "w");
+    if (!out)
+    {
+        std::cerr << "Cannot write " << file << "\n";
+        return 1;
+    }
+    printf("%-8s %10s %14s %14s\n", "alg", "bytes", "openssl MB/s", "af_alg MB/s");
+    for (size_t a = 0; a < sizeof(ALGORITHMS) / sizeof(ALGORITHMS[0]); ++a)
+    {
+        const Algorithm& alg = ALGORITHMS[a];
+        EVP_MD* md = EVP_MD_fetch(NULL, alg.evpName, NULL);
+        int tfm = afalgOpen(alg.name);
+        long long threshold = NEVER;
+        for (long long size = 1024; size <= 64LL << 20; size *= 4)
+        {
+            int fd = scratchFile(size);
+            if (fd < 0) break;
+            int reps = (int)std::max<long long>(1, (256LL << 20) / size / 4);
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int len;
+            double t0 = wallSeconds();
+            for (int i = 0; i < reps; ++i) hashOpenSSL(fd, md, digest, &len);
+            double sslTime = wallSeconds() - t0;
+            double algTime = 0;
+            bool algOk = tfm >= 0;
+            t0 = wallSeconds();
+            for (int i = 0; algOk && i < reps; ++i) algOk = hashAfalg(tfm, fd, (unsigned int)EVP_MD_get_size(md), digest, &len);
+            algTime = wallSeconds() - t0;
+            close(fd);
+            double mb = (double)size * reps / 1e6;
+            printf("%-8s %10lld %14.1f ", alg.name, size, mb / sslTime);
+            if (algOk)
+                printf("%14.1f\n", mb / algTime);
+            else
+                printf("%14s\n", "n/a");
+            if (algOk && algTime < sslTime)
+            {
+                if (threshold == NEVER) threshold = size;
+            }
+            else
+            {
+                threshold = NEVER;
+            }
+        }
+        fprintf(out, "%s %lld\n", alg.name, threshold);
+        if (tfm >= 0) close(tfm);
+        EVP_MD_free(md);
+    }
+    fclose(out);
+    std::cout << "Calibration written to " << file << std::endl;
+    return 0;
+}
+
+static void printDigest(const char* label, const unsigned char* hash, unsigned int len)
+{
+    std::cout << label << ": ";
+    for (unsigned int i = 0; i < len; ++i) printf("%02x", hash[i]);
+    std::cout << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    const Algorithm* alg = &ALGORITHMS[1];
+    Backend backend = BACKEND_AUTO;
+    std::string calibrationFile = DEFAULT_CALIBRATION;
+    bool doCalibrate = false;
+    bool compare = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:b:t:CB")) != -1)
+    {
+        if (opt == 'a')
+        {
+            alg = NULL;
+            for (size_t i = 0; i < sizeof(ALGORITHMS) / sizeof(ALGORITHMS[0]); ++i)
+                if (strcmp(optarg, ALGORITHMS[i].name) == 0) alg = &ALGORITHMS[i];
+            if (!alg)
+            {
+                optind = argc + 1;
+                break;
+            }
+        }
+        else if (opt == 'b')
+        {
+            std::string b = optarg;
+            if (b == "auto")
+                backend = BACKEND_AUTO;
+            else if (b == "openssl")
+                backend = BACKEND_OPENSSL;
+            else if (b == "afalg")
+                backend = BACKEND_AFALG;
+            else
+            {
+                optind = argc + 1;
+                break;
+            }
+        }
+        else if (opt == 't')
+            calibrationFile = optarg;
+        else if (opt == 'C')
+            doCalibrate = true;
+        else if (opt == 'B')
+            compare = true;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (doCalibrate && optind == argc) return calibrate(calibrationFile);
+    if (optind != argc - 1)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-a sha224|sha256|sha384|sha512] [-b auto|openssl|afalg] [-t calibration_file] [-B] <input_file>\n"
+                  << "       " << argv[0] << " -C [-t calibration_file]\n";
+        return 1;
+    }
+
+    int fd = open(argv[optind], O_RDONLY);
+    if (fd < 0)
+    {
+        std::cerr << "Cannot open file!\n";
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    EVP_MD* md = EVP_MD_fetch(NULL, alg->evpName, NULL);
+    int tfm = backend == BACKEND_OPENSSL && !compare ? -1 : afalgOpen(alg->name);
+    if (backend == BACKEND_AFALG && tfm < 0)
+        std::cerr << "AF_ALG " << alg->name << " unavailable (" << strerror(errno) << "), using OpenSSL\n";
+    if (backend == BACKEND_AUTO)
+    {
+        long long threshold = loadThreshold(calibrationFile, alg->name);
+        backend = threshold != NEVER && (long long)st.st_size >= threshold ? BACKEND_AFALG : BACKEND_OPENSSL;
+    }
+    if (tfm < 0) backend = BACKEND_OPENSSL;
+
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen = 0;
+    int status = 0;
+    if (compare)
+    {
+        // Same file, same (warm) page cache: only the hashing path differs.
+        unsigned char other[EVP_MAX_MD_SIZE];
+        unsigned int otherLen = 0;
+        double w0 = wallSeconds(), c0 = cpuSeconds();
+        hashOpenSSL(fd, md, hash, &hashLen);
+        double sslWall = wallSeconds() - w0, sslCpu = cpuSeconds() - c0;
+        printDigest(alg->label, hash, hashLen);
+        double mb = (double)st.st_size / 1e6;
+        printf("openssl: %.3f s wall, %.3f s CPU, %.1f MB/s\n", sslWall, sslCpu, sslWall > 0 ? mb / sslWall : 0.0);
+        if (tfm < 0)
+        {
+            std::cout << "af_alg:  unavailable" << std::endl;
+        }
+        else
+        {
+            w0 = wallSeconds();
+            c0 = cpuSeconds();
+            bool ok = hashAfalg(tfm, fd, hashLen, other, &otherLen);
+            double algWall = wallSeconds() - w0, algCpu = cpuSeconds() - c0;
+            printf("af_alg:  %.3f s wall, %.3f s CPU, %.1f MB/s\n", algWall, algCpu, algWall > 0 ? mb / algWall : 0.0);
+            bool same = ok && otherLen == hashLen && memcmp(hash, other, hashLen) == 0;
+            std::cout << "Digests " << (same ? "match" : "DIFFER") << std::endl;
+            if (!same) status = 1;
+        }
+    }
+    else
+    {
+        bool ok = backend == BACKEND_AFALG ? hashAfalg(tfm, fd, (unsigned int)EVP_MD_get_size(md), hash, &hashLen)
+                                           : hashOpenSSL(fd, md, hash, &hashLen);
+        if (ok)
+        {
+            printDigest(alg->label, hash, hashLen);
+        }
+        else
+        {
+            std::cerr << "Hashing failed: " << strerror(errno) << "\n";
+            status = 1;
+        }
+    }
+    if (tfm >= 0) close(tfm);
+    close(fd);
+    EVP_MD_free(md);
+    return status;
+}
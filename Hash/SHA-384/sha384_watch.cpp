@@ -0,0 +1,494 @@
+#include <openssl/evp.h>
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdlib>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint32_t WATCH_MASK = IN_CLOSE_WRITE | IN_MOVED_FROM | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_DELETE_SELF;
+static const size_t LATENCY_SAMPLES = 10000;
+
+static volatile sig_atomic_t g_stop = 0;
+static volatile sig_atomic_t g_report = 0;
+
+static void onSignal(int sig)
+{
+    if (sig == SIGUSR1)
+        g_report = 1;
+    else
+        g_stop = 1;
+}
+
+struct Digest
+{
+    unsigned char bytes[EVP_MAX_MD_SIZE];
+    unsigned int len;
+};
+
+struct Pending
+{
+    Clock::time_point first; // oldest event not yet reflected in the table
+    Clock::time_point last;  // newest event, for debouncing
+};
+
+struct Job
+{
+    std::string path;
+    Clock::time_point since;
+};
+
+struct Watcher
+{
+    std::string root;
+    const EVP_MD* md;
+    // The snapshot and its temporary file, root-relative, when they lie
+    // inside the tree: their own writes must not count as changes.
+    std::set<std::string> ignored;
+    bool rootDeleted;
+
+    // Digest table, keyed by root-relative path.
+    std::mutex tableLock;
+    std::map<std::string, Digest> table;
+    bool tableDirty;
+    std::vector<double> latencyMs; // ring of recent event-to-digest latencies
+    size_t latencyNext;
+    unsigned long long rehashed;
+
+    // Work queue shared with the hashing pool.
+    std::mutex queueLock;
+    std::condition_variable queueReady;
+    std::deque<Job> queue;
+    std::set<std::string> inFlight;
+    bool shutdown;
+
+    // Owned by the event loop only.
+    int inotifyFd;
+    std::map<int, std::string> dirs;
+    std::map<std::string, Pending> dirty;
+};
+
+static std::string joinPath(const std::string& dir, const std::string& name)
+{
+    return dir.empty() ? name : dir + "/" + name;
+}
+
+static std::string fullPath(const Watcher& w, const std::string& rel)
+{
+    return rel.empty() ? w.root : w.root + "/" + rel;
+}
+
+static bool hashFile(const std::string& path, const EVP_MD* md, EVP_MD_CTX* ctx, std::vector<unsigned char>& buffer, Digest& out)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return false;
+    }
+    EVP_DigestInit_ex(ctx, md, NULL);
+    for (;;)
+    {
+        ssize_t n = read(fd, &buffer[0], buffer.size());
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            close(fd);
+            return false;
+        }
+        EVP_DigestUpdate(ctx, &buffer[0], (size_t)n);
+    }
+    close(fd);
+    EVP_DigestFinal_ex(ctx, out.bytes, &out.len);
+    return true;
+}
+
+static void markDirty(Watcher& w, const std::string& rel, Clock::time_point now)
+{
+    std::map<std::string, Pending>::iterator it = w.dirty.find(rel);
+    if (it == w.dirty.end())
+    {
+        Pending p;
+        p.first = now;
+        p.last = now;
+        w.dirty[rel] = p;
+    }
+    else
+    {
+        it->second.last = now;
+    }
+}
+
+// Adds watches for rel and everything below it, and marks every file found
+// as dirty so it gets (re)hashed.
+static void addTree(Watcher& w, const std::string& rel, Clock::time_point now)
+{
+    std::string path = fullPath(w, rel);
+    int wd = inotify_add_watch(w.inotifyFd, path.c_str(), WATCH_MASK | IN_ONLYDIR);
+    if (wd < 0)
+    {
+        std::cerr << "Warning: cannot watch " << path << ": " << strerror(errno) << "\n";
+        return;
+    }
+    w.dirs[wd] = rel;
+    DIR* dp = opendir(path.c_str());
+    if (!dp) return;
+    struct dirent* d;
+    while ((d = readdir(dp)) != NULL)
+    {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        std::string child = joinPath(rel, d->d_name);
+        if (w.ignored.count(child)) continue;
+        struct stat st;
+        if (lstat(fullPath(w, child).c_str(), &st) != 0) continue;
+        if (S_ISDIR(st.st_mode))
+            addTree(w, child, now);
+        else if (S_ISREG(st.st_mode))
+            markDirty(w, child, now);
+    }
+    closedir(dp);
+}
+
+static void dropPrefix(Watcher& w, const std::string& rel)
+{
+    std::string prefix = rel + "/";
+    std::lock_guard<std::mutex> guard(w.tableLock);
+    std::map<std::string, Digest>::iterator it = w.table.lower_bound(prefix);
+    while (it != w.table.end() && it->first.compare(0, prefix.size(), prefix) == 0)
+    {
+        w.table.erase(it++);
+        w.tableDirty = true;
+    }
+}
+
+static void handleEvent(Watcher& w, const struct inotify_event* ev, Clock::time_point now)
+{
+    if (ev->mask & IN_Q_OVERFLOW)
+    {
+        // Events were lost; fall back to one full rescan of the tree.  The
+        // rescan marks every file still present; whatever else the table
+        // holds was deleted or renamed away unseen, so it is marked too and
+        // the worker that fails to open it drops it.
+        std::cerr << "Warning: inotify queue overflow, rescanning\n";
+        for (std::map<int, std::string>::iterator it = w.dirs.begin(); it != w.dirs.end(); ++it)
+            inotify_rm_watch(w.inotifyFd, it->first);
+        w.dirs.clear();
+        addTree(w, "", now);
+        std::lock_guard<std::mutex> guard(w.tableLock);
+        for (std::map<std::string, Digest>::const_iterator it = w.table.begin(); it != w.table.end(); ++it)
+            if (!w.dirty.count(it->first)) markDirty(w, it->first, now);
+        return;
+    }
+    std::map<int, std::string>::iterator dir = w.dirs.find(ev->wd);
+    if (dir == w.dirs.end()) return;
+    if ((ev->mask & IN_DELETE_SELF) && dir->second.empty())
+    {
+        std::cerr << "Error: watched directory " << w.root << " was deleted\n";
+        w.rootDeleted = true;
+        g_stop = 1;
+        return;
+    }
+    if (ev->mask & IN_IGNORED)
+    {
+        w.dirs.erase(dir);
+        return;
+    }
+    if (ev->len == 0) return;
+    std::string rel = joinPath(dir->second, ev->name);
+    if (w.ignored.count(rel)) return;
+    if (ev->mask & IN_ISDIR)
+    {
+        if (ev->mask & (IN_CREATE | IN_MOVED_TO))
+            addTree(w, rel, now);
+        else if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+            dropPrefix(w, rel);
+        return;
+    }
+    // IN_CREATE alone is ignored for files: the content only counts once the
+    // writer closes it (IN_CLOSE_WRITE) or it is renamed into place.
+    if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)) markDirty(w, rel, now);
+}
+
+// Moves every path that has been quiet for the debounce window onto the work
+// queue.  Paths still being hashed stay dirty until that hash completes, so
+// an older digest can never overwrite a newer one.
+static void flushDirty(Watcher& w, Clock::time_point now, std::chrono::milliseconds debounce)
+{
+    std::lock_guard<std::mutex> guard(w.queueLock);
+    std::map<std::string, Pending>::iterator it = w.dirty.begin();
+    while (it != w.dirty.end())
+    {
+        if (now - it->second.last < debounce || w.inFlight.count(it->first))
+        {
+            ++it;
+            continue;
+        }
+        Job job;
+        job.path = it->first;
+        job.since = it->second.first;
+        w.queue.push_back(job);
+        w.inFlight.insert(it->first);
+        w.dirty.erase(it++);
+        w.queueReady.notify_one();
+    }
+}
+
+static void workerMain(Watcher* w)
+{
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    std::vector<unsigned char> buffer(128 * 1024);
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(w->queueLock);
+            while (w->queue.empty() && !w->shutdown) w->queueReady.wait(guard);
+            if (w->queue.empty()) break;
+            job = w->queue.front();
+            w->queue.pop_front();
+        }
+        Digest d;
+        bool present = hashFile(fullPath(*w, job.path), w->md, ctx, buffer, d);
+        double ms = std::chrono::duration<double, std::milli>(Clock::now() - job.since).count();
+        {
+            std::lock_guard<std::mutex> guard(w->tableLock);
+            if (present)
+                w->table[job.path] = d;
+            else
+                w->table.erase(job.path);
+            w->tableDirty = true;
+            ++w->rehashed;
+            if (w->latencyMs.size() < LATENCY_SAMPLES)
+                w->latencyMs.push_back(ms);
+            else
+                w->latencyMs[w->latencyNext++ % LATENCY_SAMPLES] = ms;
+        }
+        std::lock_guard<std::mutex> guard(w->queueLock);
+        w->inFlight.erase(job.path);
+    }
+    EVP_MD_CTX_free(ctx);
+}
+
+// Writes the table in sha384sum format, via a temporary file and rename so
+// readers never see a half-written snapshot.
+static bool writeSnapshot(Watcher& w, const std::string& snapshot)
+{
+    std::string tmp = snapshot + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "w");
+    if (!out) return false;
+    {
+        std::lock_guard<std::mutex> guard(w.tableLock);
+        for (std::map<std::string, Digest>::const_iterator it = w.table.begin(); it != w.table.end(); ++it)
+        {
+            for (unsigned int i = 0; i < it->second.len; ++i) fprintf(out, "%02x", it->second.bytes[i]);
+            fprintf(out, "  %s\n", it->first.c_str());
+        }
+        w.tableDirty = false;
+    }
+    bool ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+    return ok && rename(tmp.c_str(), snapshot.c_str()) == 0;
+}
+
+// Root-relative path of path if it lies inside the watched tree, else "".
+// path itself need not exist yet, only its directory.
+static std::string relativeToRoot(const Watcher& w, const std::string& path)
+{
+    std::string::size_type slash = path.rfind('/');
+    std::string dir = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    char rootBuf[PATH_MAX], dirBuf[PATH_MAX];
+    if (!realpath(w.root.c_str(), rootBuf) || !realpath(dir.c_str(), dirBuf)) return "";
+    std::string root = rootBuf, real = dirBuf;
+    if (real == root) return name;
+    if (root != "/") root += "/";
+    if (real.compare(0, root.size(), root) != 0) return "";
+    return real.substr(root.size()) + "/" + name;
+}
+
+static void report(Watcher& w)
+{
+    std::vector<double> lat;
+    size_t files;
+    unsigned long long rehashed;
+    {
+        std::lock_guard<std::mutex> guard(w.tableLock);
+        lat = w.latencyMs;
+        files = w.table.size();
+        rehashed = w.rehashed;
+    }
+    std::cerr << "Files: " << files << "  re-hashed: " << rehashed << "  watched dirs: " << w.dirs.size();
+    if (!lat.empty())
+    {
+        std::sort(lat.begin(), lat.end());
+        fprintf(stderr, "  event-to-digest ms p50 %.1f p99 %.1f max %.1f",
+                lat[lat.size() / 2], lat[(lat.size() * 99) / 100], lat.back());
+    }
+    std::cerr << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int threads = std::thread::hardware_concurrency();
+    int debounceMs = 200;
+    int snapshotMs = 1000;
+    std::string snapshot = "sha384.snapshot";
+    int opt;
+    while ((opt = getopt(argc, argv, "j:d:i:o:")) != -1)
+    {
+        if (opt == 'j')
+            threads = (unsigned int)atoi(optarg);
+        else if (opt == 'd')
+            debounceMs = atoi(optarg);
+        else if (opt == 'i')
+            snapshotMs = atoi(optarg);
+        else if (opt == 'o')
+            snapshot = optarg;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-j threads] [-d debounce_ms] [-i snapshot_ms] [-o snapshot_file] <directory>\n";
+        return 1;
+    }
+    if (threads == 0) threads = 2;
+
+    Watcher w;
+    w.root = argv[optind];
+    while (w.root.size() > 1 && w.root[w.root.size() - 1] == '/') w.root.erase(w.root.size() - 1);
+    EVP_MD* md = EVP_MD_fetch(NULL, "SHA384", NULL);
+    if (!md)
+    {
+        std::cerr << "SHA-384 not available!\n";
+        return 1;
+    }
+    w.md = md;
+    w.rootDeleted = false;
+    std::string snapshotRel = relativeToRoot(w, snapshot);
+    if (!snapshotRel.empty())
+    {
+        w.ignored.insert(snapshotRel);
+        w.ignored.insert(snapshotRel + ".tmp");
+    }
+    w.tableDirty = false;
+    w.latencyNext = 0;
+    w.rehashed = 0;
+    w.shutdown = false;
+    w.inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (w.inotifyFd < 0)
+    {
+        std::cerr << "Cannot initialise inotify: " << strerror(errno) << "\n";
+        return 1;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onSignal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+
+    // Watches go in before the initial scan so nothing written during the
+    // scan is missed; the scan itself is just a burst of dirty paths.
+    Clock::time_point start = Clock::now();
+    addTree(w, "", start);
+    if (w.dirs.empty()) return 1;
+    flushDirty(w, start + std::chrono::milliseconds(debounceMs), std::chrono::milliseconds(debounceMs));
+
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; ++i) pool.push_back(std::thread(workerMain, &w));
+    std::cerr << "Watching " << w.root << " (" << w.dirs.size() << " dirs), snapshot " << snapshot << std::endl;
+
+    std::vector<char> events(64 * 1024);
+    Clock::time_point lastSnapshot = Clock::now();
+    while (!g_stop)
+    {
+        struct pollfd pfd;
+        pfd.fd = w.inotifyFd;
+        pfd.events = POLLIN;
+        int timeout = std::min(debounceMs, snapshotMs);
+        if (poll(&pfd, 1, timeout > 0 ? timeout : 1) > 0)
+        {
+            Clock::time_point now = Clock::now();
+            ssize_t n;
+            while ((n = read(w.inotifyFd, &events[0], events.size())) > 0)
+            {
+                for (ssize_t off = 0; off < n;)
+                {
+                    const struct inotify_event* ev = reinterpret_cast<const struct inotify_event*>(&events[off]);
+                    handleEvent(w, ev, now);
+                    off += sizeof(struct inotify_event) + ev->len;
+                }
+            }
+        }
+        Clock::time_point now = Clock::now();
+        flushDirty(w, now, std::chrono::milliseconds(debounceMs));
+        bool due = now - lastSnapshot >= std::chrono::milliseconds(snapshotMs);
+        bool changed;
+        {
+            std::lock_guard<std::mutex> guard(w.tableLock);
+            changed = w.tableDirty;
+        }
+        if (due && changed)
+        {
+            if (!writeSnapshot(w, snapshot)) std::cerr << "Warning: cannot write snapshot " << snapshot << "\n";
+            lastSnapshot = now;
+        }
+        if (g_report)
+        {
+            g_report = 0;
+            report(w);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> guard(w.queueLock);
+        w.shutdown = true;
+        w.queueReady.notify_all();
+    }
+    for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+    // With the root gone the last snapshot stays as the final record.
+    if (!w.rootDeleted) writeSnapshot(w, snapshot);
+    report(w);
+    close(w.inotifyFd);
+    EVP_MD_free(md);
+    return w.rootDeleted ? 1 : 0;
+}
+
+#else
+
+int main()
+{
+    std::cerr << "sha384_watch requires Linux inotify.\n";
+    return 1;
+}
+
+#endif
@@ -0,0 +1,330 @@
+#include <openssl/evp.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+// O_DIRECT needs buffer address, file offset and length aligned to the
+// device's logical block size; 4 KiB covers every current device.
+static const size_t ALIGNMENT = 4096;
+
+enum Mode
+{
+    MODE_DIRECT,   // O_DIRECT, page cache bypassed entirely
+    MODE_DONTNEED, // buffered reads, pages dropped right after hashing
+    MODE_BUFFERED  // plain buffered reads, for comparison
+};
+
+// One aligned buffer in the read ring.  Chunk i always lands in slot
+// i % slots, so the hasher consumes them strictly in file order.
+struct Slot
+{
+    unsigned char* data;
+    long long chunk; // chunk held, -1 when free
+    ssize_t length;
+};
+
+struct Pipeline
+{
+    int fd;
+    Mode mode;
+    size_t chunkSize;
+    long long chunks;
+    long long fileSize;
+    std::vector<Slot> slots;
+    std::mutex lock;
+    std::condition_variable changed;
+    long long nextChunk; // next chunk a reader will claim
+    long long consumed;  // chunks already hashed
+    bool failed;
+};
+
+// Reads until want bytes are in.  len >= want is the aligned request size;
+// stopping at want avoids a follow-up pread at an unaligned offset, which
+// O_DIRECT rejects.
+static ssize_t readFully(int fd, unsigned char* buf, size_t want, size_t len, off_t off)
+{
+    size_t done = 0;
+    while (done < want)
+    {
+        ssize_t n = pread(fd, buf + done, len - done, off + (off_t)done);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+// Each reader keeps one pread outstanding, so the number of readers is the
+// queue depth seen by the device.
+static void readerMain(Pipeline* p)
+{
+    for (;;)
+    {
+        long long chunk;
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> guard(p->lock);
+            if (p->failed || p->nextChunk >= p->chunks) return;
+            chunk = p->nextChunk++;
+            slot = &p->slots[chunk % p->slots.size()];
+            // Wait until the hasher has released the previous occupant.
+            while (!p->failed && chunk - p->consumed >= (long long)p->slots.size()) p->changed.wait(guard);
+            if (p->failed) return;
+        }
+        long long off = chunk * (long long)p->chunkSize;
+        size_t want = (size_t)std::min((long long)p->chunkSize, p->fileSize - off);
+        size_t len = (want + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        ssize_t n = readFully(p->fd, slot->data, want, len, (off_t)off);
+        std::lock_guard<std::mutex> guard(p->lock);
+        if (n < 0)
+        {
+            std::cerr << "Read error: " << strerror(errno) << "\n";
+            p->failed = true;
+        }
+        slot->length = n;
+        slot->chunk = chunk;
+        p->changed.notify_all();
+    }
+}
+
+// Bytes to hash: st_size for a file.  A block device reports st_size 0,
+// so its size is asked of the device.  NULL on success, else the reason.
+static const char* inputSize(int fd, long long* size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) return strerror(errno);
+    if (S_ISREG(st.st_mode))
+    {
+        *size = (long long)st.st_size;
+        return NULL;
+    }
+    if (!S_ISBLK(st.st_mode)) return "not a regular file or block device";
+#ifdef BLKGETSIZE64
+    uint64_t bytes;
+    if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) return strerror(errno);
+    *size = (long long)bytes;
+#else
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < 0) return strerror(errno);
+    *size = (long long)end;
+#endif
+    return NULL;
+}
+
+// Fraction of a file's pages currently in the page cache.
+static double residency(const char* path)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+    void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t pages = ((size_t)st.st_size + page - 1) / page;
+    std::vector<unsigned char> vec(pages);
+    size_t resident = 0;
+#ifdef __APPLE__
+    if (mincore(map, (size_t)st.st_size, reinterpret_cast<char*>(&vec[0])) == 0)
+#else
+    if (mincore(map, (size_t)st.st_size, &vec[0]) == 0)
+#endif
+    {
+        for (size_t i = 0; i < pages; ++i) resident += vec[i] & 1;
+    }
+    munmap(map, (size_t)st.st_size);
+    return (double)resident / (double)pages;
+}
+
+static int openInput(const char* path, Mode& mode)
+{
+    if (mode == MODE_DIRECT)
+    {
+#ifdef O_DIRECT
+        int fd = open(path, O_RDONLY | O_DIRECT);
+        if (fd >= 0) return fd;
+        // tmpfs and some network filesystems reject O_DIRECT.
+        std::cerr << "O_DIRECT unavailable (" << strerror(errno) << "), falling back to buffered + DONTNEED\n";
+#else
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0 && fcntl(fd, F_NOCACHE, 1) == 0) return fd;
+        if (fd >= 0) close(fd);
+        std::cerr << "F_NOCACHE unavailable, falling back to buffered + DONTNEED\n";
+#endif
+        mode = MODE_DONTNEED;
+    }
+    return open(path, O_RDONLY);
+}
+
+static const char* modeName(Mode mode)
+{
+    return mode == MODE_DIRECT ? "direct" : mode == MODE_DONTNEED ? "dontneed" : "buffered";
+}
+
+int main(int argc, char* argv[])
+{
+    Mode mode = MODE_DIRECT;
+    int depth = 8;
+    size_t chunkKb = 1024;
+    const char* hotFile = NULL;
+    int opt;
+    while ((opt = getopt(argc, argv, "m:q:c:w:")) != -1)
+    {
+        if (opt == 'm')
+        {
+            std::string m = optarg;
+            if (m == "direct")
+                mode = MODE_DIRECT;
+            else if (m == "dontneed")
+                mode = MODE_DONTNEED;
+            else if (m == "buffered")
+                mode = MODE_BUFFERED;
+            else
+            {
+                optind = argc + 1;
+                break;
+            }
+        }
+        else if (opt == 'q')
+            depth = atoi(optarg);
+        else if (opt == 'c')
+            chunkKb = (size_t)atol(optarg);
+        else if (opt == 'w')
+            hotFile = optarg;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    size_t chunkSize = chunkKb * 1024;
+    if (optind != argc - 1 || depth < 1 || chunkSize == 0 || chunkSize % ALIGNMENT != 0)
+    {
+        std::cerr << "Usage: " << argv[0]
+                  << " [-m direct|dontneed|buffered] [-q queue_depth] [-c chunk_kb (multiple of 4)] [-w hot_file] <input_file>\n";
+        return 1;
+    }
+    const char* path = argv[optind];
+
+    double hotBefore = hotFile ? residency(hotFile) : -1;
+    Pipeline p;
+    p.mode = mode;
+    p.fd = openInput(path, p.mode);
+    if (p.fd < 0)
+    {
+        std::cerr << "Cannot open file!\n";
+        return 1;
+    }
+    long long size = 0;
+    const char* error = inputSize(p.fd, &size);
+    if (error)
+    {
+        std::cerr << path << ": " << error << "\n";
+        close(p.fd);
+        return 1;
+    }
+    p.chunkSize = chunkSize;
+    p.fileSize = size;
+    p.chunks = (size + (long long)chunkSize - 1) / (long long)chunkSize;
+    p.nextChunk = 0;
+    p.consumed = 0;
+    p.failed = false;
+#ifdef POSIX_FADV_SEQUENTIAL
+    if (p.mode != MODE_DIRECT) posix_fadvise(p.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // Buffers are allocated once and reused for the whole file: depth reads
+    // in flight plus two so the hasher always has a full slot to work on.
+    p.slots.resize((size_t)depth + 2);
+    for (size_t i = 0; i < p.slots.size(); ++i)
+    {
+        void* mem = NULL;
+        if (posix_memalign(&mem, ALIGNMENT, chunkSize) != 0)
+        {
+            std::cerr << "Out of memory!\n";
+            return 1;
+        }
+        p.slots[i].data = static_cast<unsigned char*>(mem);
+        p.slots[i].chunk = -1;
+        p.slots[i].length = 0;
+    }
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, EVP_sha512(), NULL);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<std::thread> readers;
+    for (int i = 0; i < depth; ++i) readers.push_back(std::thread(readerMain, &p));
+
+    unsigned long long total = 0;
+    for (long long chunk = 0; chunk < p.chunks; ++chunk)
+    {
+        Slot* slot = &p.slots[chunk % p.slots.size()];
+        {
+            std::unique_lock<std::mutex> guard(p.lock);
+            while (!p.failed && slot->chunk != chunk) p.changed.wait(guard);
+            if (p.failed) break;
+        }
+        EVP_DigestUpdate(ctx, slot->data, (size_t)slot->length);
+        total += (unsigned long long)slot->length;
+#ifdef POSIX_FADV_DONTNEED
+        if (p.mode == MODE_DONTNEED)
+            posix_fadvise(p.fd, (off_t)(chunk * (long long)chunkSize), (off_t)slot->length, POSIX_FADV_DONTNEED);
+#endif
+        std::lock_guard<std::mutex> guard(p.lock);
+        slot->chunk = -1;
+        ++p.consumed;
+        p.changed.notify_all();
+    }
+    for (size_t i = 0; i < readers.size(); ++i) readers[i].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(p.fd);
+    for (size_t i = 0; i < p.slots.size(); ++i) free(p.slots[i].data);
+    if (p.failed)
+    {
+        EVP_MD_CTX_free(ctx);
+        return 1;
+    }
+
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen;
+    EVP_DigestFinal_ex(ctx, hash, &hashLen);
+    EVP_MD_CTX_free(ctx);
+    std::cout << "SHA-512: ";
+    for (unsigned int i = 0; i < hashLen; ++i) printf("%02x", hash[i]);
+    std::cout << std::endl;
+
+    fprintf(stderr, "Mode: %s  queue depth: %d  chunk: %zu KiB\n", modeName(p.mode), depth, chunkKb);
+    fprintf(stderr, "Read %llu bytes in %.3f s (%.1f MB/s)\n", total, seconds, seconds > 0 ? total / seconds / 1e6 : 0.0);
+    double inputAfter = residency(path);
+    if (inputAfter >= 0) fprintf(stderr, "Input resident in page cache afterwards: %.1f%%\n", inputAfter * 100);
+    double hotAfter = hotFile ? residency(hotFile) : -1;
+    if (hotBefore >= 0 && hotAfter >= 0)
+        fprintf(stderr, "Hot file %s resident: %.1f%% before, %.1f%% after\n", hotFile, hotBefore * 100, hotAfter * 100);
+    return 0;
+}
@@ -2,16 +2,21 @@
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include "hash_stats.h"
+#include "sparse_reader.h"
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    hash_stats_init("blake2b512_example");
+    // -s: digest the sparse extent map instead of the plain bytes
+    bool sparseDigest = argc == 3 && strcmp(argv[1], "-s") == 0;
+    if (argc != 2 && !sparseDigest)
     {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " [-s] <input_file>\n";
         return 1;
     }
-    FILE* file = fopen(argv[1], "rb");
-    if (!file)
+    int fd = open(argv[argc - 1], O_RDONLY);
+    if (fd < 0)
     {
         std::cerr << "Cannot open file!\n";
         return 1;
@@ -19,22 +24,39 @@ int main(int argc, char* argv[])
     EVP_MD_CTX* ctx = EVP_MD_CTX_new();
     const EVP_MD* md = EVP_blake2b512();
     EVP_DigestInit_ex(ctx, md, NULL);
-    unsigned char buffer[4096];
-    size_t bytesRead;
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    SparseReader reader(fd, sparseDigest);
+    const unsigned char* data;
+    ssize_t bytesRead;
+    unsigned long long t = hash_stats_begin();
+    while ((bytesRead = reader.next(&data)) > 0)
     {
-        EVP_DigestUpdate(ctx, buffer, bytesRead);
+        hash_stats_end(STAGE_READ, t, (unsigned long long)bytesRead);
+        t = hash_stats_begin();
+        EVP_DigestUpdate(ctx, data, bytesRead);
+        hash_stats_end(STAGE_DIGEST, t, (unsigned long long)bytesRead);
+        t = hash_stats_begin();
+    }
+    hash_stats_end(STAGE_READ, t, 0);
+    close(fd);
+    if (bytesRead < 0)
+    {
+        std::cerr << "Read error!\n";
+        EVP_MD_CTX_free(ctx);
+        return 1;
     }
-    fclose(file);
     unsigned char hash[EVP_MAX_MD_SIZE];
     unsigned int hashLen;
+    t = hash_stats_begin();
     EVP_DigestFinal_ex(ctx, hash, &hashLen);
+    hash_stats_end(STAGE_DIGEST, t, 0);
     EVP_MD_CTX_free(ctx);
-    std::cout << "BLAKE2b512: ";
+    t = hash_stats_begin();
+    std::cout << (sparseDigest ? "BLAKE2b512 (sparse extents): " : "BLAKE2b512: ");
     for (unsigned int i = 0; i < hashLen; ++i)
     {
         printf("%02x", hash[i]);
     }
     std::cout << std::endl;
+    hash_stats_end(STAGE_OUTPUT, t, sizeof("BLAKE2b512: ") + 2 * hashLen);
     return 0;
 }
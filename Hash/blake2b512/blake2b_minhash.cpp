@@ -0,0 +1,541 @@
+#include <openssl/evp.h>
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Signature geometry: NUM_HASHES = BANDS * ROWS.  16 bands of 8 rows put the
+// LSH threshold (1/b)^(1/r) at ~0.71 Jaccard.
+static const unsigned int NUM_HASHES = 128;
+static const unsigned int BANDS = 16;
+static const unsigned int ROWS = NUM_HASHES / BANDS;
+static const unsigned int DEFAULT_SHINGLE = 5;
+static const char INDEX_MAGIC[8] = { 'M', 'I', 'N', 'H', 'A', 'S', 'H', '1' };
+
+// On-disk index layout (native byte order):
+//   IndexHeader
+//   uint64_t  simhash[docs]
+//   uint32_t  signature[docs][numHashes]
+//   Bucket    buckets[bucketCount]      sorted by (band, key)
+//   uint64_t  pathOffset[docs + 1]
+//   char      paths[pathBytes]          NUL-terminated, back to back
+struct IndexHeader
+{
+    char magic[8];
+    uint32_t numHashes;
+    uint32_t bands;
+    uint32_t rows;
+    uint32_t shingle;
+    uint64_t docs;
+    uint64_t bucketCount;
+    uint64_t pathBytes;
+};
+
+struct Bucket
+{
+    uint64_t key;
+    uint32_t band;
+    uint32_t doc;
+};
+
+static bool bucketLess(const Bucket& a, const Bucket& b)
+{
+    return a.band != b.band ? a.band < b.band : a.key < b.key;
+}
+
+struct Signature
+{
+    uint32_t mins[NUM_HASHES];
+    uint64_t simhash;
+};
+
+static uint64_t load64(const unsigned char* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t mix64(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+// Per-thread hashing state: one BLAKE2b context reused for every shingle.
+class Shingler
+{
+public:
+    Shingler(const EVP_MD* md, unsigned int shingle) : md_(md), ctx_(EVP_MD_CTX_new()), shingle_(shingle) {}
+    ~Shingler() { EVP_MD_CTX_free(ctx_); }
+
+    // Word shingles of the normalised text (lower-case, alphanumeric runs).
+    // Each shingle is hashed once with BLAKE2b; the first 128 bits give h1
+    // and h2, and hash function i is h1 + i * h2 (Kirsch-Mitzenmacher), so
+    // all NUM_HASHES values cost one digest plus multiply-adds.
+    void sign(const char* text, size_t len, Signature& sig, std::vector<uint64_t>* shingles = NULL)
+    {
+        std::vector<std::pair<size_t, size_t> > words;
+        for (size_t i = 0; i < len;)
+        {
+            while (i < len && !isalnum((unsigned char)text[i])) ++i;
+            size_t start = i;
+            while (i < len && isalnum((unsigned char)text[i])) ++i;
+            if (i > start) words.push_back(std::make_pair(start, i - start));
+        }
+        for (unsigned int k = 0; k < NUM_HASHES; ++k) sig.mins[k] = 0xffffffffu;
+        int weights[64] = { 0 };
+        size_t count = words.size() >= shingle_ ? words.size() - shingle_ + 1 : (words.empty() ? 0 : 1);
+        std::string norm;
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLen;
+        for (size_t s = 0; s < count; ++s)
+        {
+            norm.clear();
+            for (size_t w = s; w < s + shingle_ && w < words.size(); ++w)
+            {
+                for (size_t c = 0; c < words[w].second; ++c) norm += (char)tolower((unsigned char)text[words[w].first + c]);
+                norm += ' ';
+            }
+            EVP_DigestInit_ex(ctx_, md_, NULL);
+            EVP_DigestUpdate(ctx_, norm.data(), norm.size());
+            EVP_DigestFinal_ex(ctx_, digest, &digestLen);
+            uint64_t h1 = load64(digest);
+            uint64_t h2 = load64(digest + 8) | 1;
+            for (unsigned int k = 0; k < NUM_HASHES; ++k)
+            {
+                uint32_t h = (uint32_t)((h1 + k * h2) >> 32);
+                if (h < sig.mins[k]) sig.mins[k] = h;
+            }
+            for (int b = 0; b < 64; ++b) weights[b] += (h1 >> b) & 1 ? 1 : -1;
+            if (shingles) shingles->push_back(h1);
+        }
+        sig.simhash = 0;
+        for (int b = 0; b < 64; ++b)
+            if (weights[b] > 0) sig.simhash |= 1ULL << b;
+        if (shingles)
+        {
+            std::sort(shingles->begin(), shingles->end());
+            shingles->erase(std::unique(shingles->begin(), shingles->end()), shingles->end());
+        }
+    }
+
+private:
+    const EVP_MD* md_;
+    EVP_MD_CTX* ctx_;
+    unsigned int shingle_;
+
+    Shingler(const Shingler&);
+    Shingler& operator=(const Shingler&);
+};
+
+static uint64_t bandKey(const uint32_t* mins, unsigned int band)
+{
+    uint64_t key = band;
+    for (unsigned int r = 0; r < ROWS; ++r) key = mix64(key ^ mins[band * ROWS + r]);
+    return key;
+}
+
+static double estimate(const uint32_t* a, const uint32_t* b)
+{
+    unsigned int same = 0;
+    for (unsigned int k = 0; k < NUM_HASHES; ++k) same += a[k] == b[k];
+    return (double)same / NUM_HASHES;
+}
+
+static int popcount64(uint64_t x)
+{
+    int n = 0;
+    for (; x; x &= x - 1) ++n;
+    return n;
+}
+
+static bool readFile(const std::string& path, std::string& out)
+{
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) return false;
+    out.clear();
+    char buffer[65536];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) out.append(buffer, n);
+    fclose(f);
+    return true;
+}
+
+// Signs docs[i] for every i with i % stride == offset.
+static void signFiles(const EVP_MD* md, unsigned int shingle, const std::vector<std::string>* paths,
+                      std::vector<Signature>* sigs, std::vector<char>* ok, unsigned int offset, unsigned int stride)
+{
+    Shingler shingler(md, shingle);
+    std::string text;
+    for (size_t i = offset; i < paths->size(); i += stride)
+    {
+        (*ok)[i] = readFile((*paths)[i], text);
+        if ((*ok)[i]) shingler.sign(text.data(), text.size(), (*sigs)[i]);
+    }
+}
+
+static int build(const EVP_MD* md, const std::string& indexPath, unsigned int shingle, unsigned int threads,
+                 std::vector<std::string>& paths)
+{
+    std::vector<Signature> sigs(paths.size());
+    std::vector<char> ok(paths.size());
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    std::vector<std::thread> pool;
+    for (unsigned int t = 0; t < threads; ++t)
+        pool.push_back(std::thread(signFiles, md, shingle, &paths, &sigs, &ok, t, threads));
+    for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    IndexHeader h;
+    memcpy(h.magic, INDEX_MAGIC, sizeof(h.magic));
+    h.numHashes = NUM_HASHES;
+    h.bands = BANDS;
+    h.rows = ROWS;
+    h.shingle = shingle;
+    std::vector<uint32_t> docs; // positions in paths of readable files
+    for (size_t i = 0; i < paths.size(); ++i)
+    {
+        if (ok[i])
+            docs.push_back((uint32_t)i);
+        else
+            std::cerr << "Warning: cannot read " << paths[i] << "\n";
+    }
+    h.docs = docs.size();
+    std::vector<Bucket> buckets;
+    buckets.reserve(docs.size() * BANDS);
+    std::vector<uint64_t> offsets(1, 0);
+    for (size_t d = 0; d < docs.size(); ++d)
+    {
+        for (unsigned int b = 0; b < BANDS; ++b)
+        {
+            Bucket bk;
+            bk.key = bandKey(sigs[docs[d]].mins, b);
+            bk.band = b;
+            bk.doc = (uint32_t)d;
+            buckets.push_back(bk);
+        }
+        offsets.push_back(offsets.back() + paths[docs[d]].size() + 1);
+    }
+    std::sort(buckets.begin(), buckets.end(), bucketLess);
+    h.bucketCount = buckets.size();
+    h.pathBytes = offsets.back();
+
+    std::string tmp = indexPath + ".tmp";
+    FILE* out = fopen(tmp.c_str(), "wb");
+    if (!out)
+    {
+        std::cerr << "Cannot write " << indexPath << "\n";
+        return 1;
+    }
+    fwrite(&h, sizeof(h), 1, out);
+    for (size_t d = 0; d < docs.size(); ++d) fwrite(&sigs[docs[d]].simhash, sizeof(uint64_t), 1, out);
+    for (size_t d = 0; d < docs.size(); ++d) fwrite(sigs[docs[d]].mins, sizeof(uint32_t), NUM_HASHES, out);
+    if (!buckets.empty()) fwrite(&buckets[0], sizeof(Bucket), buckets.size(), out);
+    fwrite(&offsets[0], sizeof(uint64_t), offsets.size(), out);
+    for (size_t d = 0; d < docs.size(); ++d) fwrite(paths[docs[d]].c_str(), 1, paths[docs[d]].size() + 1, out);
+    if (fclose(out) != 0 || rename(tmp.c_str(), indexPath.c_str()) != 0)
+    {
+        std::cerr << "Cannot write " << indexPath << "\n";
+        return 1;
+    }
+    printf("Indexed %llu documents in %.3f s (%.0f signatures/s)\n", (unsigned long long)h.docs, seconds,
+           seconds > 0 ? h.docs / seconds : 0.0);
+    return 0;
+}
+
+// Read-only view of a mapped index file.
+struct Index
+{
+    void* map;
+    size_t size;
+    const IndexHeader* header;
+    const uint64_t* simhash;
+    const uint32_t* sigs;
+    const Bucket* buckets;
+    const uint64_t* offsets;
+    const char* paths;
+};
+
+static bool openIndex(const std::string& path, Index& ix)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    fstat(fd, &st);
+    ix.size = (size_t)st.st_size;
+    ix.map = ix.size >= sizeof(IndexHeader) ? mmap(NULL, ix.size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ix.map == MAP_FAILED) return false;
+    const char* base = static_cast<const char*>(ix.map);
+    ix.header = reinterpret_cast<const IndexHeader*>(base);
+    const IndexHeader& h = *ix.header;
+    if (memcmp(h.magic, INDEX_MAGIC, sizeof(h.magic)) != 0 || h.numHashes != NUM_HASHES || h.bands != BANDS)
+    {
+        munmap(ix.map, ix.size);
+        return false;
+    }
+    size_t pos = sizeof(IndexHeader);
+    ix.simhash = reinterpret_cast<const uint64_t*>(base + pos);
+    pos += h.docs * sizeof(uint64_t);
+    ix.sigs = reinterpret_cast<const uint32_t*>(base + pos);
+    pos += h.docs * NUM_HASHES * sizeof(uint32_t);
+    ix.buckets = reinterpret_cast<const Bucket*>(base + pos);
+    pos += h.bucketCount * sizeof(Bucket);
+    ix.offsets = reinterpret_cast<const uint64_t*>(base + pos);
+    pos += (h.docs + 1) * sizeof(uint64_t);
+    ix.paths = base + pos;
+    if (pos + h.pathBytes > ix.size)
+    {
+        munmap(ix.map, ix.size);
+        return false;
+    }
+    return true;
+}
+
+// Documents sharing at least one LSH band with sig.
+static void candidates(const Index& ix, const Signature& sig, std::set<uint32_t>& out)
+{
+    const Bucket* end = ix.buckets + ix.header->bucketCount;
+    for (unsigned int b = 0; b < BANDS; ++b)
+    {
+        Bucket probe;
+        probe.key = bandKey(sig.mins, b);
+        probe.band = b;
+        probe.doc = 0;
+        std::pair<const Bucket*, const Bucket*> range = std::equal_range(ix.buckets, end, probe, bucketLess);
+        for (const Bucket* it = range.first; it != range.second; ++it) out.insert(it->doc);
+    }
+}
+
+static int query(const EVP_MD* md, const std::string& indexPath, const std::vector<std::string>& files, double threshold)
+{
+    Index ix;
+    if (!openIndex(indexPath, ix))
+    {
+        std::cerr << "Cannot open index " << indexPath << "\n";
+        return 1;
+    }
+    Shingler shingler(md, ix.header->shingle);
+    std::string text;
+    for (size_t f = 0; f < files.size(); ++f)
+    {
+        if (!readFile(files[f], text))
+        {
+            std::cerr << "Cannot read " << files[f] << "\n";
+            continue;
+        }
+        Signature sig;
+        shingler.sign(text.data(), text.size(), sig);
+        std::set<uint32_t> cand;
+        candidates(ix, sig, cand);
+        std::cout << files[f] << ": " << cand.size() << " candidates" << std::endl;
+        for (std::set<uint32_t>::const_iterator it = cand.begin(); it != cand.end(); ++it)
+        {
+            double j = estimate(sig.mins, ix.sigs + (size_t)*it * NUM_HASHES);
+            if (j < threshold) continue;
+            printf("  %.3f  simhash-distance %2d  %s\n", j, popcount64(sig.simhash ^ ix.simhash[*it]), ix.paths + ix.offsets[*it]);
+        }
+    }
+    munmap(ix.map, ix.size);
+    return 0;
+}
+
+static double exactJaccard(const std::vector<uint64_t>& a, const std::vector<uint64_t>& b)
+{
+    size_t i = 0, j = 0, inter = 0;
+    while (i < a.size() && j < b.size())
+    {
+        if (a[i] < b[j])
+            ++i;
+        else if (b[j] < a[i])
+            ++j;
+        else
+        {
+            ++inter;
+            ++i;
+            ++j;
+        }
+    }
+    size_t uni = a.size() + b.size() - inter;
+    return uni ? (double)inter / uni : 1.0;
+}
+
+// Synthetic corpus: clusters of a random base document plus edited copies
+// (0-50% of words replaced).  Reports signing rate, then recall and
+// precision of "LSH candidate with estimated Jaccard >= threshold" against
+// exact shingle-set Jaccard.
+static int bench(const EVP_MD* md, unsigned int shingle, double threshold, unsigned int clusters)
+{
+    const unsigned int perCluster = 8, words = 300, vocab = 20000;
+    std::mt19937 rng(12345);
+    std::vector<std::string> texts;
+    for (unsigned int c = 0; c < clusters; ++c)
+    {
+        std::vector<unsigned int> base(words);
+        for (unsigned int w = 0; w < words; ++w) base[w] = rng() % vocab;
+        for (unsigned int v = 0; v < perCluster; ++v)
+        {
+            std::vector<unsigned int> doc = base;
+            unsigned int edits = v == 0 ? 0 : rng() % (words / 2);
+            for (unsigned int e = 0; e < edits; ++e) doc[rng() % words] = rng() % vocab;
+            std::string text;
+            for (unsigned int w = 0; w < words; ++w) text += "w" + std::to_string(doc[w]) + " ";
+            texts.push_back(text);
+        }
+    }
+    Shingler shingler(md, shingle);
+    std::vector<Signature> sigs(texts.size());
+    std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < texts.size(); ++i) shingler.sign(texts[i].data(), texts[i].size(), sigs[i]);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("Signed %zu documents (%u words each) in %.3f s: %.0f signatures/s\n", texts.size(), words, seconds,
+           texts.size() / seconds);
+
+    std::vector<std::vector<uint64_t> > sets(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) shingler.sign(texts[i].data(), texts[i].size(), sigs[i], &sets[i]);
+
+    // Candidate pairs from the band buckets.
+    std::vector<Bucket> buckets;
+    for (size_t d = 0; d < sigs.size(); ++d)
+    {
+        for (unsigned int b = 0; b < BANDS; ++b)
+        {
+            Bucket bk;
+            bk.key = bandKey(sigs[d].mins, b);
+            bk.band = b;
+            bk.doc = (uint32_t)d;
+            buckets.push_back(bk);
+        }
+    }
+    std::sort(buckets.begin(), buckets.end(), bucketLess);
+    std::set<std::pair<uint32_t, uint32_t> > reported;
+    for (size_t i = 0; i < buckets.size();)
+    {
+        size_t j = i;
+        while (j < buckets.size() && buckets[j].band == buckets[i].band && buckets[j].key == buckets[i].key) ++j;
+        for (size_t a = i; a < j; ++a)
+            for (size_t b = a + 1; b < j; ++b)
+            {
+                uint32_t x = std::min(buckets[a].doc, buckets[b].doc), y = std::max(buckets[a].doc, buckets[b].doc);
+                if (estimate(sigs[x].mins, sigs[y].mins) >= threshold) reported.insert(std::make_pair(x, y));
+            }
+        i = j;
+    }
+
+    // Ground truth: all pairs inside a cluster (unrelated random documents
+    // share essentially no shingles), plus any reported cross-cluster pair.
+    size_t truth = 0, truePositive = 0;
+    for (unsigned int c = 0; c < clusters; ++c)
+        for (unsigned int a = 0; a < perCluster; ++a)
+            for (unsigned int b = a + 1; b < perCluster; ++b)
+            {
+                uint32_t x = c * perCluster + a, y = c * perCluster + b;
+                if (exactJaccard(sets[x], sets[y]) >= threshold)
+                {
+                    ++truth;
+                    if (reported.count(std::make_pair(x, y))) ++truePositive;
+                }
+            }
+    size_t correct = 0;
+    for (std::set<std::pair<uint32_t, uint32_t> >::const_iterator it = reported.begin(); it != reported.end(); ++it)
+        if (exactJaccard(sets[it->first], sets[it->second]) >= threshold) ++correct;
+    printf("Threshold %.2f: %zu true pairs, %zu reported\n", threshold, truth, reported.size());
+    printf("Recall %.3f  precision %.3f\n", truth ? (double)truePositive / truth : 1.0,
+           reported.empty() ? 1.0 : (double)correct / reported.size());
+    return 0;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " build [-k shingle_words] [-j threads] <index> <file>... (\"-\" reads paths from stdin)\n"
+              << "       " << prog << " query [-t threshold] <index> <file>...\n"
+              << "       " << prog << " bench [-k shingle_words] [-t threshold] [-n clusters]\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    std::string cmd = argv[1];
+    unsigned int shingle = DEFAULT_SHINGLE;
+    unsigned int threads = std::thread::hardware_concurrency();
+    unsigned int clusters = 2000;
+    double threshold = 0.8;
+    int opt;
+    optind = 2;
+    while ((opt = getopt(argc, argv, "k:j:t:n:")) != -1)
+    {
+        if (opt == 'k')
+            shingle = (unsigned int)atoi(optarg);
+        else if (opt == 'j')
+            threads = (unsigned int)atoi(optarg);
+        else if (opt == 't')
+            threshold = atof(optarg);
+        else if (opt == 'n')
+            clusters = (unsigned int)atoi(optarg);
+        else
+        {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (shingle == 0) shingle = DEFAULT_SHINGLE;
+    if (threads == 0) threads = 1;
+    EVP_MD* md = EVP_MD_fetch(NULL, "BLAKE2B-512", NULL);
+    if (!md)
+    {
+        std::cerr << "BLAKE2b512 not available!\n";
+        return 1;
+    }
+    int status = 1;
+    if (cmd == "bench" && optind == argc)
+    {
+        status = bench(md, shingle, threshold, clusters);
+    }
+    else if ((cmd == "build" || cmd == "query") && argc - optind >= 2)
+    {
+        std::string indexPath = argv[optind++];
+        std::vector<std::string> files;
+        for (int i = optind; i < argc; ++i)
+        {
+            if (strcmp(argv[i], "-") == 0)
+            {
+                std::string line;
+                while (std::getline(std::cin, line))
+                    if (!line.empty()) files.push_back(line);
+            }
+            else
+            {
+                files.push_back(argv[i]);
+            }
+        }
+        status = cmd == "build" ? build(md, indexPath, shingle, threads, files) : query(md, indexPath, files, threshold);
+    }
+    else
+    {
+        usage(argv[0]);
+    }
+    EVP_MD_free(md);
+    return status;
+}
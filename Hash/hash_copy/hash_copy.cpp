@@ -0,0 +1,356 @@
+#include <openssl/evp.h>
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/if_alg.h>
+#include <sys/socket.h>
+#ifndef AF_ALG
+#define AF_ALG 38
+#endif
+#endif
+
+static const size_t CHUNK = 1 << 20;
+
+enum CopyResult
+{
+    COPY_OK,
+    COPY_FAILED,
+    COPY_UNSUPPORTED // nothing written yet, caller may try the next method
+};
+
+static bool writeAll(int fd, const unsigned char* data, size_t len)
+{
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        data += n;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+// Portable path: one read per chunk, hashed from the same buffer that is
+// then written out, so the source is read exactly once.
+static CopyResult copyUser(int src, int dst, EVP_MD_CTX* ctx)
+{
+    std::vector<unsigned char> buffer(CHUNK);
+    for (;;)
+    {
+        ssize_t n = read(src, &buffer[0], buffer.size());
+        if (n == 0) return COPY_OK;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return COPY_FAILED;
+        }
+        EVP_DigestUpdate(ctx, &buffer[0], (size_t)n);
+        if (!writeAll(dst, &buffer[0], (size_t)n)) return COPY_FAILED;
+    }
+}
+
+#ifdef __linux__
+// Moves exactly len bytes from a pipe to fd.
+static bool drainPipe(int pipeRead, int fd, size_t len, unsigned int flags)
+{
+    while (len > 0)
+    {
+        ssize_t n = splice(pipeRead, NULL, fd, NULL, len, SPLICE_F_MOVE | flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        len -= (size_t)n;
+    }
+    return true;
+}
+
+static int afalgOpen(const std::string& name)
+{
+    int tfm = socket(AF_ALG, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (tfm < 0) return -1;
+    struct sockaddr_alg sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.salg_family = AF_ALG;
+    strcpy(reinterpret_cast<char*>(sa.salg_type), "hash");
+    strncpy(reinterpret_cast<char*>(sa.salg_name), name.c_str(), sizeof(sa.salg_name) - 1);
+    if (bind(tfm, reinterpret_cast<struct sockaddr*>(&sa), sizeof(sa)) != 0)
+    {
+        close(tfm);
+        return -1;
+    }
+    int op = accept(tfm, NULL, 0);
+    close(tfm);
+    return op;
+}
+
+// Kernel path: source pages are spliced into pipe A, tee'd (page references,
+// no copy) into pipe B, and A is spliced to the destination.  Pipe B feeds
+// the digest: spliced into an AF_ALG hash socket when the kernel has the
+// algorithm (no user-space copy at all), otherwise read once into user space
+// for EVP.  Either way the copy itself never leaves the kernel.
+static CopyResult copySplice(int src, int dst, EVP_MD_CTX* ctx, int afalg, unsigned char* kernelDigest,
+                             unsigned int digestLen)
+{
+    int a[2], b[2];
+    if (pipe2(a, O_CLOEXEC) != 0) return COPY_UNSUPPORTED;
+    if (pipe2(b, O_CLOEXEC) != 0)
+    {
+        close(a[0]);
+        close(a[1]);
+        return COPY_UNSUPPORTED;
+    }
+    fcntl(a[1], F_SETPIPE_SZ, (int)CHUNK);
+    fcntl(b[1], F_SETPIPE_SZ, (int)CHUNK);
+    std::vector<unsigned char> buffer(afalg >= 0 ? 0 : CHUNK);
+    CopyResult result = COPY_OK;
+    bool started = false;
+    for (;;)
+    {
+        ssize_t n = splice(src, NULL, a[1], NULL, CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            result = started ? COPY_FAILED : COPY_UNSUPPORTED;
+            break;
+        }
+        // tee may duplicate less than asked; move what it did and repeat.
+        size_t pending = (size_t)n;
+        while (pending > 0 && result == COPY_OK)
+        {
+            ssize_t t = tee(a[0], b[1], pending, 0);
+            if (t < 0 && errno == EINTR) continue;
+            if (t <= 0)
+            {
+                result = started ? COPY_FAILED : COPY_UNSUPPORTED;
+                break;
+            }
+            if (afalg >= 0)
+            {
+                if (!drainPipe(b[0], afalg, (size_t)t, SPLICE_F_MORE)) result = COPY_FAILED;
+            }
+            else
+            {
+                for (size_t left = (size_t)t; left > 0 && result == COPY_OK;)
+                {
+                    ssize_t r = read(b[0], &buffer[0], left);
+                    if (r < 0 && errno == EINTR) continue;
+                    if (r <= 0)
+                    {
+                        result = COPY_FAILED;
+                        break;
+                    }
+                    EVP_DigestUpdate(ctx, &buffer[0], (size_t)r);
+                    left -= (size_t)r;
+                }
+            }
+            if (result != COPY_OK) break;
+            if (!drainPipe(a[0], dst, (size_t)t, 0))
+            {
+                // Destination filesystem may not accept splice; only safe
+                // to fall back if nothing has been written yet.
+                result = started ? COPY_FAILED : COPY_UNSUPPORTED;
+                break;
+            }
+            started = true;
+            pending -= (size_t)t;
+        }
+        if (result != COPY_OK) break;
+    }
+    if (result == COPY_OK && afalg >= 0)
+    {
+        if (send(afalg, NULL, 0, 0) < 0 || read(afalg, kernelDigest, digestLen) != (ssize_t)digestLen) result = COPY_FAILED;
+    }
+    close(a[0]);
+    close(a[1]);
+    close(b[0]);
+    close(b[1]);
+    return result;
+}
+#endif
+
+// Re-reads the destination from storage (after fsync and dropping its
+// cached pages where possible) and digests it.
+static bool digestFile(int fd, const EVP_MD* md, unsigned char* out, unsigned int* outLen)
+{
+    fsync(fd);
+#ifdef POSIX_FADV_DONTNEED
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+#endif
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, md, NULL);
+    std::vector<unsigned char> buffer(CHUNK);
+    off_t off = 0;
+    for (;;)
+    {
+        ssize_t n = pread(fd, &buffer[0], buffer.size(), off);
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            EVP_MD_CTX_free(ctx);
+            return false;
+        }
+        EVP_DigestUpdate(ctx, &buffer[0], (size_t)n);
+        off += n;
+    }
+    EVP_DigestFinal_ex(ctx, out, outLen);
+    EVP_MD_CTX_free(ctx);
+    return true;
+}
+
+static void printHex(const unsigned char* data, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; ++i) printf("%02x", data[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string alg = "SHA256";
+    bool verify = false;
+    bool userOnly = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:vu")) != -1)
+    {
+        if (opt == 'a')
+            alg = optarg;
+        else if (opt == 'v')
+            verify = true;
+        else if (opt == 'u')
+            userOnly = true;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-a digest] [-v] [-u] <source> <destination>\n";
+        return 1;
+    }
+    EVP_MD* md = EVP_MD_fetch(NULL, alg.c_str(), NULL);
+    if (!md)
+    {
+        std::cerr << "Unknown digest " << alg << "\n";
+        return 1;
+    }
+    int src = open(argv[optind], O_RDONLY | O_CLOEXEC);
+    if (src < 0)
+    {
+        std::cerr << "Cannot open " << argv[optind] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    struct stat st, dstSt;
+    if (fstat(src, &st) != 0)
+    {
+        std::cerr << "Cannot stat " << argv[optind] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    // Opened without O_TRUNC: the destination is only emptied once it is
+    // known not to be the source under another name (or the same name).
+    int dst = open(argv[optind + 1], O_RDWR | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+    if (dst < 0 || fstat(dst, &dstSt) != 0)
+    {
+        std::cerr << "Cannot open " << argv[optind + 1] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+    if (dstSt.st_dev == st.st_dev && dstSt.st_ino == st.st_ino)
+    {
+        std::cerr << argv[optind] << " and " << argv[optind + 1] << " are the same file\n";
+        close(dst);
+        close(src);
+        EVP_MD_free(md);
+        return 1;
+    }
+    if (ftruncate(dst, 0) != 0)
+    {
+        std::cerr << "Cannot truncate " << argv[optind + 1] << ": " << strerror(errno) << "\n";
+        return 1;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(src, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(ctx, md, NULL);
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen = (unsigned int)EVP_MD_get_size(md);
+    CopyResult result = COPY_UNSUPPORTED;
+    const char* method = "read/write";
+#ifdef __linux__
+    if (!userOnly)
+    {
+        // Kernel crypto names are the lower-case OpenSSL names with SHA-2
+        // spelled "sha256" rather than "sha2-256"; digests the kernel lacks
+        // hash in user space.
+        std::string kernelName = EVP_MD_get0_name(md);
+        for (size_t i = 0; i < kernelName.size(); ++i) kernelName[i] = (char)tolower((unsigned char)kernelName[i]);
+        if (kernelName.compare(0, 5, "sha2-") == 0) kernelName = "sha" + kernelName.substr(5);
+        int afalg = afalgOpen(kernelName);
+        result = copySplice(src, dst, ctx, afalg, digest, digestLen);
+        method = afalg >= 0 ? "splice + tee + AF_ALG" : "splice + tee";
+        if (afalg >= 0) close(afalg);
+        // Part of a chunk may already be in the digest; start it afresh
+        // for the user-space path.
+        if (result == COPY_UNSUPPORTED) EVP_DigestInit_ex(ctx, md, NULL);
+        if (result == COPY_OK && afalg < 0) EVP_DigestFinal_ex(ctx, digest, &digestLen);
+    }
+#endif
+    if (result == COPY_UNSUPPORTED)
+    {
+        if (lseek(src, 0, SEEK_SET) != 0 || ftruncate(dst, 0) != 0 || lseek(dst, 0, SEEK_SET) != 0)
+            result = COPY_FAILED;
+        else
+            result = copyUser(src, dst, ctx);
+        method = "read/write";
+        if (result == COPY_OK) EVP_DigestFinal_ex(ctx, digest, &digestLen);
+    }
+    EVP_MD_CTX_free(ctx);
+    close(src);
+    if (result != COPY_OK)
+    {
+        std::cerr << "Copy failed: " << strerror(errno) << "\n";
+        close(dst);
+        EVP_MD_free(md);
+        return 1;
+    }
+
+    std::cout << EVP_MD_get0_name(md) << ": ";
+    printHex(digest, digestLen);
+    std::cout << "  " << argv[optind] << std::endl;
+    // Every path writes the destination sequentially from offset 0, so its
+    // offset is the number of bytes copied.
+    std::cerr << "Copied " << (long long)lseek(dst, 0, SEEK_CUR) << " bytes via " << method << std::endl;
+
+    int status = 0;
+    if (verify)
+    {
+        unsigned char check[EVP_MAX_MD_SIZE];
+        unsigned int checkLen = 0;
+        if (!digestFile(dst, md, check, &checkLen) || checkLen != digestLen || memcmp(check, digest, digestLen) != 0)
+        {
+            std::cout << "Verification FAILED: destination digest ";
+            printHex(check, checkLen);
+            std::cout << std::endl;
+            status = 1;
+        }
+        else
+        {
+            std::cout << "Verified: destination matches" << std::endl;
+        }
+    }
+    if (close(dst) != 0) status = 1;
+    EVP_MD_free(md);
+    return status;
+}
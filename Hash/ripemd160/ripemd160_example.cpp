@@ -2,16 +2,19 @@
 #include <cstdio>
 #include <cstring>
 #include <iostream>
+#include "sparse_reader.h"
 
 int main(int argc, char* argv[])
 {
-    if (argc != 2)
+    // -s: digest the sparse extent map instead of the plain bytes
+    bool sparseDigest = argc == 3 && strcmp(argv[1], "-s") == 0;
+    if (argc != 2 && !sparseDigest)
     {
-        std::cerr << "Usage: " << argv[0] << " <input_file>\n";
+        std::cerr << "Usage: " << argv[0] << " [-s] <input_file>\n";
         return 1;
     }
-    FILE* file = fopen(argv[1], "rb");
-    if (!file)
+    int fd = open(argv[argc - 1], O_RDONLY);
+    if (fd < 0)
     {
         std::cerr << "Cannot open file!\n";
         return 1;
@@ -19,18 +22,25 @@ int main(int argc, char* argv[])
     EVP_MD_CTX* ctx = EVP_MD_CTX_new();
     const EVP_MD* md = EVP_ripemd160();
     EVP_DigestInit_ex(ctx, md, NULL);
-    unsigned char buffer[4096];
-    size_t bytesRead;
-    while ((bytesRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+    SparseReader reader(fd, sparseDigest);
+    const unsigned char* data;
+    ssize_t bytesRead;
+    while ((bytesRead = reader.next(&data)) > 0)
     {
-        EVP_DigestUpdate(ctx, buffer, bytesRead);
+        EVP_DigestUpdate(ctx, data, bytesRead);
+    }
+    close(fd);
+    if (bytesRead < 0)
+    {
+        std::cerr << "Read error!\n";
+        EVP_MD_CTX_free(ctx);
+        return 1;
     }
-    fclose(file);
     unsigned char hash[EVP_MAX_MD_SIZE];
     unsigned int hashLen;
     EVP_DigestFinal_ex(ctx, hash, &hashLen);
     EVP_MD_CTX_free(ctx);
-    std::cout << "RIPEMD160: ";
+    std::cout << (sparseDigest ? "RIPEMD160 (sparse extents): " : "RIPEMD160: ");
     for (unsigned int i = 0; i < hashLen; ++i)
     {
         printf("%02x", hash[i]);
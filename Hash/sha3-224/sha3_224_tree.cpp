@@ -0,0 +1,423 @@
+#include <openssl/evp.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+
+// Files larger than this are queued as their own job so one huge file does
+// not serialise the directory that contains it.
+static const off_t LARGE_FILE = 1 << 20;
+static const size_t READ_BUFFER = 128 * 1024;
+// Workers are mostly blocked in I/O, but each holds a read buffer.
+static const long MAX_THREADS = 1024;
+
+struct Entry
+{
+    std::string path;
+    unsigned int mode;
+    unsigned long long size;
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digestLen;
+};
+
+struct Job
+{
+    std::string path; // relative to the root, "" for the root itself
+    bool isDir;
+};
+
+struct Walker
+{
+    int rootFd;
+    const EVP_MD* md;
+    std::mutex lock;
+    std::condition_variable ready;
+    std::deque<Job> queue;
+    size_t pending; // queued + in-progress jobs
+    std::atomic<bool> failed;
+};
+
+struct Worker
+{
+    Walker* walker;
+    EVP_MD_CTX* ctx;
+    std::vector<unsigned char> buffer;
+    std::vector<Entry> entries;
+};
+
+static std::string joinPath(const std::string& dir, const char* name)
+{
+    return dir.empty() ? std::string(name) : dir + "/" + name;
+}
+
+static void pushJob(Walker* w, const std::string& path, bool isDir)
+{
+    std::lock_guard<std::mutex> guard(w->lock);
+    Job job;
+    job.path = path;
+    job.isDir = isDir;
+    w->queue.push_back(job);
+    ++w->pending;
+    w->ready.notify_one();
+}
+
+static bool hashFd(Worker* wk, int fd, Entry& e)
+{
+    EVP_DigestInit_ex(wk->ctx, wk->walker->md, NULL);
+    for (;;)
+    {
+        ssize_t n = read(fd, &wk->buffer[0], wk->buffer.size());
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        EVP_DigestUpdate(wk->ctx, &wk->buffer[0], (size_t)n);
+    }
+    EVP_DigestFinal_ex(wk->ctx, e.digest, &e.digestLen);
+    return true;
+}
+
+static void fail(Walker* w, const std::string& path, const char* what)
+{
+    std::cerr << "Error: " << what << " " << (path.empty() ? "." : path) << ": " << strerror(errno) << "\n";
+    w->failed = true;
+}
+
+// Records one non-directory entry.  dirFd/name locate it; path is its
+// root-relative name used in the listing.
+static void visitFile(Worker* wk, int dirFd, const char* name, const std::string& path, bool inlineOnly)
+{
+    Walker* w = wk->walker;
+    struct stat st;
+    if (fstatat(dirFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        fail(w, path, "cannot stat");
+        return;
+    }
+    Entry e;
+    e.path = path;
+    e.mode = st.st_mode;
+    e.size = 0;
+    e.digestLen = 0;
+    if (S_ISREG(st.st_mode))
+    {
+        if (!inlineOnly && st.st_size > LARGE_FILE)
+        {
+            pushJob(w, path, false);
+            return;
+        }
+        int fd = openat(dirFd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+        if (fd < 0)
+        {
+            fail(w, path, "cannot open");
+            return;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        bool ok = hashFd(wk, fd, e);
+        close(fd);
+        if (!ok)
+        {
+            fail(w, path, "cannot read");
+            return;
+        }
+        e.size = (unsigned long long)st.st_size;
+    }
+    else if (S_ISLNK(st.st_mode))
+    {
+        // Symlinks are recorded by their target, never followed.
+        char target[4096];
+        ssize_t n = readlinkat(dirFd, name, target, sizeof(target));
+        if (n < 0)
+        {
+            fail(w, path, "cannot read link");
+            return;
+        }
+        EVP_Digest(target, (size_t)n, e.digest, &e.digestLen, w->md, NULL);
+        e.size = (unsigned long long)n;
+    }
+    wk->entries.push_back(e);
+}
+
+#ifdef __linux__
+struct linux_dirent64
+{
+    unsigned long long d_ino;
+    long long d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[1];
+};
+#endif
+
+static void scanDir(Worker* wk, const std::string& path)
+{
+    Walker* w = wk->walker;
+    int fd = path.empty() ? dup(w->rootFd)
+                          : openat(w->rootFd, path.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fail(w, path, "cannot open directory");
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        fail(w, path, "cannot stat");
+        close(fd);
+        return;
+    }
+    Entry dir;
+    dir.path = path.empty() ? "." : path;
+    dir.mode = st.st_mode;
+    dir.size = 0;
+    dir.digestLen = 0;
+    wk->entries.push_back(dir);
+
+#ifdef __linux__
+    // getdents64 straight into the worker buffer: one syscall returns
+    // hundreds of entries and d_type usually saves a stat for directories.
+    for (;;)
+    {
+        long n = syscall(SYS_getdents64, fd, &wk->buffer[0], wk->buffer.size());
+        if (n == 0) break;
+        if (n < 0)
+        {
+            if (errno == EINTR) continue;
+            fail(w, path, "cannot read directory");
+            break;
+        }
+        // Entries live in the shared read buffer, which visitFile reuses
+        // for file data, so copy out the names of this batch first.
+        std::vector<std::pair<std::string, unsigned char> > batch;
+        for (long off = 0; off < n;)
+        {
+            linux_dirent64* d = reinterpret_cast<linux_dirent64*>(&wk->buffer[off]);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+            batch.push_back(std::make_pair(std::string(d->d_name), d->d_type));
+        }
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const char* name = batch[i].first.c_str();
+            std::string child = joinPath(path, name);
+            unsigned char type = batch[i].second;
+            if (type == DT_UNKNOWN)
+            {
+                struct stat cst;
+                if (fstatat(fd, name, &cst, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(cst.st_mode)) type = DT_DIR;
+            }
+            if (type == DT_DIR)
+                pushJob(w, child, true);
+            else
+                visitFile(wk, fd, name, child, false);
+        }
+    }
+    close(fd);
+#else
+    DIR* dp = fdopendir(fd);
+    if (!dp)
+    {
+        fail(w, path, "cannot read directory");
+        close(fd);
+        return;
+    }
+    struct dirent* d;
+    while ((d = readdir(dp)) != NULL)
+    {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        std::string child = joinPath(path, d->d_name);
+        struct stat cst;
+        if (fstatat(fd, d->d_name, &cst, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(cst.st_mode))
+            pushJob(w, child, true);
+        else
+            visitFile(wk, fd, d->d_name, child, false);
+    }
+    closedir(dp);
+#endif
+}
+
+static void workerMain(Worker* wk)
+{
+    Walker* w = wk->walker;
+    for (;;)
+    {
+        Job job;
+        {
+            std::unique_lock<std::mutex> guard(w->lock);
+            while (w->queue.empty() && w->pending > 0) w->ready.wait(guard);
+            if (w->queue.empty()) return;
+            job = w->queue.front();
+            w->queue.pop_front();
+        }
+        if (job.isDir)
+        {
+            scanDir(wk, job.path);
+        }
+        else
+        {
+            std::string::size_type slash = job.path.rfind('/');
+            std::string parent = slash == std::string::npos ? "" : job.path.substr(0, slash);
+            std::string name = slash == std::string::npos ? job.path : job.path.substr(slash + 1);
+            int dirFd = parent.empty() ? dup(w->rootFd)
+                                       : openat(w->rootFd, parent.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (dirFd < 0)
+            {
+                fail(w, parent, "cannot open directory");
+            }
+            else
+            {
+                visitFile(wk, dirFd, name.c_str(), job.path, true);
+                close(dirFd);
+            }
+        }
+        std::lock_guard<std::mutex> guard(w->lock);
+        if (--w->pending == 0) w->ready.notify_all();
+    }
+}
+
+static bool entryLess(const Entry& a, const Entry& b)
+{
+    return a.path < b.path;
+}
+
+static void putBE(unsigned char* out, unsigned long long v, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; --i)
+    {
+        out[i] = (unsigned char)(v & 0xff);
+        v >>= 8;
+    }
+}
+
+static void printHex(const unsigned char* data, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; ++i) printf("%02x", data[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    unsigned int threads = std::thread::hardware_concurrency() * 2;
+    bool listing = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "j:l")) != -1)
+    {
+        if (opt == 'j')
+        {
+            char* end;
+            long n = strtol(optarg, &end, 10);
+            if (end == optarg || *end != '\0' || n <= 0 || n > MAX_THREADS)
+            {
+                optind = argc + 1;
+                break;
+            }
+            threads = (unsigned int)n;
+        }
+        else if (opt == 'l')
+            listing = true;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-j threads (1-" << MAX_THREADS << ")] [-l] <directory>\n";
+        return 1;
+    }
+    if (threads == 0) threads = 4; // hardware_concurrency() unknown
+
+    Walker w;
+    w.rootFd = open(argv[optind], O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (w.rootFd < 0)
+    {
+        std::cerr << "Cannot open directory!\n";
+        return 1;
+    }
+    // Fetch once; EVP_sha3_224() would repeat the provider lookup on every
+    // EVP_DigestInit_ex across all threads.
+    EVP_MD* md = EVP_MD_fetch(NULL, "SHA3-224", NULL);
+    if (!md)
+    {
+        std::cerr << "SHA3-224 not available!\n";
+        return 1;
+    }
+    w.md = md;
+    w.pending = 0;
+    w.failed = false;
+    pushJob(&w, "", true);
+
+    std::vector<Worker> workers(threads);
+    std::vector<std::thread> pool;
+    for (unsigned int i = 0; i < threads; ++i)
+    {
+        workers[i].walker = &w;
+        workers[i].ctx = EVP_MD_CTX_new();
+        workers[i].buffer.resize(READ_BUFFER);
+        pool.push_back(std::thread(workerMain, &workers[i]));
+    }
+    for (size_t i = 0; i < pool.size(); ++i) pool[i].join();
+    close(w.rootFd);
+
+    std::vector<Entry> all;
+    for (size_t i = 0; i < workers.size(); ++i)
+    {
+        all.insert(all.end(), workers[i].entries.begin(), workers[i].entries.end());
+        EVP_MD_CTX_free(workers[i].ctx);
+    }
+    std::sort(all.begin(), all.end(), entryLess);
+
+    // Tree digest over each entry in path order:
+    //   path NUL | mode (4 bytes BE) | size (8 bytes BE) | content digest
+    EVP_MD_CTX* tree = EVP_MD_CTX_new();
+    EVP_DigestInit_ex(tree, md, NULL);
+    for (size_t i = 0; i < all.size(); ++i)
+    {
+        const Entry& e = all[i];
+        unsigned char meta[12];
+        putBE(meta, e.mode, 4);
+        putBE(meta + 4, e.size, 8);
+        EVP_DigestUpdate(tree, e.path.c_str(), e.path.size() + 1);
+        EVP_DigestUpdate(tree, meta, sizeof(meta));
+        EVP_DigestUpdate(tree, e.digest, e.digestLen);
+        if (listing)
+        {
+            if (e.digestLen)
+                printHex(e.digest, e.digestLen);
+            else
+                printf("%56s", "-");
+            printf("  %06o %12llu  %s\n", e.mode, e.size, e.path.c_str());
+        }
+    }
+    unsigned char hash[EVP_MAX_MD_SIZE];
+    unsigned int hashLen;
+    EVP_DigestFinal_ex(tree, hash, &hashLen);
+    EVP_MD_CTX_free(tree);
+    EVP_MD_free(md);
+
+    std::cout << "Entries: " << all.size() << std::endl;
+    std::cout << "SHA3-224 tree: ";
+    printHex(hash, hashLen);
+    std::cout << std::endl;
+    return w.failed ? 1 : 0;
+}
@@ -0,0 +1,192 @@
+// Sparse-file-aware sequential reader for the file hash examples.
+//
+// SparseReader maps a file's data extents with lseek(SEEK_DATA/SEEK_HOLE)
+// and only reads those.  Holes are handed to the caller as pointers into a
+// shared zero page, so a thin VM image costs I/O proportional to its
+// allocated data while producing exactly the same digest as a plain read.
+//
+// In extent mode (-s in the examples) the stream is instead a canonical
+// description of the file:
+//   'D' | offset (8 bytes BE) | length (8 bytes BE) | data bytes
+//   'H' | offset (8 bytes BE) | length (8 bytes BE)
+// so holes cost nothing at all, neither I/O nor digest time.  That digest
+// identifies the same bytes but differs from the plain-file digest, and
+// also changes if the same content is allocated differently.
+//
+// Filesystems without SEEK_DATA support are read as one data extent.
+// Anything that is not a regular file (a pipe, /dev/stdin, a FIFO, a block
+// device) has no extents or reliable st_size and is read with read() until
+// EOF, in both modes.
+#ifndef SPARSE_READER_H
+#define SPARSE_READER_H
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+class SparseReader
+{
+public:
+    explicit SparseReader(int fd, bool extents = false)
+        : fd_(fd), extents_(extents), regular_(false), announced_(false), pos_(0), size_(0), dataStart_(0),
+          dataEnd_(0), headerLen_(0), headerPos_(0), dataBytes_(0), holeBytes_(0)
+    {
+        struct stat st;
+        if (fstat(fd_, &st) == 0 && S_ISREG(st.st_mode))
+        {
+            regular_ = true;
+            size_ = st.st_size;
+            locate(0);
+        }
+    }
+
+    // Next piece of the stream: returns its length and points *data at it,
+    // 0 at end of file, -1 on a read error (errno set).  Data stays valid
+    // until the following call.
+    ssize_t next(const unsigned char** data)
+    {
+        if (headerPos_ < headerLen_)
+        {
+            *data = header_ + headerPos_;
+            ssize_t n = (ssize_t)(headerLen_ - headerPos_);
+            headerPos_ = headerLen_;
+            return n;
+        }
+        if (!regular_) return stream(data);
+        if (pos_ >= size_ && !grown()) return 0;
+        if (pos_ < dataStart_)
+        {
+            off_t hole = dataStart_ - pos_;
+            if (extents_)
+            {
+                setHeader('H', pos_, hole);
+                holeBytes_ += (unsigned long long)hole;
+                pos_ = dataStart_;
+                return next(data);
+            }
+            off_t n = hole < (off_t)ZERO_SIZE ? hole : (off_t)ZERO_SIZE;
+            holeBytes_ += (unsigned long long)n;
+            pos_ += n;
+            *data = zeros();
+            return (ssize_t)n;
+        }
+        if (extents_ && pos_ == dataStart_ && !announced_)
+        {
+            announced_ = true;
+            setHeader('D', dataStart_, dataEnd_ - dataStart_);
+            return next(data);
+        }
+        off_t want = dataEnd_ - pos_;
+        if (want > (off_t)sizeof(buffer_)) want = (off_t)sizeof(buffer_);
+        ssize_t n;
+        do
+        {
+            n = pread(fd_, buffer_, (size_t)want, pos_);
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) return -1;
+        if (n == 0)
+        {
+            // File shrank underneath us; stop here.
+            size_ = pos_;
+            return 0;
+        }
+        pos_ += n;
+        dataBytes_ += (unsigned long long)n;
+        if (pos_ >= dataEnd_) locate(pos_);
+        *data = buffer_;
+        return n;
+    }
+
+    unsigned long long dataBytes() const { return dataBytes_; }
+    unsigned long long holeBytes() const { return holeBytes_; }
+
+private:
+    static const size_t ZERO_SIZE = 1 << 20;
+
+    // One read-only zero region shared by all readers; untouched .bss pages
+    // map to the kernel zero page, so this costs no real memory.
+    static const unsigned char* zeros()
+    {
+        static const unsigned char zero[ZERO_SIZE] = { 0 };
+        return zero;
+    }
+
+    // Non-regular input: sequential read() until EOF.
+    ssize_t stream(const unsigned char** data)
+    {
+        ssize_t n;
+        do
+        {
+            n = read(fd_, buffer_, sizeof(buffer_));
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return n;
+        pos_ += n;
+        dataBytes_ += (unsigned long long)n;
+        *data = buffer_;
+        return n;
+    }
+
+    // At the size seen so far: true (with the extents re-located) if the
+    // file has grown since, so a file still being written is read to its
+    // current end.  pread returns 0 exactly at the current st_size.
+    bool grown()
+    {
+        struct stat st;
+        if (fstat(fd_, &st) != 0 || st.st_size <= size_) return false;
+        size_ = st.st_size;
+        locate(pos_);
+        return true;
+    }
+
+    // Finds the data extent at or after off.
+    void locate(off_t off)
+    {
+        announced_ = false;
+        dataStart_ = off;
+        dataEnd_ = size_;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+        off_t start = lseek(fd_, off, SEEK_DATA);
+        if (start < 0)
+        {
+            // ENXIO: only a hole remains.  Anything else: no sparse support.
+            if (errno == ENXIO) dataStart_ = dataEnd_ = size_;
+            return;
+        }
+        off_t end = lseek(fd_, start, SEEK_HOLE);
+        dataStart_ = start;
+        dataEnd_ = end < 0 || end > size_ ? size_ : end;
+#endif
+    }
+
+    void setHeader(char type, off_t offset, off_t length)
+    {
+        header_[0] = (unsigned char)type;
+        for (int i = 0; i < 8; ++i)
+        {
+            header_[1 + i] = (unsigned char)((unsigned long long)offset >> (56 - 8 * i));
+            header_[9 + i] = (unsigned char)((unsigned long long)length >> (56 - 8 * i));
+        }
+        headerLen_ = sizeof(header_);
+        headerPos_ = 0;
+    }
+
+    int fd_;
+    bool extents_;
+    bool regular_;
+    bool announced_;
+    off_t pos_;
+    off_t size_;
+    off_t dataStart_;
+    off_t dataEnd_;
+    unsigned char header_[17];
+    size_t headerLen_;
+    size_t headerPos_;
+    unsigned long long dataBytes_;
+    unsigned long long holeBytes_;
+    unsigned char buffer_[64 * 1024];
+};
+
+#endif
@@ -0,0 +1,403 @@
+#include <openssl/evp.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+static const size_t BLOCK = 512;
+// Extended headers are metadata, not content; anything larger is malformed.
+static const unsigned long long MAX_META = 1 << 20;
+
+// Buffered sequential reader over a file or stdin.  Memory is one fixed
+// buffer whatever the member sizes; every byte consumed can also be fed to
+// a whole-archive digest.
+class TarStream
+{
+public:
+    TarStream(int fd, EVP_MD_CTX* whole)
+        : fd_(fd), whole_(whole), pos_(0), len_(0), readError_(false), buffer_(256 * 1024)
+    {
+    }
+
+    // Hands the next n bytes to ctx (or drops them when ctx is NULL).
+    // Returns false on a short archive or read error.
+    bool consume(unsigned long long n, EVP_MD_CTX* ctx, std::string* keep = NULL)
+    {
+        while (n > 0)
+        {
+            if (pos_ == len_ && !fill()) return false;
+            size_t take = len_ - pos_;
+            if (take > n) take = (size_t)n;
+            const unsigned char* data = &buffer_[pos_];
+            if (ctx) EVP_DigestUpdate(ctx, data, take);
+            if (keep) keep->append(reinterpret_cast<const char*>(data), take);
+            if (whole_) EVP_DigestUpdate(whole_, data, take);
+            pos_ += take;
+            n -= take;
+        }
+        return true;
+    }
+
+    // 1: the next block is in out; 0: clean end of input on a block
+    // boundary; -1: a partial block or a read error.
+    int block(unsigned char* out)
+    {
+        if (pos_ == len_ && !fill()) return readError_ ? -1 : 0;
+        std::string raw;
+        if (!consume(BLOCK, NULL, &raw)) return -1;
+        memcpy(out, raw.data(), BLOCK);
+        return 1;
+    }
+
+    // Drains whatever follows the end-of-archive marker into the whole
+    // digest, so -w matches a digest of the complete input.
+    void drain()
+    {
+        while (whole_ && (pos_ < len_ || fill()))
+        {
+            EVP_DigestUpdate(whole_, &buffer_[pos_], len_ - pos_);
+            pos_ = len_;
+        }
+    }
+
+private:
+    bool fill()
+    {
+        ssize_t n;
+        do
+        {
+            n = read(fd_, &buffer_[0], buffer_.size());
+        } while (n < 0 && errno == EINTR);
+        if (n < 0) readError_ = true;
+        if (n <= 0) return false;
+        pos_ = 0;
+        len_ = (size_t)n;
+        return true;
+    }
+
+    int fd_;
+    EVP_MD_CTX* whole_;
+    size_t pos_;
+    size_t len_;
+    bool readError_;
+    std::vector<unsigned char> buffer_;
+};
+
+// Header field as a string: NUL-terminated or filling the whole field.
+static std::string field(const unsigned char* p, size_t len)
+{
+    size_t n = 0;
+    while (n < len && p[n]) ++n;
+    return std::string(reinterpret_cast<const char*>(p), n);
+}
+
+// Numeric field: octal text, or GNU base-256 when the top bit is set.
+static bool number(const unsigned char* p, size_t len, unsigned long long* out)
+{
+    unsigned long long v = 0;
+    if (p[0] & 0x80)
+    {
+        v = p[0] & 0x3f;
+        for (size_t i = 1; i < len; ++i)
+        {
+            if (v >> 56) return false;
+            v = (v << 8) | p[i];
+        }
+        *out = v;
+        return true;
+    }
+    size_t i = 0;
+    while (i < len && p[i] == ' ') ++i;
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; ++i)
+    {
+        if (v >> 61) return false;
+        v = (v << 3) | (unsigned long long)(p[i] - '0');
+    }
+    *out = v;
+    return true;
+}
+
+static bool checksumOk(const unsigned char* h)
+{
+    unsigned long long stored;
+    if (!number(h + 148, 8, &stored)) return false;
+    unsigned long long sum = 0;
+    for (size_t i = 0; i < BLOCK; ++i) sum += (i >= 148 && i < 156) ? ' ' : h[i];
+    return sum == stored;
+}
+
+static unsigned long long padding(unsigned long long size)
+{
+    return (BLOCK - size % BLOCK) % BLOCK;
+}
+
+// Pax extended header overrides (POSIX.1-2001) for the fields we report.
+struct PaxOverrides
+{
+    std::string path;
+    bool hasPath = false;
+    std::string linkPath;
+    bool hasLinkPath = false;
+    unsigned long long size = 0;
+    bool hasSize = false;
+};
+
+// Records are "<len> <key>=<value>\n" with len counting the whole record.
+static bool parsePax(const std::string& data, PaxOverrides* pax)
+{
+    size_t off = 0;
+    while (off < data.size())
+    {
+        if (data[off] == '\0') break;
+        size_t space = data.find(' ', off);
+        if (space == std::string::npos) return false;
+        unsigned long long len = strtoull(data.c_str() + off, NULL, 10);
+        if (len <= space - off || off + len > data.size() || data[off + len - 1] != '\n') return false;
+        std::string record = data.substr(space + 1, off + len - space - 2);
+        size_t eq = record.find('=');
+        if (eq != std::string::npos)
+        {
+            std::string key = record.substr(0, eq);
+            std::string value = record.substr(eq + 1);
+            if (key == "path")
+            {
+                pax->path = value;
+                pax->hasPath = true;
+            }
+            else if (key == "linkpath")
+            {
+                pax->linkPath = value;
+                pax->hasLinkPath = true;
+            }
+            else if (key == "size")
+            {
+                pax->size = strtoull(value.c_str(), NULL, 10);
+                pax->hasSize = true;
+            }
+        }
+        off += (size_t)len;
+    }
+    return true;
+}
+
+static void printHex(const unsigned char* data, unsigned int len)
+{
+    for (unsigned int i = 0; i < len; ++i) printf("%02x", data[i]);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string alg = "SHA256";
+    bool wholeDigest = false;
+    bool listAll = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "a:wl")) != -1)
+    {
+        if (opt == 'a')
+            alg = optarg;
+        else if (opt == 'w')
+            wholeDigest = true;
+        else if (opt == 'l')
+            listAll = true;
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind < argc - 1 || optind > argc)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-a digest] [-w] [-l] [archive.tar|-]\n";
+        return 1;
+    }
+    EVP_MD* md = EVP_MD_fetch(NULL, alg.c_str(), NULL);
+    if (!md)
+    {
+        std::cerr << "Unknown digest " << alg << "\n";
+        return 1;
+    }
+    int fd = 0;
+    if (optind < argc && strcmp(argv[optind], "-") != 0)
+    {
+        fd = open(argv[optind], O_RDONLY);
+        if (fd < 0)
+        {
+            std::cerr << "Cannot open " << argv[optind] << ": " << strerror(errno) << "\n";
+            EVP_MD_free(md);
+            return 1;
+        }
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    }
+
+    EVP_MD_CTX* whole = NULL;
+    if (wholeDigest)
+    {
+        whole = EVP_MD_CTX_new();
+        EVP_DigestInit_ex(whole, md, NULL);
+    }
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    TarStream in(fd, whole);
+    PaxOverrides global, local;
+    std::string longName, longLink;
+    unsigned char h[BLOCK];
+    unsigned long long members = 0, bytes = 0;
+    int zeroBlocks = 0;
+    int status = 0;
+    const char* error = NULL;
+
+    while (zeroBlocks < 2)
+    {
+        int got = in.block(h);
+        if (got < 0)
+        {
+            error = "truncated archive";
+            break;
+        }
+        if (got == 0)
+        {
+            // A missing end-of-archive marker is common (some writers omit
+            // it) and harmless when input ends between members; ending
+            // after a metadata entry means its member was cut off.
+            if (local.hasPath || local.hasLinkPath || local.hasSize || !longName.empty() || !longLink.empty())
+                error = "truncated archive";
+            break;
+        }
+        bool zero = true;
+        for (size_t i = 0; i < BLOCK && zero; ++i) zero = h[i] == 0;
+        if (zero)
+        {
+            ++zeroBlocks;
+            continue;
+        }
+        zeroBlocks = 0;
+        if (!checksumOk(h))
+        {
+            error = "bad header checksum";
+            break;
+        }
+        unsigned long long size;
+        if (!number(h + 124, 12, &size))
+        {
+            error = "bad size field";
+            break;
+        }
+        char type = (char)h[156];
+
+        // Metadata entries describe the member that follows: pax headers,
+        // and GNU long names ('L') and long link targets ('K').
+        if (type == 'x' || type == 'g' || type == 'L' || type == 'K')
+        {
+            if (size > MAX_META)
+            {
+                error = "oversized extended header";
+                break;
+            }
+            std::string meta;
+            if (!in.consume(size, NULL, &meta) || !in.consume(padding(size), NULL))
+            {
+                error = "truncated extended header";
+                break;
+            }
+            if (type == 'L')
+                longName = field(reinterpret_cast<const unsigned char*>(meta.data()), meta.size());
+            else if (type == 'K')
+                longLink = field(reinterpret_cast<const unsigned char*>(meta.data()), meta.size());
+            else if (!parsePax(meta, type == 'x' ? &local : &global))
+            {
+                error = "malformed pax header";
+                break;
+            }
+            continue;
+        }
+
+        std::string path = field(h, 100);
+        if (memcmp(h + 257, "ustar", 5) == 0)
+        {
+            std::string prefix = field(h + 345, 155);
+            if (!prefix.empty()) path = prefix + "/" + path;
+        }
+        if (global.hasPath) path = global.path;
+        if (!longName.empty()) path = longName;
+        if (local.hasPath) path = local.path;
+        if (global.hasSize) size = global.size;
+        if (local.hasSize) size = local.size;
+        std::string link = field(h + 157, 100);
+        if (global.hasLinkPath) link = global.linkPath;
+        if (!longLink.empty()) link = longLink;
+        if (local.hasLinkPath) link = local.linkPath;
+        local = PaxOverrides();
+        longName.clear();
+        longLink.clear();
+
+        // Hard links, symlinks, devices and directories carry no content
+        // (a hard link's size field is ignored by readers); GNU sparse
+        // members store a map plus data, not the file image.
+        bool regular = type == '0' || type == '\0' || type == '7';
+        unsigned long long stored = (type == '1' || type == '2') ? 0 : size;
+        if (regular)
+        {
+            EVP_DigestInit_ex(ctx, md, NULL);
+            if (!in.consume(stored, ctx))
+            {
+                error = "truncated member";
+                break;
+            }
+            unsigned char digest[EVP_MAX_MD_SIZE];
+            unsigned int digestLen;
+            EVP_DigestFinal_ex(ctx, digest, &digestLen);
+            printHex(digest, digestLen);
+            printf("  %llu  %s\n", size, path.c_str());
+            ++members;
+            bytes += size;
+        }
+        else
+        {
+            if (type == 'S') std::cerr << "Skipping GNU sparse member " << path << "\n";
+            if (!in.consume(stored, NULL))
+            {
+                error = "truncated member";
+                break;
+            }
+            if (listAll)
+            {
+                printf("%-*s  %c  %s", (int)EVP_MD_get_size(md) * 2, "-", type ? type : '0', path.c_str());
+                if (type == '1' || type == '2') printf(" -> %s", link.c_str());
+                printf("\n");
+            }
+        }
+        if (!in.consume(padding(stored), NULL))
+        {
+            error = "truncated member";
+            break;
+        }
+    }
+    if (error)
+    {
+        std::cerr << "Invalid archive: " << error << "\n";
+        status = 1;
+    }
+
+    if (whole)
+    {
+        in.drain();
+        unsigned char digest[EVP_MAX_MD_SIZE];
+        unsigned int digestLen;
+        EVP_DigestFinal_ex(whole, digest, &digestLen);
+        printf("%s (archive): ", EVP_MD_get0_name(md));
+        printHex(digest, digestLen);
+        printf("\n");
+        EVP_MD_CTX_free(whole);
+    }
+    std::cerr << members << " members, " << bytes << " bytes hashed with " << EVP_MD_get0_name(md) << std::endl;
+    EVP_MD_CTX_free(ctx);
+    EVP_MD_free(md);
+    if (fd != 0) close(fd);
+    return status;
+}
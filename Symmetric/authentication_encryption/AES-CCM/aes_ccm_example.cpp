@@ -1,13 +1,36 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_span.h"
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        if (opt == 'k')
+            bits = atoi(optarg);
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* aes = AesDispatch::cipher("CCM", bits);
+    if (!aes || optind != argc) {
+        std::cerr << "Usage: " << argv[0] << " [-k 128|192|256] | --cpu-report" << std::endl;
+        return 1;
+    }
 
-int main() {
     // Key and IV sizes for AES-CCM
-    const int key_len = 16; // 128-bit key
-    const int iv_len = 12;  // 96-bit nonce (recommended for CCM)
-    unsigned char key[key_len];
+    const int key_len = bits / 8; // 128-, 192- or 256-bit key
+    const int iv_len = 12;        // 96-bit nonce (recommended for CCM)
+    unsigned char key[32];
     unsigned char iv[iv_len];
     RAND_bytes(key, key_len);
     RAND_bytes(iv, iv_len);
@@ -15,49 +38,41 @@ int main() {
     // Plaintext and AAD
     const char* plaintext = "OpenSSL AES-CCM Example!";
     const char* aad = "header-data";
-    int pt_len = strlen(plaintext);
-    int aad_len = strlen(aad);
 
-    // Buffers
-    unsigned char ciphertext[128];
+    // Buffers: the message is sealed and opened in place
+    std::vector<unsigned char> message(plaintext, plaintext + strlen(plaintext));
     unsigned char tag[16];
-    unsigned char decrypted[128];
 
-    // Encrypt
+    // Encrypt (CCM fixes the nonce and tag lengths before the key)
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
-    EVP_EncryptInit_ex(ctx, EVP_aes_128_ccm(), NULL, NULL, NULL);
+    EVP_EncryptInit_ex(ctx, aes, NULL, NULL, NULL);
     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, iv_len, NULL);
     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, 16, NULL);
     EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv);
-    EVP_EncryptUpdate(ctx, NULL, &pt_len, NULL, pt_len);
-    EVP_EncryptUpdate(ctx, NULL, &aad_len, (unsigned char*)aad, aad_len);
-    int outlen;
-    EVP_EncryptUpdate(ctx, ciphertext, &outlen, (unsigned char*)plaintext, pt_len);
-    EVP_EncryptFinal_ex(ctx, NULL, &outlen);
-    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_GET_TAG, 16, tag);
+    bool ok = CipherSpan::seal(ctx, ConstByteSpan(aad, strlen(aad)), message, message, ByteSpan(tag, sizeof(tag)));
     EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        std::cout << "Encryption failed!" << std::endl;
+        return 1;
+    }
 
     std::cout << "Ciphertext: ";
-    for (int i = 0; i < pt_len; ++i) printf("%02x", ciphertext[i]);
+    for (size_t i = 0; i < message.size(); ++i) printf("%02x", message[i]);
     std::cout << "\nTag: ";
     for (int i = 0; i < 16; ++i) printf("%02x", tag[i]);
     std::cout << std::endl;
 
     // Decrypt
     ctx = EVP_CIPHER_CTX_new();
-    EVP_DecryptInit_ex(ctx, EVP_aes_128_ccm(), NULL, NULL, NULL);
+    EVP_DecryptInit_ex(ctx, aes, NULL, NULL, NULL);
     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_IVLEN, iv_len, NULL);
-    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, 16, tag);
+    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_CCM_SET_TAG, 16, NULL);
     EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv);
-    EVP_DecryptUpdate(ctx, NULL, &pt_len, NULL, pt_len);
-    EVP_DecryptUpdate(ctx, NULL, &aad_len, (unsigned char*)aad, aad_len);
-    int len;
-    int ret = EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, pt_len);
+    ok = CipherSpan::open(ctx, ConstByteSpan(aad, strlen(aad)), message, message, ConstByteSpan(tag, sizeof(tag)));
     EVP_CIPHER_CTX_free(ctx);
 
-    if (ret > 0) {
-        decrypted[len] = '\0';
-        std::cout << "Decrypted: " << decrypted << std::endl;
+    if (ok) {
+        std::cout << "Decrypted: " << std::string(message.begin(), message.end()) << std::endl;
     } else {
         std::cout << "Decryption failed!" << std::endl;
     }
@@ -0,0 +1,265 @@
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_ctx_pool.h"
+#include "cipher_span.h"
+#include "gcm_siv.h"
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static void printHex(const char* label, const unsigned char* data, size_t len) {
+    std::cout << label;
+    for (size_t i = 0; i < len; ++i) printf("%02x", data[i]);
+    std::cout << std::endl;
+}
+
+// RFC 8452 Appendix C: AES-128 (C.1), AES-256 (C.2) and the two
+// counter-wrap vectors (C.3), whose tags make the 32-bit CTR counter
+// wrap from 0xffffffff to 0 inside the message.
+struct KnownAnswer {
+    const char *key, *nonce, *aad, *plaintext, *result; // result = ciphertext || tag
+};
+
+static const KnownAnswer knownAnswers[] = {
+    { "01000000000000000000000000000000", "030000000000000000000000", "", "",
+      "dc20e2d83f25705bb49e439eca56de25" },
+    { "01000000000000000000000000000000", "030000000000000000000000", "", "0100000000000000",
+      "b5d839330ac7b786578782fff6013b815b287c22493a364c" },
+    { "01000000000000000000000000000000", "030000000000000000000000", "01", "0200000000000000",
+      "1e6daba35669f4273b0a1a2560969cdf790d99759abd1508" },
+    { "0100000000000000000000000000000000000000000000000000000000000000", "030000000000000000000000", "", "",
+      "07f5f4169bbf55a8400cd47ea6fd400f" },
+    { "0100000000000000000000000000000000000000000000000000000000000000", "030000000000000000000000", "",
+      "0100000000000000", "c2ef328e5c71c83b843122130f7364b761e0b97427e3df28" },
+    { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+      "000000000000000000000000000000004db923dc793ee6497c76dcc03a98e108",
+      "f3f80f2cf0cb2dd9c5984fcda908456cc537703b5ba70324a6793a7bf218d3eaffffffff000000000000000000000000" },
+    { "0000000000000000000000000000000000000000000000000000000000000000", "000000000000000000000000", "",
+      "eb3640277c7ffd1303c7a542d02d3e4c0000000000000000",
+      "18ce4f0b8cb4d0cac65fea8f79257b20888e53e72299e56dffffffff000000000000000000000000" },
+};
+
+static std::vector<unsigned char> fromHex(const char* hex) {
+    std::vector<unsigned char> out;
+    for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+        char byte[3] = { hex[i], hex[i + 1], 0 };
+        out.push_back((unsigned char)strtoul(byte, NULL, 16));
+    }
+    return out;
+}
+
+// Seals and opens every known answer with the backend in use.  Prints
+// each mismatch and returns false if there was one.
+static bool selfTest() {
+    size_t count = sizeof(knownAnswers) / sizeof(knownAnswers[0]), passed = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const KnownAnswer& v = knownAnswers[i];
+        std::vector<unsigned char> key = fromHex(v.key), nonce = fromHex(v.nonce), aad = fromHex(v.aad),
+                                   plain = fromHex(v.plaintext), expected = fromHex(v.result);
+        std::vector<unsigned char> out(plain.size()), opened(plain.size());
+        unsigned char tag[16];
+        GcmSiv siv(key.data(), key.size());
+        bool sealed = siv.ok() && siv.seal(nonce.data(), aad, plain, out, tag);
+        out.insert(out.end(), tag, tag + sizeof(tag));
+        bool ok = sealed && out == expected &&
+                  siv.open(nonce.data(), aad, ConstByteSpan(expected.data(), plain.size()), opened,
+                           expected.data() + plain.size()) &&
+                  opened == plain;
+        if (ok) {
+            ++passed;
+            continue;
+        }
+        std::cerr << "RFC 8452 known-answer test FAILED: AES-" << key.size() * 8 << " vector " << i + 1
+                  << std::endl;
+        std::cerr << "  expected " << v.result << std::endl << "  got      ";
+        for (size_t b = 0; sealed && b < out.size(); ++b) fprintf(stderr, "%02x", out[b]);
+        std::cerr << (sealed ? "" : "(seal failed)") << std::endl;
+    }
+    return passed == count;
+}
+
+// AES-GCM with the same key size as the GCM-SIV it is compared with.
+static bool gcmSeal(const EVP_CIPHER* gcm, const unsigned char* key, const unsigned char* nonce, ConstByteSpan in,
+                    ByteSpan out, unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(gcm, key, nonce, true);
+    return ctx && CipherSpan::seal(ctx, ConstByteSpan(), in, out, ByteSpan(tag, 16));
+}
+
+static void counterNonce(unsigned char* nonce, const unsigned char* prefix, uint64_t counter) {
+    memcpy(nonce, prefix, 4);
+    for (int b = 0; b < 8; ++b) nonce[4 + b] = (unsigned char)(counter >> (56 - 8 * b));
+}
+
+static int bench(int bits) {
+    // A benchmark may repeat a nonce; real messages never may.
+    const EVP_CIPHER* gcm = AesDispatch::cipher("GCM", bits);
+    size_t keyLen = (size_t)bits / 8;
+    unsigned char key[32], prefix[4];
+    if (!gcm || !RAND_bytes(key, (int)keyLen) || !RAND_bytes(prefix, sizeof(prefix))) handleErrors();
+    GcmSiv siv(key, keyLen);
+    if (!siv.ok()) handleErrors();
+    const size_t BATCH = 256;
+    std::cout << "AES-" << bits << ", messages/sec (GCM-SIV backend: " << GcmSiv::backend() << ")" << std::endl;
+    printf("%8s %14s %14s %14s %14s\n", "Message", "GCM rand nonce", "GCM counter", "GCM-SIV batch", "SIV vs GCM");
+    const size_t sizes[] = { 64, 256, 1024, 16384 };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t len = sizes[s];
+        size_t total = std::max<size_t>((64 << 20) / len, BATCH) / BATCH * BATCH;
+        std::vector<unsigned char> in(BATCH * len), out(BATCH * len), opened(BATCH * len);
+        if (!RAND_bytes(in.data(), (int)in.size())) handleErrors();
+        std::vector<SivMessage> msgs(BATCH);
+        unsigned char nonce[12], tag[16];
+        double rate[3];
+        for (int col = 0; col < 3; ++col) {
+            auto t0 = std::chrono::steady_clock::now();
+            for (size_t done = 0; done < total; done += BATCH) {
+                if (col == 2) {
+                    for (size_t i = 0; i < BATCH; ++i) {
+                        msgs[i].aad = ConstByteSpan();
+                        msgs[i].in = ConstByteSpan(&in[i * len], len);
+                        msgs[i].out = ByteSpan(&out[i * len], len);
+                    }
+                    if (siv.sealBatch(msgs.data(), BATCH, prefix, done) != BATCH) handleErrors();
+                    continue;
+                }
+                for (size_t i = 0; i < BATCH; ++i) {
+                    // GCM needs a unique nonce per message: a fresh random one
+                    // (as aes_gcm.cpp does) or a counter that must never repeat.
+                    if (col == 0) {
+                        if (!RAND_bytes(nonce, sizeof(nonce))) handleErrors();
+                    } else {
+                        counterNonce(nonce, prefix, done + i);
+                    }
+                    if (!gcmSeal(gcm, key, nonce, ConstByteSpan(&in[i * len], len), ByteSpan(&out[i * len], len), tag))
+                        handleErrors();
+                }
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            rate[col] = total / sec;
+        }
+        // The last GCM-SIV batch must open again, into a separate buffer.
+        for (size_t i = 0; i < BATCH; ++i) {
+            msgs[i].in = ConstByteSpan(&out[i * len], len);
+            msgs[i].out = ByteSpan(&opened[i * len], len);
+        }
+        if (siv.openBatch(msgs.data(), BATCH) != BATCH || opened != in) handleErrors();
+        printf("%6zu B %14.0f %14.0f %14.0f %13.2fx\n", len, rate[0], rate[1], rate[2], rate[2] / rate[0]);
+    }
+
+    // What the random nonce costs on its own.
+    const int draws = 1000000;
+    unsigned char nonce[12];
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < draws; ++i)
+        if (!RAND_bytes(nonce, sizeof(nonce))) handleErrors();
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    printf("RAND_bytes(12): %.0f ns per nonce\n", sec / draws * 1e9);
+    std::cout << "Per-message overhead on the wire: 12-byte nonce + 16-byte tag for both modes" << std::endl;
+    OPENSSL_cleanse(key, sizeof(key));
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        if (opt == 'k') {
+            bits = atoi(optarg);
+        } else {
+            optind = argc + 1; // fails the check below; getopt must not run past argv[argc]
+            break;
+        }
+    }
+    // RFC 8452 defines GCM-SIV for 128- and 256-bit keys only.
+    bool isBench = optind == argc - 1 && strcmp(argv[optind], "bench") == 0;
+    if ((bits != 128 && bits != 256) || (!isBench && optind != argc)) {
+        std::cerr << "Usage: " << argv[0] << " [-k 128|256] [bench]\n"
+                  << "       " << argv[0] << " --cpu-report\n";
+        return 1;
+    }
+    // A backend that does not reproduce RFC 8452 must not be used or timed.
+    if (!selfTest()) {
+        std::cerr << "GCM-SIV backend (" << GcmSiv::backend() << ") is broken; refusing to continue" << std::endl;
+        return 1;
+    }
+    if (isBench) return bench(bits);
+
+    const EVP_CIPHER* gcm = AesDispatch::cipher("GCM", bits);
+    size_t keyLen = (size_t)bits / 8;
+    unsigned char key[32];
+    if (!gcm || !RAND_bytes(key, (int)keyLen)) handleErrors();
+    GcmSiv siv(key, keyLen);
+    if (!siv.ok()) handleErrors();
+    std::cout << "AES-" << bits << "-GCM-SIV, backend: " << GcmSiv::backend() << std::endl;
+    std::cout << "RFC 8452 known answers: " << sizeof(knownAnswers) / sizeof(knownAnswers[0])
+              << " passed (AES-128, AES-256, counter wrap)" << std::endl;
+
+    // Seal and open one message in place
+    const std::string aad = "header-data";
+    const char* plaintext = "This is AES gcm-siv.";
+    std::vector<unsigned char> message(plaintext, plaintext + strlen(plaintext));
+    unsigned char nonce[12], tag[16];
+    if (!RAND_bytes(nonce, sizeof(nonce))) handleErrors();
+    if (!siv.seal(nonce, aad, message, message, tag)) handleErrors();
+    printHex("Key: ", key, keyLen);
+    printHex("Nonce: ", nonce, sizeof(nonce));
+    printHex("Ciphertext: ", message.data(), message.size());
+    printHex("Tag: ", tag, sizeof(tag));
+    if (siv.open(nonce, aad, message, message, tag))
+        std::cout << "Decrypted: " << std::string(message.begin(), message.end()) << std::endl;
+    else
+        std::cout << "Decryption failed!" << std::endl;
+
+    // Nonce misuse: two different messages under one nonce.  With GCM the
+    // XOR of the ciphertexts is the XOR of the plaintexts; with GCM-SIV
+    // each message gets its own keystream (the tag is the CTR IV).
+    const std::string a = "pay alice 100", b = "pay mallory 1";
+    std::vector<unsigned char> ga(a.size()), gb(b.size()), sa(a.size()), sb(b.size());
+    unsigned char t1[16], t2[16];
+    if (!gcmSeal(gcm, key, nonce, a, ga, t1) || !gcmSeal(gcm, key, nonce, b, gb, t2) ||
+        !siv.seal(nonce, ConstByteSpan(), a, sa, t1) || !siv.seal(nonce, ConstByteSpan(), b, sb, t2))
+        handleErrors();
+    bool gcmLeaks = true, sivLeaks = true;
+    for (size_t i = 0; i < a.size(); ++i) {
+        unsigned char p = (unsigned char)(a[i] ^ b[i]);
+        gcmLeaks = gcmLeaks && (ga[i] ^ gb[i]) == p;
+        sivLeaks = sivLeaks && (sa[i] ^ sb[i]) == p;
+    }
+    std::cout << "Repeated nonce, GCM:     ciphertext XOR " << (gcmLeaks ? "equals" : "differs from")
+              << " plaintext XOR" << std::endl;
+    std::cout << "Repeated nonce, GCM-SIV: ciphertext XOR " << (sivLeaks ? "equals" : "differs from")
+              << " plaintext XOR (only identical messages show as identical)" << std::endl;
+
+    // Batch: counter nonces, no randomness per message
+    const char* texts[] = { "first", "second message", "third, a little longer message" };
+    std::vector<std::vector<unsigned char> > bufs;
+    std::vector<SivMessage> batch(3);
+    unsigned char prefix[4];
+    if (!RAND_bytes(prefix, sizeof(prefix))) handleErrors();
+    for (size_t i = 0; i < 3; ++i) bufs.push_back(std::vector<unsigned char>(texts[i], texts[i] + strlen(texts[i])));
+    for (size_t i = 0; i < 3; ++i) {
+        batch[i].aad = aad;
+        batch[i].in = bufs[i];
+        batch[i].out = bufs[i];
+    }
+    size_t sealed = siv.sealBatch(batch.data(), batch.size(), prefix, 0);
+    size_t opened = siv.openBatch(batch.data(), batch.size());
+    std::cout << "Batch: sealed " << sealed << ", opened " << opened << ":";
+    for (size_t i = 0; i < 3; ++i) std::cout << " \"" << std::string(bufs[i].begin(), bufs[i].end()) << "\"";
+    std::cout << std::endl;
+    OPENSSL_cleanse(key, sizeof(key));
+    return gcmLeaks && !sivLeaks && opened == 3 ? 0 : 1;
+}
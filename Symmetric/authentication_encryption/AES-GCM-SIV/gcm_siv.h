@@ -0,0 +1,320 @@
+// AES-GCM-SIV (RFC 8452): nonce-misuse-resistant AEAD, with a batch API
+// for many small messages.
+//
+// GCM-SIV derives a fresh message key from (key, nonce), computes the tag
+// as a PRF of the whole message and uses the tag as the CTR IV.  Repeating
+// a nonce therefore only reveals that two identical messages were sent
+// under it, instead of GCM's loss of confidentiality and authenticity.
+// That makes counter or derived nonces safe, so the batch API can number
+// messages prefix || counter and skip the DRBG call per message.
+//
+// With OpenSSL 3.2 or later this uses EVP_aes_*_gcm_siv.  Older OpenSSL
+// has no GCM-SIV, so a portable implementation on AES-ECB (with a
+// constant-time software POLYVAL) is used instead; it produces the same
+// bytes and is checked against the RFC 8452 test vectors.
+#ifndef GCM_SIV_H
+#define GCM_SIV_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/opensslv.h>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include "cipher_span.h"
+
+#if OPENSSL_VERSION_NUMBER >= 0x30200000L
+#define GCM_SIV_EVP 1
+#endif
+
+// One message of a batch.  out.size >= in.size and out may be in.
+struct SivMessage {
+    ConstByteSpan aad;
+    ConstByteSpan in;
+    ByteSpan out;
+    unsigned char nonce[12]; // filled by sealBatch, read by openBatch
+    unsigned char tag[16];   // filled by sealBatch, read by openBatch
+    bool ok;
+};
+
+class GcmSiv {
+public:
+    static const size_t NONCE = 12;
+    static const size_t TAG = 16;
+
+    // key is 16 (AES-128-GCM-SIV) or 32 (AES-256-GCM-SIV) bytes.  Check
+    // ok() before use.
+    GcmSiv(const unsigned char* key, size_t keyLen)
+        : keyLen_(keyLen), ok_(false),
+#ifdef GCM_SIV_EVP
+          ctx_(NULL) {
+#else
+          ecb_(NULL), kgk_(NULL), enc_(NULL) {
+        memset(&h_, 0, sizeof(h_));
+#endif
+        if (keyLen != 16 && keyLen != 32) return;
+#ifdef GCM_SIV_EVP
+        ctx_ = EVP_CIPHER_CTX_new();
+        ok_ = ctx_ && EVP_CipherInit_ex(ctx_, keyLen == 16 ? EVP_aes_128_gcm_siv() : EVP_aes_256_gcm_siv(), NULL, key,
+                                        NULL, 1) == 1;
+#else
+        ecb_ = keyLen == 16 ? EVP_aes_128_ecb() : EVP_aes_256_ecb();
+        kgk_ = EVP_CIPHER_CTX_new();
+        enc_ = EVP_CIPHER_CTX_new();
+        ok_ = kgk_ && enc_ && EVP_EncryptInit_ex(kgk_, ecb_, NULL, key, NULL) == 1 &&
+              EVP_CIPHER_CTX_set_padding(kgk_, 0) == 1;
+#endif
+    }
+
+    ~GcmSiv() {
+#ifdef GCM_SIV_EVP
+        EVP_CIPHER_CTX_free(ctx_);
+#else
+        EVP_CIPHER_CTX_free(kgk_);
+        EVP_CIPHER_CTX_free(enc_);
+        OPENSSL_cleanse(&h_, sizeof(h_));
+#endif
+    }
+
+    bool ok() const { return ok_; }
+
+    static const char* backend() {
+#ifdef GCM_SIV_EVP
+        return "OpenSSL EVP_aes_*_gcm_siv";
+#else
+        return "portable RFC 8452 (OpenSSL < 3.2)";
+#endif
+    }
+
+    bool seal(const unsigned char* nonce, ConstByteSpan aad, ConstByteSpan in, ByteSpan out, unsigned char* tag) {
+        if (!ok_ || out.size < in.size || in.size > (size_t)INT_MAX || aad.size > (size_t)INT_MAX) return false;
+#ifdef GCM_SIV_EVP
+        int len;
+        return EVP_CipherInit_ex(ctx_, NULL, NULL, NULL, nonce, 1) == 1 && evpUpdate(aad, in, out) &&
+               EVP_EncryptFinal_ex(ctx_, out.data, &len) == 1 &&
+               EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_GET_TAG, (int)TAG, tag) == 1;
+#else
+        // The tag covers the plaintext, so it is computed before out
+        // (which may be in) is overwritten.
+        unsigned char s[16];
+        return deriveKeys(nonce) && polyval(aad, in, s) && tagFrom(s, nonce, tag) && ctr(tag, in, out.data);
+#endif
+    }
+
+    // False if the tag does not verify; out is then wiped.
+    bool open(const unsigned char* nonce, ConstByteSpan aad, ConstByteSpan in, ByteSpan out, const unsigned char* tag) {
+        if (!ok_ || out.size < in.size || in.size > (size_t)INT_MAX || aad.size > (size_t)INT_MAX) return false;
+        bool ok;
+#ifdef GCM_SIV_EVP
+        // The tag is the CTR IV, so it must be set before any data.
+        int len;
+        ok = EVP_CipherInit_ex(ctx_, NULL, NULL, NULL, nonce, 0) == 1 &&
+             EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_SET_TAG, (int)TAG, const_cast<unsigned char*>(tag)) == 1 &&
+             evpUpdate(aad, in, out) && EVP_DecryptFinal_ex(ctx_, out.data, &len) == 1;
+#else
+        unsigned char s[16], expected[16];
+        ok = deriveKeys(nonce) && ctr(tag, in, out.data) && polyval(aad, ConstByteSpan(out.data, in.size), s) &&
+             tagFrom(s, nonce, expected) && CRYPTO_memcmp(expected, tag, TAG) == 0;
+#endif
+        if (!ok && out.data) OPENSSL_cleanse(out.data, in.size);
+        return ok;
+    }
+
+    // Seals msgs[0, count) under nonces prefix (4 bytes) || counter + i
+    // (8 bytes, big-endian), storing each nonce and tag in its message.
+    // No randomness is drawn; GCM-SIV stays safe even if a counter value
+    // is ever reused.  Returns the number of messages sealed.
+    size_t sealBatch(SivMessage* msgs, size_t count, const unsigned char* prefix, uint64_t counter) {
+        size_t done = 0;
+        for (size_t i = 0; i < count; ++i) {
+            SivMessage& m = msgs[i];
+            memcpy(m.nonce, prefix, 4);
+            uint64_t n = counter + i;
+            for (int b = 0; b < 8; ++b) m.nonce[4 + b] = (unsigned char)(n >> (56 - 8 * b));
+            m.ok = seal(m.nonce, m.aad, m.in, m.out, m.tag);
+            if (m.ok) ++done;
+        }
+        return done;
+    }
+
+    // Opens msgs[0, count) with their nonce and tag; returns the number that
+    // verified (check each ok).
+    size_t openBatch(SivMessage* msgs, size_t count) {
+        size_t done = 0;
+        for (size_t i = 0; i < count; ++i) {
+            SivMessage& m = msgs[i];
+            m.ok = open(m.nonce, m.aad, m.in, m.out, m.tag);
+            if (m.ok) ++done;
+        }
+        return done;
+    }
+
+private:
+    GcmSiv(const GcmSiv&);
+    GcmSiv& operator=(const GcmSiv&);
+
+    size_t keyLen_;
+    bool ok_;
+
+#ifdef GCM_SIV_EVP
+    bool evpUpdate(ConstByteSpan aad, ConstByteSpan in, ByteSpan out) {
+        // GCM-SIV is two-pass: the whole message goes in one update.
+        unsigned char none = 0;
+        int len;
+        return (aad.size == 0 || EVP_CipherUpdate(ctx_, NULL, &len, aad.data, (int)aad.size) == 1) &&
+               EVP_CipherUpdate(ctx_, in.size ? out.data : &none, &len, in.size ? in.data : &none, (int)in.size) == 1;
+    }
+
+    EVP_CIPHER_CTX* ctx_;
+#else
+    // A field element as two little-endian words: lo holds x^0..x^63.
+    struct Elem {
+        uint64_t lo, hi;
+    };
+
+    static uint64_t le64(const unsigned char* p) {
+        uint64_t v = 0;
+        for (int i = 7; i >= 0; --i) v = (v << 8) | p[i];
+        return v;
+    }
+
+    static void putLe64(unsigned char* p, uint64_t v) {
+        for (int i = 0; i < 8; ++i) p[i] = (unsigned char)(v >> (8 * i));
+    }
+
+    // Carry-less 64 x 64 -> 64 multiply using integer multiplies with
+    // holes every fourth bit so carries never reach a result bit
+    // (constant time; the technique from BearSSL's ghash_ctmul64).
+    static uint64_t bmul64(uint64_t x, uint64_t y) {
+        const uint64_t m0 = 0x1111111111111111ULL, m1 = m0 << 1, m2 = m0 << 2, m3 = m0 << 3;
+        uint64_t x0 = x & m0, x1 = x & m1, x2 = x & m2, x3 = x & m3;
+        uint64_t y0 = y & m0, y1 = y & m1, y2 = y & m2, y3 = y & m3;
+        uint64_t z0 = (x0 * y0) ^ (x1 * y3) ^ (x2 * y2) ^ (x3 * y1);
+        uint64_t z1 = (x0 * y1) ^ (x1 * y0) ^ (x2 * y3) ^ (x3 * y2);
+        uint64_t z2 = (x0 * y2) ^ (x1 * y1) ^ (x2 * y0) ^ (x3 * y3);
+        uint64_t z3 = (x0 * y3) ^ (x1 * y2) ^ (x2 * y1) ^ (x3 * y0);
+        return (z0 & m0) | (z1 & m1) | (z2 & m2) | (z3 & m3);
+    }
+
+    static uint64_t rev64(uint64_t x) {
+        x = ((x & 0x5555555555555555ULL) << 1) | ((x >> 1) & 0x5555555555555555ULL);
+        x = ((x & 0x3333333333333333ULL) << 2) | ((x >> 2) & 0x3333333333333333ULL);
+        x = ((x & 0x0f0f0f0f0f0f0f0fULL) << 4) | ((x >> 4) & 0x0f0f0f0f0f0f0f0fULL);
+        x = ((x & 0x00ff00ff00ff00ffULL) << 8) | ((x >> 8) & 0x00ff00ff00ff00ffULL);
+        x = ((x & 0x0000ffff0000ffffULL) << 16) | ((x >> 16) & 0x0000ffff0000ffffULL);
+        return (x << 32) | (x >> 32);
+    }
+
+    // Full 128-bit carry-less product; the high half comes from the low
+    // half of the bit-reversed operands.
+    static void clmul(uint64_t x, uint64_t y, uint64_t* lo, uint64_t* hi) {
+        *lo = bmul64(x, y);
+        *hi = rev64(bmul64(rev64(x), rev64(y))) >> 1;
+    }
+
+    // Per-nonce keys: the first 8 bytes of AES(K, LE32(i) || nonce) for
+    // i = 0, 1 make the POLYVAL key and the following ones the AES key.
+    bool deriveKeys(const unsigned char* nonce) {
+        size_t blocks = keyLen_ == 16 ? 4 : 6;
+        unsigned char in[6 * 16], out[6 * 16], encKey[32], authKey[16];
+        memset(in, 0, sizeof(in));
+        for (size_t i = 0; i < blocks; ++i) {
+            in[i * 16] = (unsigned char)i;
+            memcpy(in + i * 16 + 4, nonce, NONCE);
+        }
+        int len;
+        bool ok = EVP_EncryptUpdate(kgk_, out, &len, in, (int)(blocks * 16)) == 1;
+        for (size_t i = 0; i < blocks; ++i) memcpy(i < 2 ? authKey + i * 8 : encKey + (i - 2) * 8, out + i * 16, 8);
+        ok = ok && EVP_EncryptInit_ex(enc_, ecb_, NULL, encKey, NULL) == 1 && EVP_CIPHER_CTX_set_padding(enc_, 0) == 1;
+        h_.lo = le64(authKey);
+        h_.hi = le64(authKey + 8);
+        OPENSSL_cleanse(out, sizeof(out));
+        OPENSSL_cleanse(encKey, sizeof(encKey));
+        OPENSSL_cleanse(authKey, sizeof(authKey));
+        return ok;
+    }
+
+    // s = s * H * x^-128 mod x^128 + x^127 + x^126 + x^121 + 1: a
+    // Karatsuba product, then two Montgomery steps that each add a
+    // multiple of the polynomial to clear the low word and drop it.
+    void dot(Elem* s) const {
+        uint64_t a0, a1, b0, b1, c0, c1;
+        clmul(s->lo, h_.lo, &a0, &a1);
+        clmul(s->hi, h_.hi, &b0, &b1);
+        clmul(s->lo ^ s->hi, h_.lo ^ h_.hi, &c0, &c1);
+        c0 ^= a0 ^ b0;
+        c1 ^= a1 ^ b1;
+        uint64_t w0 = a0, w1 = a1 ^ c0, w2 = b0 ^ c1, w3 = b1;
+        w1 ^= (w0 << 63) ^ (w0 << 62) ^ (w0 << 57);
+        w2 ^= w0 ^ (w0 >> 1) ^ (w0 >> 2) ^ (w0 >> 7);
+        w2 ^= (w1 << 63) ^ (w1 << 62) ^ (w1 << 57);
+        w3 ^= w1 ^ (w1 >> 1) ^ (w1 >> 2) ^ (w1 >> 7);
+        s->lo = w2;
+        s->hi = w3;
+    }
+
+    void absorb(Elem* s, const unsigned char* data, size_t len) const {
+        for (size_t off = 0; off < len; off += 16) {
+            unsigned char block[16] = { 0 };
+            size_t n = len - off < 16 ? len - off : 16;
+            memcpy(block, data + off, n);
+            s->lo ^= le64(block);
+            s->hi ^= le64(block + 8);
+            dot(s);
+        }
+    }
+
+    // POLYVAL(H, pad(AAD) || pad(plaintext) || LE64(bits(AAD)) || LE64(bits(plaintext)))
+    bool polyval(ConstByteSpan aad, ConstByteSpan plain, unsigned char* out) const {
+        Elem s = { 0, 0 };
+        absorb(&s, aad.data, aad.size);
+        absorb(&s, plain.data, plain.size);
+        s.lo ^= (uint64_t)aad.size * 8;
+        s.hi ^= (uint64_t)plain.size * 8;
+        dot(&s);
+        putLe64(out, s.lo);
+        putLe64(out + 8, s.hi);
+        return true;
+    }
+
+    // tag = AES(encKey, (S ^ nonce) with the top bit cleared)
+    bool tagFrom(unsigned char* s, const unsigned char* nonce, unsigned char* tag) {
+        for (size_t i = 0; i < NONCE; ++i) s[i] ^= nonce[i];
+        s[15] &= 0x7f;
+        int len;
+        return EVP_EncryptUpdate(enc_, tag, &len, s, 16) == 1;
+    }
+
+    // CTR with the tag (top bit set) as the initial block and a 32-bit
+    // little-endian counter in its first four bytes -- not EVP's CTR.
+    bool ctr(const unsigned char* tag, ConstByteSpan in, unsigned char* out) {
+        static const size_t TILE = 64;
+        unsigned char counters[TILE * 16], stream[TILE * 16];
+        unsigned char cb[16];
+        memcpy(cb, tag, 16);
+        cb[15] |= 0x80;
+        uint32_t c = (uint32_t)cb[0] | (uint32_t)cb[1] << 8 | (uint32_t)cb[2] << 16 | (uint32_t)cb[3] << 24;
+        bool ok = true;
+        for (size_t off = 0; ok && off < in.size; off += TILE * 16) {
+            size_t n = in.size - off < TILE * 16 ? in.size - off : TILE * 16;
+            size_t blocks = (n + 15) / 16;
+            for (size_t b = 0; b < blocks; ++b, ++c) {
+                memcpy(counters + b * 16, cb, 16);
+                for (int i = 0; i < 4; ++i) counters[b * 16 + i] = (unsigned char)(c >> (8 * i));
+            }
+            int len;
+            ok = EVP_EncryptUpdate(enc_, stream, &len, counters, (int)(blocks * 16)) == 1;
+            for (size_t i = 0; ok && i < n; ++i) out[off + i] = in.data[off + i] ^ stream[i];
+        }
+        OPENSSL_cleanse(stream, sizeof(stream));
+        return ok;
+    }
+
+    const EVP_CIPHER* ecb_;
+    EVP_CIPHER_CTX* kgk_; // keyed with the key-generating key
+    EVP_CIPHER_CTX* enc_; // re-keyed with each message's encryption key
+    Elem h_; // this message's POLYVAL key
+#endif
+};
+
+#endif
@@ -1,66 +1,134 @@
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_ctx_pool.h"
+#include "cipher_span.h"
 
 void handleErrors() {
     std::cerr << "Error occurred!" << std::endl;
     exit(1);
 }
 
-int main() {
+// Seal + open of one message with a fresh context per direction, the
+// pattern of the demo below before the pool.
+static bool roundTripFresh(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                           const unsigned char* in, int len, unsigned char* ct, unsigned char* pt) {
+    unsigned char tag[16];
+    int n, tail;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_EncryptInit_ex(ctx, aes, NULL, key, iv) == 1 &&
+              EVP_EncryptUpdate(ctx, ct, &n, in, len) == 1 && EVP_EncryptFinal_ex(ctx, ct + n, &tail) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) return false;
+    ctx = EVP_CIPHER_CTX_new();
+    ok = ctx && EVP_DecryptInit_ex(ctx, aes, NULL, key, iv) == 1 &&
+         EVP_DecryptUpdate(ctx, pt, &n, ct, len) == 1 && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag) == 1 &&
+         EVP_DecryptFinal_ex(ctx, pt + n, &tail) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+// Same round trip through the per-thread pool: only the nonce is re-armed.
+static bool roundTripPooled(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                            const unsigned char* in, int len, unsigned char* ct, unsigned char* pt) {
+    unsigned char tag[16];
+    int n, tail;
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(aes, key, iv, true);
+    if (!ctx || EVP_EncryptUpdate(ctx, ct, &n, in, len) != 1 || EVP_EncryptFinal_ex(ctx, ct + n, &tail) != 1 ||
+        EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag) != 1)
+        return false;
+    ctx = CipherCtxPool::arm(aes, key, iv, false);
+    return ctx && EVP_DecryptUpdate(ctx, pt, &n, ct, len) == 1 &&
+           EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag) == 1 && EVP_DecryptFinal_ex(ctx, pt + n, &tail) == 1;
+}
+
+static int benchPool(const EVP_CIPHER* aes) {
+    // A benchmark may repeat a nonce; real messages never may.
+    unsigned char key[32], iv[12], in[1024], ct[1024], pt[1024];
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv)) || !RAND_bytes(in, sizeof(in))) handleErrors();
+    const int iterations = 500000;
+    std::cout << "AES-" << EVP_CIPHER_get_key_length(aes) * 8 << "-GCM round trips (seal + open), messages/sec"
+              << std::endl;
+    std::cout << "Message      fresh ctx       pooled   speedup" << std::endl;
+    for (int size = 64; size <= 1024; size *= 16) {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            if (!roundTripFresh(aes, key, iv, in, size, ct, pt)) handleErrors();
+        double fresh = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            if (!roundTripPooled(aes, key, iv, in, size, ct, pt)) handleErrors();
+        double pooled = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (memcmp(in, pt, (size_t)size) != 0) handleErrors();
+        printf("%5d B   %12.0f %12.0f   %6.2fx\n", size, iterations / fresh, iterations / pooled, fresh / pooled);
+    }
+    std::cout << "Pool hits " << CipherCtxPool::hits() << ", misses " << CipherCtxPool::misses() << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:")) != -1) {
+        if (opt == 'k')
+            bits = atoi(optarg);
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* aes = AesDispatch::cipher("GCM", bits);
+    bool isBench = optind == argc - 1 && strcmp(argv[optind], "bench") == 0;
+    if (!aes || (!isBench && optind != argc)) {
+        std::cerr << "Usage: " << argv[0] << " [-k 128|192|256] [bench]\n"
+                  << "       " << argv[0] << " --cpu-report\n";
+        return 1;
+    }
+    if (isBench) return benchPool(aes);
+
     // Key and IV
-    unsigned char key[16]; // 128-bit key
+    const int keyLen = bits / 8;
+    unsigned char key[32]; // 128-, 192- or 256-bit key
     unsigned char iv[12];  // 96-bit nonce for GCM
-    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    if (!RAND_bytes(key, keyLen) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
 
-    // Data
+    // Data, sealed in place in a buffer the caller owns
     const char* plaintext = "This is AES gcm.";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
+    std::vector<unsigned char> message(plaintext, plaintext + strlen(plaintext));
     unsigned char tag[16];
 
-    // Encrypt
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    // Encrypt: a pooled context keyed once per thread, re-armed with the nonce
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(aes, key, iv, true);
     if (!ctx) handleErrors();
-    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL)) handleErrors();
-    if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
-
-    int len;
-    int ciphertext_len;
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, (unsigned char*)plaintext, plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
-    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag)) handleErrors();
+    if (!CipherSpan::seal(ctx, ConstByteSpan(), message, message, ByteSpan(tag, sizeof(tag)))) handleErrors();
 
     std::cout << "Key: ";
-    for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)key[i];
+    for (int i = 0; i < keyLen; ++i) std::cout << std::hex << (int)key[i];
     std::cout << "\nIV: ";
     for (int i = 0; i < 12; ++i) std::cout << std::hex << (int)iv[i];
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
+    for (size_t i = 0; i < message.size(); ++i) std::cout << std::hex << (int)message[i];
     std::cout << "\nTag: ";
     for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)tag[i];
     std::cout << std::endl;
 
-    EVP_CIPHER_CTX_free(ctx);
-
-    // Decrypt
-    ctx = EVP_CIPHER_CTX_new();
+    // Decrypt in place; the buffer is only trusted once the tag verifies
+    ctx = CipherCtxPool::arm(aes, key, iv, false);
     if (!ctx) handleErrors();
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_gcm(), NULL, NULL, NULL)) handleErrors();
-    if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
-    unsigned char decrypted[128];
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    if (1 != EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_SET_TAG, 16, tag)) handleErrors();
-    int ret = EVP_DecryptFinal_ex(ctx, decrypted + len, &len);
-    if (ret > 0) {
-        decrypted[plaintext_len] = '\0';
-        std::cout << "Decrypted: " << decrypted << std::endl;
+    if (CipherSpan::open(ctx, ConstByteSpan(), message, message, ConstByteSpan(tag, sizeof(tag)))) {
+        std::cout << "Decrypted: " << std::string(message.begin(), message.end()) << std::endl;
     } else {
         std::cout << "Decryption failed!" << std::endl;
     }
-    EVP_CIPHER_CTX_free(ctx);
     return 0;
 }
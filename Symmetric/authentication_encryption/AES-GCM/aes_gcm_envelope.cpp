@@ -0,0 +1,167 @@
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "envelope.h"
+
+// Envelope encryption of objects of any size: AES-256-GCM under a fresh
+// data key per object, with the data key wrapped by RSA-OAEP or AES-KW.
+// The benchmark reads objects back with and without the DEK cache.
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+// Zipf(s) over [0, n) by inverse CDF on a precomputed table.
+class Zipf {
+public:
+    Zipf(size_t n, double s, unsigned seed) : cdf_(n), rng_(seed), uniform_(0.0, 1.0) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) cdf_[i] = (sum += 1.0 / std::pow((double)(i + 1), s));
+        for (size_t i = 0; i < n; ++i) cdf_[i] /= sum;
+    }
+    size_t next() {
+        return (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), uniform_(rng_)) - cdf_.begin());
+    }
+
+private:
+    std::vector<double> cdf_;
+    std::mt19937_64 rng_;
+    std::uniform_real_distribution<double> uniform_;
+};
+
+struct Options {
+    size_t objects = 1000;
+    size_t reads = 5000;
+    size_t size = 4096;
+    size_t capacity = 256;
+    double zipf = 1.0;
+};
+
+// Reads o.reads objects (Zipf-distributed) through reader, timing each one.
+static void readAll(const Options& o, const std::vector<std::vector<unsigned char> >& objects, KeyWrapper* wrapper,
+                    size_t capacity) {
+    EnvelopeReader reader(wrapper, capacity);
+    Zipf pick(o.objects, o.zipf, 1234);
+    std::vector<double> micros(o.reads);
+    std::vector<unsigned char> payload;
+    double total = 0;
+    for (size_t r = 0; r < o.reads; ++r) {
+        const std::vector<unsigned char>& object = objects[pick.next()];
+        auto t0 = std::chrono::steady_clock::now();
+        if (!reader.open(object, &payload)) handleErrors();
+        micros[r] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+        total += micros[r];
+    }
+    std::sort(micros.begin(), micros.end());
+    char cache[32];
+    if (capacity)
+        snprintf(cache, sizeof(cache), "%zu", capacity);
+    else
+        snprintf(cache, sizeof(cache), "off");
+    printf("%-9s %6s %9llu %9llu %10.1f %9.1f %9.1f\n", wrapper->name(), cache, reader.unwraps(),
+           reader.reads() - reader.unwraps(), total / o.reads, micros[o.reads / 2], micros[o.reads * 99 / 100]);
+}
+
+static int bench(const Options& o, KeyWrapper* rsa, KeyWrapper* kw) {
+    std::vector<unsigned char> payload(o.size);
+    if (!RAND_bytes(payload.data(), (int)payload.size())) handleErrors();
+    std::cout << o.objects << " objects of " << o.size << " B (AES-256-GCM), " << o.reads
+              << " reads (Zipf s=" << o.zipf << "), RSA-2048" << std::endl;
+    printf("%-9s %6s %9s %9s %10s %9s %9s\n", "Wrap", "Cache", "Unwraps", "Saved", "Mean us", "p50 us", "p99 us");
+    KeyWrapper* wrappers[] = { rsa, kw };
+    for (int w = 0; w < 2; ++w) {
+        std::vector<std::vector<unsigned char> > objects(o.objects);
+        for (size_t i = 0; i < o.objects; ++i)
+            if (!Envelope::seal(wrappers[w], payload, &objects[i])) handleErrors();
+        readAll(o, objects, wrappers[w], 0);
+        readAll(o, objects, wrappers[w], o.capacity);
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:r:s:c:z:")) != -1) {
+        if (opt == 'n')
+            o.objects = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'r')
+            o.reads = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 's')
+            o.size = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'c')
+            o.capacity = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'z')
+            o.zipf = atof(optarg);
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    bool isBench = optind == argc - 1 && strcmp(argv[optind], "bench") == 0;
+    if ((!isBench && optind != argc) || o.objects == 0 || o.reads == 0 || o.size == 0 || o.size > (size_t)INT_MAX) {
+        std::cerr << "Usage: " << argv[0] << "                                   # demonstration\n"
+                  << "       " << argv[0] << " [-n objects] [-r reads] [-s size] [-c cache_capacity] [-z zipf_s] bench\n"
+                  << "       " << argv[0] << " --cpu-report\n";
+        return 1;
+    }
+
+    // The key-encryption keys: an RSA-2048 pair (as rsa_create_key makes)
+    // and a 256-bit AES master key.
+    EVP_PKEY* pkey = EVP_RSA_gen(2048);
+    unsigned char master[32];
+    if (!pkey || !RAND_bytes(master, sizeof(master))) handleErrors();
+    RsaOaepWrapper rsa(pkey);
+    AesKwWrapper kw(master, sizeof(master));
+    EVP_PKEY_free(pkey);
+    OPENSSL_cleanse(master, sizeof(master));
+    if (!kw.ok()) handleErrors();
+    if (isBench) return bench(o, &rsa, &kw);
+
+    // RSA-OAEP (SHA-256) alone takes at most modulus - 66 bytes.
+    std::string text;
+    while (text.size() < 1000) text += "Envelope encryption seals any amount of data. ";
+    std::cout << "RSA-2048 OAEP limit: " << 256 - 2 * 32 - 2 << " bytes; payload: " << text.size() << " bytes"
+              << std::endl;
+
+    std::vector<unsigned char> object, payload;
+    KeyWrapper* wrappers[] = { &rsa, &kw };
+    bool ok = true;
+    for (int w = 0; w < 2; ++w) {
+        if (!Envelope::seal(wrappers[w], text, &object)) handleErrors();
+        Envelope::Parts parts;
+        if (!Envelope::parse(object, &parts)) handleErrors();
+        std::cout << wrappers[w]->name() << ": object " << object.size() << " bytes (wrapped DEK "
+                  << parts.wrapped.size << ", nonce " << parts.nonce.size << ", ciphertext " << parts.ciphertext.size
+                  << ", tag " << parts.tag.size << ")" << std::endl;
+
+        // Three reads of the same object through a cached reader: one unwrap.
+        EnvelopeReader reader(wrappers[w], 16);
+        for (int i = 0; i < 3; ++i) ok = reader.open(object, &payload) && ok;
+        ok = ok && std::string(payload.begin(), payload.end()) == text;
+        std::cout << "  3 reads: " << (ok ? "decrypted" : "FAILED") << ", " << reader.unwraps() << " unwrap"
+                  << std::endl;
+
+        // A flipped ciphertext bit fails the GCM tag.
+        object[parts.ciphertext.data - object.data()] ^= 1;
+        bool accepted = EnvelopeReader(wrappers[w], 0).open(object, &payload);
+        std::cout << "  Tampered ciphertext: " << (accepted ? "ACCEPTED" : "rejected") << std::endl;
+        ok = ok && !accepted;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,449 @@
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/kdf.h>
+#include <openssl/params.h>
+#include <openssl/rand.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include "aes_dispatch.h"
+
+// Segmented AES-256-GCM file format (STREAM construction, as in age):
+//
+//   header:  "AESGCMS1" | segment size (4 bytes BE) | 4 zero bytes | salt (16)
+//   body:    segment 0 | segment 1 | ... | final segment
+//   segment: ciphertext of up to <segment size> plaintext bytes | tag (16)
+//
+// The file key is HKDF-SHA256(master key, salt), so every file has a fresh
+// key and segment nonces can simply count: nonce = index (11 bytes BE) |
+// last flag (1 byte).  The index stops reordering or dropping segments, the
+// last flag stops truncation at a segment boundary, and the header is the
+// AAD of every segment so its fields cannot be altered.  Segments are
+// independent GCM messages and therefore encrypt and decrypt in parallel.
+
+static const char MAGIC[8] = { 'A', 'E', 'S', 'G', 'C', 'M', 'S', '1' };
+static const size_t HEADER_LEN = 32;
+static const size_t TAG_LEN = 16;
+static const size_t KEY_LEN = 32;
+static const size_t MAX_SEGMENT = 64 << 20;
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static void fail(const std::string& message) {
+    std::cerr << message << std::endl;
+    exit(1);
+}
+
+static bool deriveFileKey(const unsigned char* master, const unsigned char* salt, unsigned char* fileKey) {
+    EVP_KDF* kdf = EVP_KDF_fetch(NULL, "HKDF", NULL);
+    if (!kdf) return false;
+    EVP_KDF_CTX* kctx = EVP_KDF_CTX_new(kdf);
+    EVP_KDF_free(kdf);
+    if (!kctx) return false;
+    char digest[] = "SHA256";
+    char info[] = "aes-gcm-stream v1";
+    OSSL_PARAM params[5];
+    params[0] = OSSL_PARAM_construct_utf8_string(OSSL_KDF_PARAM_DIGEST, digest, 0);
+    params[1] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_KEY, (void*)master, KEY_LEN);
+    params[2] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_SALT, (void*)salt, 16);
+    params[3] = OSSL_PARAM_construct_octet_string(OSSL_KDF_PARAM_INFO, info, strlen(info));
+    params[4] = OSSL_PARAM_construct_end();
+    bool ok = EVP_KDF_derive(kctx, fileKey, KEY_LEN, params) == 1;
+    EVP_KDF_CTX_free(kctx);
+    return ok;
+}
+
+struct Segment {
+    std::vector<unsigned char> in;
+    std::vector<unsigned char> out;
+    size_t inLen;
+    size_t outLen;
+    uint64_t index;
+    bool last;
+    bool ok;
+};
+
+// Per-thread cipher state: the context is keyed once and each segment only
+// sets a new nonce, so no key schedule is repeated per segment.
+class SegmentCipher {
+public:
+    SegmentCipher(const unsigned char* key, const unsigned char* header, bool encrypt)
+        : ctx_(EVP_CIPHER_CTX_new()), header_(header), encrypt_(encrypt) {
+        if (!ctx_ || 1 != EVP_CipherInit_ex(ctx_, EVP_aes_256_gcm(), NULL, key, NULL, encrypt ? 1 : 0)) handleErrors();
+    }
+    ~SegmentCipher() { EVP_CIPHER_CTX_free(ctx_); }
+
+    void process(Segment& s) {
+        unsigned char nonce[12];
+        for (int i = 0; i < 11; ++i) nonce[i] = (unsigned char)(i < 3 ? 0 : s.index >> (8 * (10 - i)));
+        nonce[11] = s.last ? 1 : 0;
+        s.ok = false;
+        s.outLen = 0;
+        size_t dataLen = s.inLen;
+        if (!encrypt_) {
+            if (s.inLen < TAG_LEN) return;
+            dataLen -= TAG_LEN;
+        }
+        int len;
+        if (1 != EVP_CipherInit_ex(ctx_, NULL, NULL, NULL, nonce, -1)) return;
+        if (1 != EVP_CipherUpdate(ctx_, NULL, &len, header_, (int)HEADER_LEN)) return;
+        if (!encrypt_ && 1 != EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_SET_TAG, TAG_LEN, &s.in[dataLen])) return;
+        if (1 != EVP_CipherUpdate(ctx_, s.out.data(), &len, s.in.data(), (int)dataLen)) return;
+        int tail;
+        if (1 != EVP_CipherFinal_ex(ctx_, s.out.data() + len, &tail)) return;
+        s.outLen = (size_t)(len + tail);
+        if (encrypt_) {
+            if (1 != EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_GCM_GET_TAG, TAG_LEN, &s.out[s.outLen])) return;
+            s.outLen += TAG_LEN;
+        }
+        s.ok = true;
+    }
+
+private:
+    EVP_CIPHER_CTX* ctx_;
+    const unsigned char* header_;
+    bool encrypt_;
+    SegmentCipher(const SegmentCipher&);
+    SegmentCipher& operator=(const SegmentCipher&);
+};
+
+// Fixed set of workers that process one batch of segments at a time; the
+// caller reads the next batch and writes the previous one meanwhile.
+class SegmentPool {
+public:
+    SegmentPool(unsigned threads, const unsigned char* key, const unsigned char* header, bool encrypt)
+        : batch_(NULL), count_(0), next_(0), active_(0), generation_(0), stop_(false) {
+        for (unsigned i = 0; i < threads; ++i) workers_.push_back(std::thread(&SegmentPool::run, this, key, header, encrypt));
+    }
+
+    ~SegmentPool() {
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            stop_ = true;
+        }
+        wake_.notify_all();
+        for (size_t i = 0; i < workers_.size(); ++i) workers_[i].join();
+    }
+
+    void start(std::vector<Segment>* batch, size_t count) {
+        std::lock_guard<std::mutex> guard(lock_);
+        batch_ = batch;
+        count_ = count;
+        next_ = 0;
+        active_ = workers_.size();
+        ++generation_;
+        wake_.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> guard(lock_);
+        done_.wait(guard, [this] { return active_ == 0; });
+    }
+
+private:
+    void run(const unsigned char* key, const unsigned char* header, bool encrypt) {
+        SegmentCipher cipher(key, header, encrypt);
+        unsigned long long seen = 0;
+        for (;;) {
+            std::vector<Segment>* batch;
+            size_t count;
+            {
+                std::unique_lock<std::mutex> guard(lock_);
+                wake_.wait(guard, [&] { return stop_ || generation_ != seen; });
+                if (stop_) return;
+                seen = generation_;
+                batch = batch_;
+                count = count_;
+            }
+            for (size_t i; (i = next_.fetch_add(1)) < count;) cipher.process((*batch)[i]);
+            // Every worker checks in for every batch, so none can still be
+            // claiming from this one when the next starts.
+            std::lock_guard<std::mutex> guard(lock_);
+            if (--active_ == 0) done_.notify_one();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    std::vector<Segment>* batch_;
+    size_t count_;
+    std::atomic<size_t> next_;
+    size_t active_;
+    unsigned long long generation_;
+    bool stop_;
+};
+
+static size_t readFull(int fd, unsigned char* buf, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = read(fd, buf + done, len - done);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            fail(std::string("Read error: ") + strerror(errno));
+        }
+        done += (size_t)n;
+    }
+    return done;
+}
+
+static void writeFull(int fd, const unsigned char* buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) fail(std::string("Write error: ") + strerror(errno));
+        buf += n;
+        len -= (size_t)n;
+    }
+}
+
+// Reads fixed-size segments and tells whether each is the final one by
+// peeking one byte ahead, so pipes work as well as files.
+class SegmentReader {
+public:
+    explicit SegmentReader(int fd) : fd_(fd), haveCarry_(false), carry_(0), eof_(false) {}
+
+    size_t next(unsigned char* buf, size_t len, bool* last) {
+        size_t got = 0;
+        if (haveCarry_) {
+            buf[0] = carry_;
+            got = 1;
+            haveCarry_ = false;
+        }
+        got += readFull(fd_, buf + got, len - got);
+        *last = got < len || readFull(fd_, &carry_, 1) == 0;
+        haveCarry_ = !*last;
+        eof_ = *last;
+        return got;
+    }
+
+    bool eof() const { return eof_; }
+
+private:
+    int fd_;
+    bool haveCarry_;
+    unsigned char carry_;
+    bool eof_;
+};
+
+static bool loadKey(const char* path, unsigned char* key) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+    size_t n = readFull(fd, key, KEY_LEN);
+    close(fd);
+    return n == KEY_LEN;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << " keygen <keyfile>\n"
+              << "       " << prog << " encrypt -k <keyfile> [-s segment_kib] [-j threads] <in|-> <out|->\n"
+              << "       " << prog << " decrypt -k <keyfile> [-j threads] <in|-> <out|->\n"
+              << "       " << prog << " bench [-s segment_kib] [-j threads] [-m mib]\n"
+              << "       " << prog << " --cpu-report\n";
+    exit(1);
+}
+
+// Streams in -> out through the pool with two batches in flight: while the
+// workers process one, the main thread writes the previous and reads the
+// next.  Memory is two batches regardless of file size.
+static bool streamFile(int in, int out, const unsigned char* fileKey, const unsigned char* header,
+                       size_t segmentSize, unsigned threads, bool encrypt) {
+    size_t inSize = encrypt ? segmentSize : segmentSize + TAG_LEN;
+    size_t outSize = segmentSize + TAG_LEN;
+    size_t perBatch = threads * 4;
+    std::vector<Segment> batches[2];
+    for (int b = 0; b < 2; ++b) {
+        batches[b].resize(perBatch);
+        for (size_t i = 0; i < perBatch; ++i) {
+            batches[b][i].in.resize(inSize);
+            batches[b][i].out.resize(outSize);
+        }
+    }
+    SegmentReader reader(in);
+    uint64_t index = 0;
+    bool sawLast = false;
+    auto fill = [&](std::vector<Segment>& batch) {
+        size_t count = 0;
+        while (count < perBatch && !reader.eof()) {
+            Segment& s = batch[count++];
+            s.inLen = reader.next(s.in.data(), inSize, &s.last);
+            s.index = index++;
+            sawLast = s.last;
+        }
+        return count;
+    };
+
+    SegmentPool pool(threads, fileKey, header, encrypt);
+    int cur = 0;
+    size_t count = fill(batches[cur]);
+    bool ok = true;
+    while (count > 0) {
+        pool.start(&batches[cur], count);
+        size_t nextCount = fill(batches[1 - cur]);
+        pool.wait();
+        for (size_t i = 0; i < count; ++i) {
+            Segment& s = batches[cur][i];
+            if (!s.ok) {
+                std::cerr << "Segment " << s.index << " failed authentication" << std::endl;
+                return false;
+            }
+            // Each verified segment is released as soon as its batch is done.
+            writeFull(out, s.out.data(), s.outLen);
+            if (!encrypt) OPENSSL_cleanse(s.out.data(), s.outLen);
+        }
+        cur = 1 - cur;
+        count = nextCount;
+    }
+    if (!sawLast) {
+        std::cerr << "Stream truncated" << std::endl;
+        ok = false;
+    }
+    return ok;
+}
+
+static void makeHeader(unsigned char* header, size_t segmentSize, const unsigned char* salt) {
+    memcpy(header, MAGIC, sizeof(MAGIC));
+    for (int i = 0; i < 4; ++i) header[8 + i] = (unsigned char)(segmentSize >> (24 - 8 * i));
+    memset(header + 12, 0, 4);
+    memcpy(header + 16, salt, 16);
+}
+
+static int bench(size_t segmentSize, unsigned threads, size_t mib) {
+    unsigned char master[KEY_LEN], salt[16], header[HEADER_LEN], fileKey[KEY_LEN];
+    if (!RAND_bytes(master, sizeof(master)) || !RAND_bytes(salt, sizeof(salt))) handleErrors();
+    makeHeader(header, segmentSize, salt);
+    if (!deriveFileKey(master, salt, fileKey)) handleErrors();
+
+    size_t segments = (mib << 20) / segmentSize;
+    if (segments == 0) segments = 1;
+    std::vector<Segment> batch(segments);
+    for (size_t i = 0; i < segments; ++i) {
+        batch[i].in.assign(segmentSize, (unsigned char)i);
+        batch[i].out.resize(segmentSize + TAG_LEN);
+        batch[i].inLen = segmentSize;
+        batch[i].index = i;
+        batch[i].last = i + 1 == segments;
+    }
+    std::cout << "Segments: " << segments << " x " << (segmentSize >> 10) << " KiB, threads: " << threads << std::endl;
+    for (int pass = 0; pass < 2; ++pass) {
+        bool encrypt = pass == 0;
+        SegmentPool pool(threads, fileKey, header, encrypt);
+        if (!encrypt) {
+            for (size_t i = 0; i < segments; ++i) {
+                batch[i].in.swap(batch[i].out);
+                batch[i].inLen = batch[i].outLen;
+                batch[i].out.resize(segmentSize + TAG_LEN);
+            }
+        }
+        auto start = std::chrono::steady_clock::now();
+        pool.start(&batch, segments);
+        pool.wait();
+        double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        for (size_t i = 0; i < segments; ++i) {
+            if (!batch[i].ok) fail("Benchmark segment failed");
+        }
+        printf("%-8s %8.2f GB/s\n", encrypt ? "encrypt" : "decrypt", segments * segmentSize / s / 1e9);
+    }
+    OPENSSL_cleanse(master, sizeof(master));
+    OPENSSL_cleanse(fileKey, sizeof(fileKey));
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    if (argc < 2) usage(argv[0]);
+    std::string command = argv[1];
+    if (command == "keygen") {
+        if (argc != 3) usage(argv[0]);
+        unsigned char key[KEY_LEN];
+        if (!RAND_bytes(key, sizeof(key))) handleErrors();
+        int fd = open(argv[2], O_WRONLY | O_CREAT | O_EXCL, 0600);
+        if (fd < 0) fail(std::string("Cannot create ") + argv[2] + ": " + strerror(errno));
+        writeFull(fd, key, sizeof(key));
+        close(fd);
+        OPENSSL_cleanse(key, sizeof(key));
+        return 0;
+    }
+
+    const char* keyFile = NULL;
+    size_t segmentSize = 64 << 10;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    size_t mib = 1024;
+    optind = 2;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:s:j:m:")) != -1) {
+        if (opt == 'k')
+            keyFile = optarg;
+        else if (opt == 's')
+            segmentSize = (size_t)strtoul(optarg, NULL, 10) << 10;
+        else if (opt == 'j')
+            threads = (unsigned)atoi(optarg);
+        else if (opt == 'm')
+            mib = (size_t)strtoul(optarg, NULL, 10);
+        else
+            usage(argv[0]);
+    }
+    if (threads == 0 || segmentSize == 0 || segmentSize > MAX_SEGMENT) usage(argv[0]);
+    if (command == "bench") return bench(segmentSize, threads, mib);
+    if ((command != "encrypt" && command != "decrypt") || !keyFile || optind != argc - 2) usage(argv[0]);
+    bool encrypt = command == "encrypt";
+
+    unsigned char master[KEY_LEN];
+    if (!loadKey(keyFile, master)) fail(std::string("Cannot read 32-byte key from ") + keyFile);
+    const char* inPath = argv[optind];
+    const char* outPath = argv[optind + 1];
+    int in = strcmp(inPath, "-") == 0 ? 0 : open(inPath, O_RDONLY);
+    if (in < 0) fail(std::string("Cannot open ") + inPath + ": " + strerror(errno));
+    bool toStdout = strcmp(outPath, "-") == 0;
+    int out = toStdout ? 1 : open(outPath, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (out < 0) fail(std::string("Cannot create ") + outPath + ": " + strerror(errno));
+
+    unsigned char header[HEADER_LEN];
+    if (encrypt) {
+        unsigned char salt[16];
+        if (!RAND_bytes(salt, sizeof(salt))) handleErrors();
+        makeHeader(header, segmentSize, salt);
+        writeFull(out, header, HEADER_LEN);
+    } else {
+        if (readFull(in, header, HEADER_LEN) != HEADER_LEN || memcmp(header, MAGIC, sizeof(MAGIC)) != 0)
+            fail("Not an AES-GCM stream");
+        segmentSize = 0;
+        for (int i = 0; i < 4; ++i) segmentSize = (segmentSize << 8) | header[8 + i];
+        if (segmentSize == 0 || segmentSize > MAX_SEGMENT) fail("Bad segment size in header");
+    }
+    unsigned char fileKey[KEY_LEN];
+    if (!deriveFileKey(master, header + 16, fileKey)) handleErrors();
+    OPENSSL_cleanse(master, sizeof(master));
+
+    bool ok = streamFile(in, out, fileKey, header, segmentSize, threads, encrypt);
+    OPENSSL_cleanse(fileKey, sizeof(fileKey));
+    if (in != 0) close(in);
+    if (!toStdout && close(out) != 0) ok = false;
+    if (!ok) {
+        // Segments already written were authentic, but the file as a whole
+        // is not; do not leave a plausible-looking partial output behind.
+        if (!toStdout) unlink(outPath);
+        std::cerr << (encrypt ? "Encryption failed!" : "Decryption failed!") << std::endl;
+        return 1;
+    }
+    return 0;
+}
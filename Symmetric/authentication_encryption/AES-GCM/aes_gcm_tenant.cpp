@@ -0,0 +1,166 @@
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "gcm_key_cache.h"
+
+// Simulated multi-tenant gateway: every request seals a payload under the
+// key of a tenant drawn from a Zipf distribution (a few hot tenants, a
+// long tail).  Compares a fresh context plus key expansion per request
+// with the sharded key-schedule cache.
+
+static const size_t PAYLOAD = 256;
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+// Tenant keys as a KMS would return them; generated once up front.
+static std::vector<std::vector<unsigned char> > g_tenantKeys;
+
+static bool loadTenantKey(const std::string& keyId, unsigned char* key, size_t* keyLen) {
+    size_t tenant = (size_t)strtoul(keyId.c_str() + 7, NULL, 10); // "tenant-<n>"
+    if (tenant >= g_tenantKeys.size()) return false;
+    memcpy(key, g_tenantKeys[tenant].data(), 32);
+    *keyLen = 32;
+    return true;
+}
+
+// Zipf(s) over [0, n) by inverse CDF on a precomputed table.
+class Zipf {
+public:
+    Zipf(size_t n, double s, unsigned seed) : cdf_(n), rng_(seed), uniform_(0.0, 1.0) {
+        double sum = 0;
+        for (size_t i = 0; i < n; ++i) cdf_[i] = (sum += 1.0 / std::pow((double)(i + 1), s));
+        for (size_t i = 0; i < n; ++i) cdf_[i] /= sum;
+    }
+    size_t next() {
+        return (size_t)(std::lower_bound(cdf_.begin(), cdf_.end(), uniform_(rng_)) - cdf_.begin());
+    }
+
+private:
+    std::vector<double> cdf_;
+    std::mt19937_64 rng_;
+    std::uniform_real_distribution<double> uniform_;
+};
+
+static bool sealWith(EVP_CIPHER_CTX* ctx, const unsigned char* nonce, const unsigned char* in, unsigned char* out,
+                     unsigned char* tag) {
+    int len, tail;
+    return EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, 1) == 1 &&
+           EVP_EncryptUpdate(ctx, out, &len, in, (int)PAYLOAD) == 1 && EVP_EncryptFinal_ex(ctx, out + len, &tail) == 1 &&
+           EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_GCM_GET_TAG, 16, tag) == 1;
+}
+
+struct Options {
+    size_t tenants = 1000;
+    size_t capacity = 256;
+    size_t shards = 16;
+    unsigned threads = 4;
+    size_t requests = 200000;
+    double zipf = 1.0;
+};
+
+// One worker's requests; cache == NULL runs the per-request-keying baseline.
+static void worker(const Options& o, GcmKeyCache* cache, unsigned id, bool* ok) {
+    Zipf tenants(o.tenants, o.zipf, 1234 + id);
+    unsigned char in[PAYLOAD], out[PAYLOAD], tag[16], nonce[12];
+    memset(in, 0x42, sizeof(in));
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    *ok = ctx != NULL;
+    char keyId[32];
+    for (size_t r = 0; *ok && r < o.requests; ++r) {
+        size_t tenant = tenants.next();
+        // Nonce = worker id | request number: unique per key in this run.
+        memset(nonce, 0, sizeof(nonce));
+        nonce[0] = (unsigned char)id;
+        for (int i = 0; i < 8; ++i) nonce[4 + i] = (unsigned char)(r >> (56 - 8 * i));
+        if (cache) {
+            snprintf(keyId, sizeof(keyId), "tenant-%zu", tenant);
+            *ok = cache->acquire(keyId, ctx) && sealWith(ctx, nonce, in, out, tag);
+        } else {
+            // aes_gcm.cpp's pattern: allocate, key and free per request.
+            EVP_CIPHER_CTX* fresh = EVP_CIPHER_CTX_new();
+            *ok = fresh && EVP_EncryptInit_ex(fresh, EVP_aes_256_gcm(), NULL, g_tenantKeys[tenant].data(), NULL) == 1 &&
+                  sealWith(fresh, nonce, in, out, tag);
+            EVP_CIPHER_CTX_free(fresh);
+        }
+    }
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+static double run(const Options& o, GcmKeyCache* cache) {
+    std::vector<std::thread> threads;
+    std::vector<char> ok(o.threads);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < o.threads; ++t)
+        threads.push_back(std::thread([&, t] {
+            bool good;
+            worker(o, cache, t, &good);
+            ok[t] = good;
+        }));
+    for (unsigned t = 0; t < o.threads; ++t) threads[t].join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    for (unsigned t = 0; t < o.threads; ++t)
+        if (!ok[t]) handleErrors();
+    return o.threads * o.requests / s;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:c:s:j:n:z:")) != -1) {
+        if (opt == 't')
+            o.tenants = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'c')
+            o.capacity = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 's')
+            o.shards = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'j')
+            o.threads = (unsigned)atoi(optarg);
+        else if (opt == 'n')
+            o.requests = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'z')
+            o.zipf = atof(optarg);
+        else {
+            std::cerr << "Usage: " << argv[0]
+                      << " [-t tenants] [-c capacity] [-s shards] [-j threads] [-n requests_per_thread] [-z zipf_s]\n"
+                      << "       " << argv[0] << " --cpu-report" << std::endl;
+            return 1;
+        }
+    }
+    if (o.tenants == 0 || o.threads == 0 || o.threads > 255) {
+        std::cerr << "Need at least one tenant and 1..255 threads" << std::endl;
+        return 1;
+    }
+
+    g_tenantKeys.resize(o.tenants, std::vector<unsigned char>(32));
+    for (size_t i = 0; i < o.tenants; ++i)
+        if (!RAND_bytes(g_tenantKeys[i].data(), 32)) handleErrors();
+
+    std::cout << o.tenants << " tenants (Zipf s=" << o.zipf << "), " << o.threads << " threads x " << o.requests
+              << " requests, " << PAYLOAD << "-byte AES-256-GCM seals" << std::endl;
+    double baseline = run(o, NULL);
+    printf("per-request keying: %10.0f requests/s\n", baseline);
+    GcmKeyCache cache(o.capacity, o.shards, loadTenantKey);
+    double cached = run(o, &cache);
+    printf("key-schedule cache: %10.0f requests/s  (%.2fx, capacity %zu in %zu shards)\n", cached, cached / baseline,
+           o.capacity, o.shards);
+    std::cout << cache.exportText();
+
+    for (size_t i = 0; i < g_tenantKeys.size(); ++i) OPENSSL_cleanse(g_tenantKeys[i].data(), 32);
+    return 0;
+}
@@ -0,0 +1,281 @@
+// Envelope encryption: a random per-object data key (DEK) seals the payload
+// with AES-256-GCM, and only the DEK is encrypted ("wrapped") under a
+// long-lived key-encryption key: RSA-OAEP for a public/private key pair,
+// or AES Key Wrap (RFC 3394) for a symmetric master key.  The payload can
+// be any size, the master key never touches bulk data, and re-keying the
+// master key only rewraps 32-byte DEKs.
+//
+// Object format:
+//
+//   "ENV1" | wrap kind (1) | wrapped DEK length (2, big-endian) | wrapped DEK
+//   | nonce (12) | ciphertext | tag (16)
+//
+// Everything before the nonce is GCM AAD, so a DEK cannot be swapped onto
+// another object's payload.
+//
+// Opening an object is dominated by the unwrap when that is an RSA private
+// key operation.  EnvelopeReader can keep unwrapped DEKs in a GcmKeyCache,
+// keyed by the wrapped DEK bytes, as keyed AES-GCM templates, so repeat
+// reads of an object skip both the unwrap and the AES key expansion.
+#ifndef ENVELOPE_H
+#define ENVELOPE_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/rsa.h>
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
+#include "gcm_key_cache.h"
+
+// Wraps and unwraps 32-byte DEKs.  Implementations create their OpenSSL
+// contexts per call, so one wrapper may be shared by several threads.
+class KeyWrapper {
+public:
+    static const size_t MAX_DEK = 32;
+
+    virtual ~KeyWrapper() {}
+    virtual unsigned char kind() const = 0;
+    virtual const char* name() const = 0;
+    virtual bool wrap(const unsigned char* dek, size_t len, std::vector<unsigned char>* wrapped) = 0;
+    // dek has room for MAX_DEK bytes.
+    virtual bool unwrap(ConstByteSpan wrapped, unsigned char* dek, size_t* len) = 0;
+};
+
+// RSA-OAEP with SHA-256 (OAEP and MGF1).  A public key can only wrap;
+// unwrapping needs the private key.
+class RsaOaepWrapper : public KeyWrapper {
+public:
+    explicit RsaOaepWrapper(EVP_PKEY* key) : key_(key) { EVP_PKEY_up_ref(key_); }
+    ~RsaOaepWrapper() { EVP_PKEY_free(key_); }
+
+    unsigned char kind() const { return 1; }
+    const char* name() const { return "RSA-OAEP"; }
+
+    bool wrap(const unsigned char* dek, size_t len, std::vector<unsigned char>* wrapped) {
+        EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(key_, NULL);
+        size_t outLen = 0;
+        bool ok = ctx && EVP_PKEY_encrypt_init(ctx) == 1 && oaep(ctx) &&
+                  EVP_PKEY_encrypt(ctx, NULL, &outLen, dek, len) == 1;
+        if (ok) {
+            wrapped->resize(outLen);
+            ok = EVP_PKEY_encrypt(ctx, wrapped->data(), &outLen, dek, len) == 1;
+            wrapped->resize(outLen);
+        }
+        EVP_PKEY_CTX_free(ctx);
+        return ok;
+    }
+
+    bool unwrap(ConstByteSpan wrapped, unsigned char* dek, size_t* len) {
+        // OAEP decodes into a modulus-sized buffer before the length check.
+        unsigned char buf[1024];
+        size_t outLen = sizeof(buf);
+        EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new(key_, NULL);
+        bool ok = ctx && (size_t)EVP_PKEY_get_size(key_) <= sizeof(buf) && EVP_PKEY_decrypt_init(ctx) == 1 &&
+                  oaep(ctx) && EVP_PKEY_decrypt(ctx, buf, &outLen, wrapped.data, wrapped.size) == 1 &&
+                  outLen <= MAX_DEK;
+        if (ok) {
+            memcpy(dek, buf, outLen);
+            *len = outLen;
+        }
+        OPENSSL_cleanse(buf, sizeof(buf));
+        EVP_PKEY_CTX_free(ctx);
+        return ok;
+    }
+
+private:
+    RsaOaepWrapper(const RsaOaepWrapper&);
+    RsaOaepWrapper& operator=(const RsaOaepWrapper&);
+
+    static bool oaep(EVP_PKEY_CTX* ctx) {
+        return EVP_PKEY_CTX_set_rsa_padding(ctx, RSA_PKCS1_OAEP_PADDING) == 1 &&
+               EVP_PKEY_CTX_set_rsa_oaep_md(ctx, EVP_sha256()) == 1 &&
+               EVP_PKEY_CTX_set_rsa_mgf1_md(ctx, EVP_sha256()) == 1;
+    }
+
+    EVP_PKEY* key_;
+};
+
+// AES Key Wrap (RFC 3394) under a 16-, 24- or 32-byte master key; the
+// wrapped DEK is 8 bytes longer than the DEK and carries its own
+// integrity check.
+class AesKwWrapper : public KeyWrapper {
+public:
+    AesKwWrapper(const unsigned char* kek, size_t kekLen)
+        : cipher_(kekLen == 16 ? EVP_aes_128_wrap() : kekLen == 24 ? EVP_aes_192_wrap()
+                  : kekLen == 32 ? EVP_aes_256_wrap() : NULL) {
+        memset(kek_, 0, sizeof(kek_));
+        if (cipher_) memcpy(kek_, kek, kekLen);
+    }
+    ~AesKwWrapper() { OPENSSL_cleanse(kek_, sizeof(kek_)); }
+
+    bool ok() const { return cipher_ != NULL; }
+    unsigned char kind() const { return 2; }
+    const char* name() const { return "AES-KW"; }
+
+    bool wrap(const unsigned char* dek, size_t len, std::vector<unsigned char>* wrapped) {
+        wrapped->resize(len + 8);
+        size_t outLen;
+        return run(true, ConstByteSpan(dek, len), wrapped->data(), &outLen) && outLen == len + 8;
+    }
+
+    bool unwrap(ConstByteSpan wrapped, unsigned char* dek, size_t* len) {
+        unsigned char buf[MAX_DEK + 8];
+        size_t outLen;
+        bool ok = wrapped.size >= 24 && wrapped.size <= sizeof(buf) && run(false, wrapped, buf, &outLen) &&
+                  outLen <= MAX_DEK;
+        if (ok) {
+            memcpy(dek, buf, outLen);
+            *len = outLen;
+        }
+        OPENSSL_cleanse(buf, sizeof(buf));
+        return ok;
+    }
+
+private:
+    AesKwWrapper(const AesKwWrapper&);
+    AesKwWrapper& operator=(const AesKwWrapper&);
+
+    bool run(bool encrypt, ConstByteSpan in, unsigned char* out, size_t* outLen) {
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        int len = 0, tail = 0;
+        if (ctx) EVP_CIPHER_CTX_set_flags(ctx, EVP_CIPHER_CTX_FLAG_WRAP_ALLOW);
+        bool ok = cipher_ && ctx && EVP_CipherInit_ex(ctx, cipher_, NULL, kek_, NULL, encrypt ? 1 : 0) == 1 &&
+                  EVP_CipherUpdate(ctx, out, &len, in.data, (int)in.size) == 1 &&
+                  EVP_CipherFinal_ex(ctx, out + len, &tail) == 1;
+        EVP_CIPHER_CTX_free(ctx);
+        *outLen = (size_t)len + (size_t)tail;
+        return ok;
+    }
+
+    const EVP_CIPHER* cipher_;
+    unsigned char kek_[32];
+};
+
+class Envelope {
+public:
+    static const size_t HEADER = 7; // magic, kind, wrapped length
+    static const size_t NONCE = 12;
+    static const size_t TAG = 16;
+    static const size_t DEK = 32; // AES-256-GCM
+
+    // Seals payload under a fresh DEK wrapped by wrapper.
+    static bool seal(KeyWrapper* wrapper, ConstByteSpan payload, std::vector<unsigned char>* object) {
+        unsigned char dek[DEK], nonce[NONCE];
+        std::vector<unsigned char> wrapped;
+        bool ok = RAND_bytes(dek, sizeof(dek)) == 1 && RAND_bytes(nonce, sizeof(nonce)) == 1 &&
+                  wrapper->wrap(dek, sizeof(dek), &wrapped) && wrapped.size() <= 0xffff;
+        EVP_CIPHER_CTX* ctx = ok ? EVP_CIPHER_CTX_new() : NULL;
+        if (ctx) {
+            size_t aadLen = HEADER + wrapped.size();
+            object->resize(aadLen + NONCE + payload.size + TAG);
+            unsigned char* p = object->data();
+            memcpy(p, "ENV1", 4);
+            p[4] = wrapper->kind();
+            p[5] = (unsigned char)(wrapped.size() >> 8);
+            p[6] = (unsigned char)wrapped.size();
+            memcpy(p + HEADER, wrapped.data(), wrapped.size());
+            memcpy(p + aadLen, nonce, NONCE);
+            ok = EVP_EncryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, dek, nonce) == 1 &&
+                 CipherSpan::seal(ctx, ConstByteSpan(p, aadLen), payload,
+                                  ByteSpan(p + aadLen + NONCE, payload.size),
+                                  ByteSpan(p + aadLen + NONCE + payload.size, TAG));
+        }
+        ok = ok && ctx;
+        EVP_CIPHER_CTX_free(ctx);
+        OPENSSL_cleanse(dek, sizeof(dek));
+        return ok;
+    }
+
+    // The parts of a sealed object; false if it is not one.
+    struct Parts {
+        unsigned char kind;
+        ConstByteSpan aad, wrapped, nonce, ciphertext, tag;
+    };
+
+    static bool parse(ConstByteSpan object, Parts* parts) {
+        if (object.size < HEADER || memcmp(object.data, "ENV1", 4) != 0) return false;
+        size_t wrappedLen = ((size_t)object.data[5] << 8) | object.data[6];
+        if (object.size < HEADER + wrappedLen + NONCE + TAG) return false;
+        size_t aadLen = HEADER + wrappedLen;
+        parts->kind = object.data[4];
+        parts->aad = ConstByteSpan(object.data, aadLen);
+        parts->wrapped = ConstByteSpan(object.data + HEADER, wrappedLen);
+        parts->nonce = ConstByteSpan(object.data + aadLen, NONCE);
+        parts->ciphertext = ConstByteSpan(object.data + aadLen + NONCE, object.size - aadLen - NONCE - TAG);
+        parts->tag = ConstByteSpan(object.data + object.size - TAG, TAG);
+        return true;
+    }
+};
+
+// Opens objects sealed under one wrapper.  With cacheCapacity > 0,
+// unwrapped DEKs are kept (as keyed AES-GCM templates) in a sharded LRU
+// GcmKeyCache; 0 unwraps on every read.  Thread-safe.
+class EnvelopeReader {
+public:
+    EnvelopeReader(KeyWrapper* wrapper, size_t cacheCapacity, size_t shards = 16)
+        : wrapper_(wrapper), cache_(NULL), unwraps_(0), reads_(0) {
+        if (cacheCapacity > 0)
+            cache_ = new GcmKeyCache(cacheCapacity, shards, [this](const std::string& id, unsigned char* key, size_t* len) {
+                return unwrap(ConstByteSpan(id.data(), id.size()), key, len);
+            });
+    }
+    ~EnvelopeReader() { delete cache_; }
+
+    // Decrypts object into payload; false (payload wiped) if it does not
+    // verify.
+    bool open(ConstByteSpan object, std::vector<unsigned char>* payload) {
+        ++reads_;
+        Envelope::Parts parts;
+        if (!Envelope::parse(object, &parts) || parts.kind != wrapper_->kind()) return false;
+        EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+        bool ok = ctx != NULL;
+        if (ok && cache_) {
+            ok = cache_->acquire(std::string((const char*)parts.wrapped.data, parts.wrapped.size), ctx);
+        } else if (ok) {
+            unsigned char dek[KeyWrapper::MAX_DEK];
+            size_t len = 0;
+            ok = unwrap(parts.wrapped, dek, &len) && EVP_DecryptInit_ex(ctx, EVP_aes_256_gcm(), NULL, dek, NULL) == 1;
+            OPENSSL_cleanse(dek, sizeof(dek));
+        }
+        payload->resize(parts.ciphertext.size);
+        ok = ok && EVP_CipherInit_ex(ctx, NULL, NULL, NULL, parts.nonce.data, 0) == 1 &&
+             CipherSpan::open(ctx, parts.aad, parts.ciphertext, *payload, parts.tag);
+        EVP_CIPHER_CTX_free(ctx);
+        if (!ok) {
+            OPENSSL_cleanse(payload->data(), payload->size());
+            payload->clear();
+        }
+        return ok;
+    }
+
+    // Key-wrap operations actually performed, and reads served.
+    unsigned long long unwraps() const { return unwraps_; }
+    unsigned long long reads() const { return reads_; }
+    const GcmKeyCache* cache() const { return cache_; }
+
+private:
+    EnvelopeReader(const EnvelopeReader&);
+    EnvelopeReader& operator=(const EnvelopeReader&);
+
+    // Both the cache loader and the uncached path come through here, so a
+    // wrapped key of any other length (a valid AES-128 key, say) is never
+    // used for an AES-256-GCM object.
+    bool unwrap(ConstByteSpan wrapped, unsigned char* dek, size_t* len) {
+        ++unwraps_;
+        if (wrapper_->unwrap(wrapped, dek, len) && *len == Envelope::DEK) return true;
+        OPENSSL_cleanse(dek, KeyWrapper::MAX_DEK);
+        *len = 0;
+        return false;
+    }
+
+    KeyWrapper* wrapper_;
+    GcmKeyCache* cache_;
+    std::atomic<unsigned long long> unwraps_;
+    std::atomic<unsigned long long> reads_;
+};
+
+#endif
@@ -0,0 +1,232 @@
+// Multi-tenant key-schedule cache for AES-GCM.
+//
+// Maps key IDs to keyed EVP_CIPHER_CTX templates (AES key expansion and the
+// GHASH key already done) and hands each request its own copy with
+// EVP_CIPHER_CTX_copy, so a request never repeats key setup while its key
+// stays cached.  The request then sets its nonce and direction with
+// EVP_CipherInit_ex(ctx, NULL, NULL, NULL, nonce, enc).
+//
+// The cache is split into shards, each a mutex-protected LRU list, so
+// requests for different tenants rarely contend.  Key material comes from a
+// loader callback on a miss (e.g. a KMS fetch) and is wiped from the stack
+// as soon as the template is keyed.  Evicted templates are released with
+// EVP_CIPHER_CTX_free, which zeroises the provider's key schedule.
+#ifndef GCM_KEY_CACHE_H
+#define GCM_KEY_CACHE_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GcmKeyCache {
+public:
+    // Fills key (up to 32 bytes) for keyId and sets *keyLen to 16, 24 or
+    // 32; returns false if the key does not exist.
+    typedef std::function<bool(const std::string& keyId, unsigned char* key, size_t* keyLen)> Loader;
+
+    GcmKeyCache(size_t capacity, size_t shards, Loader loader)
+        : shards_(shards ? shards : 1), perShard_((capacity + shards_.size() - 1) / shards_.size()), loader_(loader),
+          hits_(0), misses_(0), evictions_(0), failures_(0) {
+        if (perShard_ == 0) perShard_ = 1;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) latency_[i] = 0;
+    }
+
+    ~GcmKeyCache() {
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            Shard& s = shards_[i];
+            for (Lru::iterator it = s.lru.begin(); it != s.lru.end(); ++it) EVP_CIPHER_CTX_free(it->ctx);
+        }
+    }
+
+    // Copies the template for keyId into ctx (an existing, caller-owned
+    // context; reusing one per thread avoids the outer allocation).
+    bool acquire(const std::string& keyId, EVP_CIPHER_CTX* ctx) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        Shard& s = shards_[std::hash<std::string>()(keyId) % shards_.size()];
+        bool ok = copyCached(s, keyId, ctx);
+        if (ok) {
+            ++hits_;
+        } else {
+            ++misses_;
+            // Key setup happens outside the shard lock so a slow loader
+            // only delays requests for this key.
+            EVP_CIPHER_CTX* fresh = keyTemplate(keyId);
+            if (!fresh) {
+                ++failures_;
+                record(start);
+                return false;
+            }
+            ok = insertAndCopy(s, keyId, fresh, ctx);
+        }
+        record(start);
+        return ok;
+    }
+
+    struct Stats {
+        unsigned long long hits, misses, evictions, failures, entries;
+        double p50, p99, p999; // acquire latency, seconds
+    };
+
+    Stats stats() const {
+        Stats st;
+        st.hits = hits_;
+        st.misses = misses_;
+        st.evictions = evictions_;
+        st.failures = failures_;
+        st.entries = 0;
+        for (size_t i = 0; i < shards_.size(); ++i) {
+            std::lock_guard<std::mutex> guard(shards_[i].lock);
+            st.entries += shards_[i].lru.size();
+        }
+        st.p50 = percentile(0.5);
+        st.p99 = percentile(0.99);
+        st.p999 = percentile(0.999);
+        return st;
+    }
+
+    // Prometheus text exposition of the counters and latency summary.
+    std::string exportText() const {
+        Stats st = stats();
+        char buf[1024];
+        snprintf(buf, sizeof(buf),
+                 "gcm_key_cache_hits_total %llu\n"
+                 "gcm_key_cache_misses_total %llu\n"
+                 "gcm_key_cache_evictions_total %llu\n"
+                 "gcm_key_cache_load_failures_total %llu\n"
+                 "gcm_key_cache_entries %llu\n"
+                 "gcm_key_cache_hit_ratio %.4f\n"
+                 "gcm_key_cache_acquire_seconds{quantile=\"0.5\"} %.9f\n"
+                 "gcm_key_cache_acquire_seconds{quantile=\"0.99\"} %.9f\n"
+                 "gcm_key_cache_acquire_seconds{quantile=\"0.999\"} %.9f\n",
+                 st.hits, st.misses, st.evictions, st.failures, st.entries,
+                 st.hits + st.misses ? (double)st.hits / (st.hits + st.misses) : 0.0, st.p50, st.p99, st.p999);
+        return buf;
+    }
+
+private:
+    struct Entry {
+        std::string id;
+        EVP_CIPHER_CTX* ctx;
+    };
+    typedef std::list<Entry> Lru; // most recently used first
+
+    struct Shard {
+        mutable std::mutex lock;
+        Lru lru;
+        std::unordered_map<std::string, Lru::iterator> index;
+    };
+
+    // Latency histogram: 4 sub-buckets per power of two of nanoseconds,
+    // so percentiles are within ~19% without storing samples.
+    static const size_t LATENCY_BUCKETS = 64 * 4;
+
+    bool copyCached(Shard& s, const std::string& keyId, EVP_CIPHER_CTX* ctx) {
+        std::lock_guard<std::mutex> guard(s.lock);
+        std::unordered_map<std::string, Lru::iterator>::iterator it = s.index.find(keyId);
+        if (it == s.index.end()) return false;
+        s.lru.splice(s.lru.begin(), s.lru, it->second);
+        return EVP_CIPHER_CTX_copy(ctx, it->second->ctx) == 1;
+    }
+
+    EVP_CIPHER_CTX* keyTemplate(const std::string& keyId) {
+        unsigned char key[32];
+        size_t keyLen = 0;
+        EVP_CIPHER_CTX* ctx = NULL;
+        if (loader_(keyId, key, &keyLen)) {
+            const EVP_CIPHER* cipher = keyLen == 16 ? EVP_aes_128_gcm()
+                                     : keyLen == 24 ? EVP_aes_192_gcm()
+                                     : keyLen == 32 ? EVP_aes_256_gcm() : NULL;
+            ctx = cipher ? EVP_CIPHER_CTX_new() : NULL;
+            if (ctx && EVP_EncryptInit_ex(ctx, cipher, NULL, key, NULL) != 1) {
+                EVP_CIPHER_CTX_free(ctx);
+                ctx = NULL;
+            }
+        }
+        OPENSSL_cleanse(key, sizeof(key));
+        return ctx;
+    }
+
+    bool insertAndCopy(Shard& s, const std::string& keyId, EVP_CIPHER_CTX* fresh, EVP_CIPHER_CTX* ctx) {
+        EVP_CIPHER_CTX* evicted = NULL;
+        bool ok;
+        {
+            std::lock_guard<std::mutex> guard(s.lock);
+            std::unordered_map<std::string, Lru::iterator>::iterator it = s.index.find(keyId);
+            if (it != s.index.end()) {
+                // Another thread loaded it meanwhile; keep theirs.
+                s.lru.splice(s.lru.begin(), s.lru, it->second);
+                ok = EVP_CIPHER_CTX_copy(ctx, it->second->ctx) == 1;
+                evicted = fresh;
+            } else {
+                if (s.lru.size() >= perShard_) {
+                    evicted = s.lru.back().ctx;
+                    s.index.erase(s.lru.back().id);
+                    s.lru.pop_back();
+                    ++evictions_;
+                }
+                Entry e;
+                e.id = keyId;
+                e.ctx = fresh;
+                s.lru.push_front(e);
+                s.index[keyId] = s.lru.begin();
+                ok = EVP_CIPHER_CTX_copy(ctx, fresh) == 1;
+            }
+        }
+        EVP_CIPHER_CTX_free(evicted);
+        return ok;
+    }
+
+    void record(std::chrono::steady_clock::time_point start) {
+        unsigned long long ns = (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                    std::chrono::steady_clock::now() - start).count();
+        ++latency_[bucketOf(ns)];
+    }
+
+    static size_t bucketOf(unsigned long long ns) {
+        if (ns < 4) return (size_t)ns;
+        int msb = 63 - __builtin_clzll(ns);
+        size_t b = (size_t)msb * 4 + (size_t)((ns >> (msb - 2)) & 3);
+        return b < LATENCY_BUCKETS ? b : LATENCY_BUCKETS - 1;
+    }
+
+    // Upper bound of bucket b, in nanoseconds.
+    static double bucketLimit(size_t b) {
+        if (b < 4) return (double)b + 1;
+        size_t msb = b / 4, sub = b % 4;
+        return (double)(1ULL << msb) * (1.0 + (sub + 1) / 4.0);
+    }
+
+    double percentile(double q) const {
+        unsigned long long total = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) total += latency_[i];
+        if (total == 0) return 0;
+        unsigned long long want = (unsigned long long)(q * total), seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; ++i) {
+            seen += latency_[i];
+            if (seen > want) return bucketLimit(i) / 1e9;
+        }
+        return bucketLimit(LATENCY_BUCKETS - 1) / 1e9;
+    }
+
+    std::vector<Shard> shards_;
+    size_t perShard_;
+    Loader loader_;
+    std::atomic<unsigned long long> hits_;
+    std::atomic<unsigned long long> misses_;
+    std::atomic<unsigned long long> evictions_;
+    std::atomic<unsigned long long> failures_;
+    std::atomic<unsigned long long> latency_[LATENCY_BUCKETS];
+
+    GcmKeyCache(const GcmKeyCache&);
+    GcmKeyCache& operator=(const GcmKeyCache&);
+};
+
+#endif
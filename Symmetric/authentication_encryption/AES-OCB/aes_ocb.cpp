@@ -0,0 +1,200 @@
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_ctx_pool.h"
+#include "cipher_span.h"
+#include "ocb_parallel.h"
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static void printHex(const char* label, const unsigned char* data, size_t len) {
+    std::cout << label;
+    for (size_t i = 0; i < len; ++i) printf("%02x", data[i]);
+    std::cout << std::endl;
+}
+
+// Seals in -> out with EVP in several uneven pieces, as a stream arrives:
+// OCB buffers any partial block internally, so each update can return a
+// little less or more than it was given.
+static bool sealStreaming(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* nonce,
+                          const std::string& aad, const std::vector<unsigned char>& in, unsigned char* out,
+                          unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_EncryptInit_ex(ctx, aes, NULL, NULL, NULL) == 1 &&
+              EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, 12, NULL) == 1 &&
+              EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce) == 1;
+    int n;
+    // AAD may be streamed too, before the first plaintext byte.
+    size_t half = aad.size() / 2;
+    ok = ok && EVP_EncryptUpdate(ctx, NULL, &n, (const unsigned char*)aad.data(), (int)half) == 1 &&
+         EVP_EncryptUpdate(ctx, NULL, &n, (const unsigned char*)aad.data() + half, (int)(aad.size() - half)) == 1;
+    size_t pos = 0, written = 0;
+    const size_t pieces[] = { 7, 20, 33 };
+    for (size_t i = 0; ok && pos < in.size(); ++i) {
+        size_t len = std::min(pieces[i % 3], in.size() - pos);
+        ok = EVP_EncryptUpdate(ctx, out + written, &n, in.data() + pos, (int)len) == 1;
+        pos += len;
+        written += (size_t)n;
+    }
+    ok = ok && EVP_EncryptFinal_ex(ctx, out + written, &n) == 1 &&
+         EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, tag) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok && written + (size_t)n == in.size();
+}
+
+static bool sealParallel(OcbParallel* ocb, const unsigned char* nonce, const unsigned char* aad, size_t aadLen,
+                         const unsigned char* in, unsigned char* out, size_t len, unsigned char* tag) {
+    return ocb->start(nonce, 12, 16, true) && ocb->aad(aad, aadLen) && ocb->finish(in, out, len, tag);
+}
+
+static bool sealEvp(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* nonce,
+                    const unsigned char* aad, size_t aadLen, const unsigned char* in, unsigned char* out, size_t len,
+                    unsigned char* tag) {
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(cipher, key, nonce, true);
+    return ctx && CipherSpan::seal(ctx, ConstByteSpan(aad, aadLen), ConstByteSpan(in, len), ByteSpan(out, len),
+                                   ByteSpan(tag, 16));
+}
+
+static int bench(int bits, unsigned threads, size_t mib) {
+    // A benchmark may repeat a nonce; real messages never may.
+    const EVP_CIPHER* gcm = AesDispatch::cipher("GCM", bits);
+    const EVP_CIPHER* ocbEvp = AesDispatch::cipher("OCB", bits);
+    const int keyLen = bits / 8;
+    unsigned char key[32], nonce[12], aad[16];
+    if (!gcm || !ocbEvp || !RAND_bytes(key, keyLen) || !RAND_bytes(nonce, sizeof(nonce)) || !RAND_bytes(aad, sizeof(aad)))
+        handleErrors();
+    size_t largest = std::max<size_t>(mib << 20, 1 << 20);
+    std::vector<unsigned char> in(largest), out(largest), ref(largest);
+    if (!RAND_bytes(in.data(), (int)std::min<size_t>(largest, 1 << 20))) handleErrors();
+    OcbParallel ocb(key, keyLen, threads);
+    if (!ocb.ok()) handleErrors();
+
+    std::cout << "AES-" << bits << " AEAD seal, same messages and 16-byte AAD, MB/s" << std::endl;
+    printf("%10s %12s %12s %12s   %s\n", "Message", "GCM (EVP)", "OCB (EVP)", "OCB", "OCB vs GCM");
+    printf("%10s %12s %12s %9u thr\n", "", "", "", threads);
+    const size_t sizes[] = { 64, 1024, 16 << 10, 1 << 20, largest };
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+        size_t len = sizes[s];
+        if (s > 0 && len == sizes[s - 1]) continue;
+        // About 256 MiB of work per column, at least 3 messages.
+        size_t reps = std::max<size_t>((256 << 20) / len, 3);
+        unsigned char tag[16], refTag[16];
+        double mbps[3];
+        for (int col = 0; col < 3; ++col) {
+            auto t0 = std::chrono::steady_clock::now();
+            for (size_t r = 0; r < reps; ++r) {
+                bool ok = col == 0 ? sealEvp(gcm, key, nonce, aad, sizeof(aad), in.data(), out.data(), len, tag)
+                        : col == 1 ? sealEvp(ocbEvp, key, nonce, aad, sizeof(aad), in.data(), ref.data(), len, refTag)
+                                   : sealParallel(&ocb, nonce, aad, sizeof(aad), in.data(), out.data(), len, tag);
+                if (!ok) handleErrors();
+            }
+            double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            mbps[col] = reps * len / sec / 1e6;
+        }
+        // The parallel OCB must produce exactly EVP's ciphertext and tag.
+        bool same = memcmp(out.data(), ref.data(), len) == 0 && memcmp(tag, refTag, sizeof(tag)) == 0;
+        char label[32];
+        if (len >= (1 << 20))
+            snprintf(label, sizeof(label), "%zu MiB", len >> 20);
+        else if (len >= 1024)
+            snprintf(label, sizeof(label), "%zu KiB", len >> 10);
+        else
+            snprintf(label, sizeof(label), "%zu B", len);
+        printf("%10s %12.0f %12.0f %12.0f   %5.2fx  %s\n", label, mbps[0], mbps[1], mbps[2], mbps[2] / mbps[0],
+               same ? "matches EVP" : "MISMATCH");
+        if (!same) return 1;
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    size_t mib = 64;
+    int opt;
+    while ((opt = getopt(argc, argv, "k:j:m:")) != -1) {
+        if (opt == 'k')
+            bits = atoi(optarg);
+        else if (opt == 'j')
+            threads = (unsigned)atoi(optarg);
+        else if (opt == 'm')
+            mib = (size_t)strtoul(optarg, NULL, 10);
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    bool isBench = optind == argc - 1 && strcmp(argv[optind], "bench") == 0;
+    const EVP_CIPHER* aes = AesDispatch::cipher("OCB", bits);
+    if (!aes || threads == 0 || (!isBench && optind != argc)) {
+        std::cerr << "Usage: " << argv[0] << " [-k 128|192|256]                              # demonstration\n"
+                  << "       " << argv[0] << " [-k 128|192|256] [-j threads] [-m mib] bench\n"
+                  << "       " << argv[0] << " --cpu-report\n";
+        return 1;
+    }
+    if (isBench) return bench(bits, threads, mib);
+
+    // Key and nonce
+    const size_t keyLen = (size_t)bits / 8;
+    unsigned char key[32];   // 128-, 192- or 256-bit key
+    unsigned char nonce[12]; // 96-bit nonce (OCB accepts 1 to 15 bytes)
+    if (!RAND_bytes(key, (int)keyLen) || !RAND_bytes(nonce, sizeof(nonce))) handleErrors();
+
+    // Data and associated data
+    const char* plaintext = "AES-OCB is a one-pass, parallelisable AEAD mode.";
+    const std::string aad = "header-data";
+    std::vector<unsigned char> message(plaintext, plaintext + strlen(plaintext));
+    std::vector<unsigned char> streamed(message.size()), parallel(message.size());
+    unsigned char tag[16], parallelTag[16];
+
+    // Encrypt: EVP, streamed in pieces
+    if (!sealStreaming(aes, key, nonce, aad, message, streamed.data(), tag)) handleErrors();
+    printHex("Key: ", key, keyLen);
+    printHex("Nonce: ", nonce, sizeof(nonce));
+    std::cout << "AAD: " << aad << std::endl;
+    printHex("Ciphertext: ", streamed.data(), streamed.size());
+    printHex("Tag: ", tag, sizeof(tag));
+
+    // Encrypt again with the multi-threaded implementation: same bytes
+    OcbParallel ocb(key, keyLen, threads);
+    if (!ocb.ok() || !sealParallel(&ocb, nonce, (const unsigned char*)aad.data(), aad.size(), message.data(),
+                                   parallel.data(), message.size(), parallelTag))
+        handleErrors();
+    bool same = parallel == streamed && memcmp(tag, parallelTag, sizeof(tag)) == 0;
+    std::cout << "Multi-threaded OCB: " << (same ? "same ciphertext and tag" : "MISMATCH") << std::endl;
+
+    // Decrypt in place; the buffer is only trusted once the tag verifies
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(aes, key, nonce, false);
+    if (!ctx) handleErrors();
+    if (CipherSpan::open(ctx, aad, streamed, streamed, ConstByteSpan(tag, sizeof(tag)))) {
+        std::cout << "Decrypted: " << std::string(streamed.begin(), streamed.end()) << std::endl;
+    } else {
+        std::cout << "Decryption failed!" << std::endl;
+    }
+
+    // A single flipped ciphertext bit must be rejected
+    parallel[0] ^= 1;
+    if (!ocb.start(nonce, sizeof(nonce), sizeof(tag), false) ||
+        !ocb.aad((const unsigned char*)aad.data(), aad.size()))
+        handleErrors();
+    bool accepted = ocb.verify(parallel.data(), parallel.data(), parallel.size(), tag);
+    std::cout << "Tampered ciphertext: " << (accepted ? "ACCEPTED" : "rejected") << std::endl;
+    OPENSSL_cleanse(key, sizeof(key));
+    return same && !accepted ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+// Multi-threaded AES-OCB3 (RFC 7253), byte-compatible with EVP_aes_*_ocb.
+//
+// OCB encrypts block i as C_i = Offset_i ^ E(K, P_i ^ Offset_i), where
+// Offset_i = Offset_{i-1} ^ L_{ntz(i)}.  Unrolled, that is Offset_0 XORed
+// with the L_k for every set bit k of gray(i) = i ^ (i >> 1), so a thread
+// can jump straight to any block index and work on its range alone.  The
+// checksum is the XOR of all plaintext blocks, so per-thread checksums
+// just XOR together.  The block cipher calls themselves go through
+// AES-ECB in tiles, which keeps the AES-NI pipeline full.
+//
+// EVP's OCB runs on one thread; OcbParallel splits each update across
+// threads.  Updates must be whole blocks except the last (passed to
+// finish), and all AAD goes in one aad() call before the data.
+#ifndef OCB_PARALLEL_H
+#define OCB_PARALLEL_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "cipher_ctx_pool.h"
+
+class OcbParallel {
+public:
+    static const size_t BLOCK = 16;
+
+    // key is 16, 24 or 32 bytes; threads is the most threads an update may
+    // use.  Check ok() before use.
+    OcbParallel(const unsigned char* key, size_t keyLen, unsigned threads)
+        : ecb_(keyLen == 16 ? EVP_aes_128_ecb() : keyLen == 24 ? EVP_aes_192_ecb() : keyLen == 32 ? EVP_aes_256_ecb() : NULL),
+          enc_(EVP_CIPHER_CTX_new()), dec_(EVP_CIPHER_CTX_new()), threads_(threads ? threads : 1), ok_(false),
+          encrypt_(true), tagLen_(16), blocks_(0) {
+        memset(key_, 0, sizeof(key_));
+        memset(lStar_, 0, BLOCK);
+        if (!ecb_ || !enc_ || !dec_) return;
+        memcpy(key_, key, keyLen);
+        if (EVP_EncryptInit_ex(enc_, ecb_, NULL, key, NULL) != 1 || EVP_DecryptInit_ex(dec_, ecb_, NULL, key, NULL) != 1)
+            return;
+        EVP_CIPHER_CTX_set_padding(enc_, 0);
+        EVP_CIPHER_CTX_set_padding(dec_, 0);
+        // L_* = E(K, 0), L_$ = double(L_*), L_0 = double(L_$), L_k = double(L_{k-1})
+        ok_ = encryptBlock(lStar_, lStar_);
+        twice(lDollar_, lStar_);
+        twice(l_[0], lDollar_);
+        for (int k = 1; k < 64; ++k) twice(l_[k], l_[k - 1]);
+    }
+
+    ~OcbParallel() {
+        EVP_CIPHER_CTX_free(enc_);
+        EVP_CIPHER_CTX_free(dec_);
+        OPENSSL_cleanse(key_, sizeof(key_));
+        OPENSSL_cleanse(l_, sizeof(l_));
+        OPENSSL_cleanse(lStar_, BLOCK);
+        OPENSSL_cleanse(lDollar_, BLOCK);
+        OPENSSL_cleanse(offset_, BLOCK);
+        OPENSSL_cleanse(checksum_, BLOCK);
+    }
+
+    bool ok() const { return ok_; }
+
+    // Starts a message: nonce of 1..15 bytes, tag of 1..16 bytes.
+    bool start(const unsigned char* nonce, size_t nonceLen, size_t tagLen, bool encrypt) {
+        if (!ok_ || nonceLen == 0 || nonceLen > 15 || tagLen == 0 || tagLen > BLOCK) return false;
+        encrypt_ = encrypt;
+        tagLen_ = tagLen;
+        blocks_ = 0;
+        memset(checksum_, 0, BLOCK);
+        memset(hash_, 0, BLOCK);
+        // Nonce = num2str(TAGLEN mod 128, 7) || 0* || 1 || N; bottom = its
+        // last 6 bits; Ktop = E(K, Nonce with those bits cleared).
+        unsigned char n[BLOCK] = { 0 };
+        n[0] = (unsigned char)(((tagLen * 8) % 128) << 1);
+        n[BLOCK - nonceLen - 1] |= 1;
+        memcpy(n + BLOCK - nonceLen, nonce, nonceLen);
+        unsigned bottom = n[BLOCK - 1] & 63;
+        n[BLOCK - 1] &= 0xc0;
+        unsigned char stretch[24];
+        if (!encryptBlock(n, stretch)) return false;
+        for (int i = 0; i < 8; ++i) stretch[16 + i] = stretch[i] ^ stretch[i + 1];
+        // Offset_0 = Stretch[1 + bottom .. 128 + bottom] (bits)
+        unsigned byteShift = bottom / 8, bitShift = bottom % 8;
+        for (size_t i = 0; i < BLOCK; ++i) {
+            unsigned hi = stretch[i + byteShift], lo = stretch[i + byteShift + 1];
+            offset0_[i] = (unsigned char)(bitShift ? (hi << bitShift) | (lo >> (8 - bitShift)) : hi);
+        }
+        memcpy(offset_, offset0_, BLOCK);
+        return true;
+    }
+
+    // HASH(K, A) over all the associated data, once, before any data.
+    bool aad(const unsigned char* a, size_t len) {
+        unsigned char off[BLOCK] = { 0 };
+        size_t full = len / BLOCK;
+        if (!blocks(enc_, off, 1, a, NULL, full, true, hash_)) return false;
+        size_t rest = len % BLOCK;
+        if (rest == 0) return true;
+        unsigned char in[BLOCK] = { 0 };
+        memcpy(in, a + full * BLOCK, rest);
+        in[rest] = 0x80;
+        xorInto(off, lStar_);
+        xorInto(in, off);
+        if (!encryptBlock(in, in)) return false;
+        xorInto(hash_, in);
+        return true;
+    }
+
+    // len must be a multiple of BLOCK; out may be in.
+    bool update(const unsigned char* in, unsigned char* out, size_t len) {
+        if (len % BLOCK != 0) return false;
+        size_t count = len / BLOCK;
+        if (count == 0) return true;
+        // Below ~64 KiB per thread the thread start costs more than it saves.
+        unsigned threads = threads_;
+        if (threads > count / 4096) threads = count >= 4096 ? (unsigned)(count / 4096) : 1;
+        bool ok = true;
+        if (threads <= 1) {
+            ok = blocks(encrypt_ ? enc_ : dec_, offset_, blocks_ + 1, in, out, count, encrypt_, checksum_);
+        } else {
+            std::vector<std::thread> workers;
+            std::vector<unsigned char> sums(threads * BLOCK, 0);
+            std::vector<char> done(threads, 0);
+            size_t per = count / threads, extra = count % threads, first = 0;
+            for (unsigned t = 0; t < threads; ++t) {
+                size_t n = per + (t < extra ? 1 : 0);
+                workers.push_back(std::thread([=, &sums, &done] {
+                    unsigned char off[BLOCK];
+                    offsetAt(blocks_ + first, off);
+                    EVP_CIPHER_CTX* ctx = ecbCtx(encrypt_);
+                    done[t] = ctx && blocks(ctx, off, blocks_ + first + 1, in + first * BLOCK, out + first * BLOCK, n,
+                                            encrypt_, &sums[t * BLOCK]);
+                }));
+                first += n;
+            }
+            for (unsigned t = 0; t < threads; ++t) {
+                workers[t].join();
+                ok = ok && done[t];
+                xorInto(checksum_, &sums[t * BLOCK]);
+            }
+            offsetAt(blocks_ + count, offset_);
+        }
+        blocks_ += count;
+        return ok;
+    }
+
+    // The rest of the message (any length), then the tag.
+    bool finish(const unsigned char* in, unsigned char* out, size_t len, unsigned char* tag) {
+        size_t full = len - len % BLOCK;
+        if (!update(in, out, full)) return false;
+        size_t rest = len - full;
+        if (rest > 0) {
+            // Offset_* = Offset_m ^ L_*; C_* = P_* ^ E(K, Offset_*)
+            xorInto(offset_, lStar_);
+            unsigned char pad[BLOCK], p[BLOCK] = { 0 };
+            if (!encryptBlock(offset_, pad)) return false;
+            for (size_t i = 0; i < rest; ++i) {
+                unsigned char c = in[full + i];
+                out[full + i] = c ^ pad[i];
+                p[i] = encrypt_ ? c : out[full + i];
+            }
+            p[rest] = 0x80;
+            xorInto(checksum_, p);
+        }
+        // Tag = E(K, Checksum ^ Offset ^ L_$) ^ HASH(K, A)
+        unsigned char t[BLOCK];
+        for (size_t i = 0; i < BLOCK; ++i) t[i] = checksum_[i] ^ offset_[i] ^ lDollar_[i];
+        if (!encryptBlock(t, t)) return false;
+        xorInto(t, hash_);
+        memcpy(tag, t, tagLen_);
+        return true;
+    }
+
+    // finish() for decryption: false if the tag does not match, in which
+    // case out must be discarded.
+    bool verify(const unsigned char* in, unsigned char* out, size_t len, const unsigned char* tag) {
+        unsigned char expected[BLOCK];
+        return finish(in, out, len, expected) && CRYPTO_memcmp(expected, tag, tagLen_) == 0;
+    }
+
+private:
+    // Tiles of this many blocks go through ECB in one call.
+    static const size_t TILE = 256;
+
+    // A block as two machine words, for XOR only (byte order is irrelevant).
+    struct Word {
+        uint64_t a, b;
+        Word& operator^=(const Word& o) {
+            a ^= o.a;
+            b ^= o.b;
+            return *this;
+        }
+    };
+
+    static Word load(const unsigned char* p) {
+        Word w;
+        memcpy(&w, p, BLOCK);
+        return w;
+    }
+
+    static void store(unsigned char* p, const Word& w) { memcpy(p, &w, BLOCK); }
+
+    static void xorInto(unsigned char* dst, const unsigned char* src) {
+        Word w = load(dst);
+        w ^= load(src);
+        store(dst, w);
+    }
+
+    // double(S): S << 1, reduced by x^128 + x^7 + x^2 + x + 1
+    static void twice(unsigned char* out, const unsigned char* in) {
+        unsigned carry = in[0] >> 7;
+        for (size_t i = 0; i < BLOCK - 1; ++i) out[i] = (unsigned char)((in[i] << 1) | (in[i + 1] >> 7));
+        out[BLOCK - 1] = (unsigned char)((in[BLOCK - 1] << 1) ^ (carry ? 0x87 : 0));
+    }
+
+    // Offset_i straight from Offset_0, without walking blocks 1..i.
+    void offsetAt(uint64_t i, unsigned char* off) const {
+        memcpy(off, offset0_, BLOCK);
+        uint64_t gray = i ^ (i >> 1);
+        for (int k = 0; gray; ++k, gray >>= 1)
+            if (gray & 1) xorInto(off, l_[k]);
+    }
+
+    // The calling thread's ECB context: the object's own on the thread
+    // that drives it, a pooled one on update's worker threads.  Padding
+    // must be off, or an ECB decrypt holds back its last block for Final.
+    EVP_CIPHER_CTX* ecbCtx(bool encrypt) const {
+        EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(ecb_, key_, NULL, encrypt);
+        return ctx && EVP_CIPHER_CTX_set_padding(ctx, 0) == 1 ? ctx : NULL;
+    }
+
+    bool encryptBlock(const unsigned char* in, unsigned char* out) const {
+        int n;
+        return EVP_EncryptUpdate(enc_, out, &n, in, (int)BLOCK) == 1;
+    }
+
+    // count blocks starting at block index first (1-based).  off holds
+    // Offset_{first-1} and is left at the last block's offset.  With out,
+    // this is OCB encryption or decryption and sum collects the plaintext
+    // checksum; without, it is HASH and sum collects E(K, A_i ^ Offset_i).
+    bool blocks(EVP_CIPHER_CTX* ctx, unsigned char* off, uint64_t first, const unsigned char* in, unsigned char* out,
+                size_t count, bool encrypt, unsigned char* sum) const {
+        Word offs[TILE], tmp[TILE];
+        Word o = load(off), s = load(sum);
+        bool ok = true;
+        for (size_t base = 0; ok && base < count; base += TILE) {
+            size_t n = count - base < TILE ? count - base : TILE;
+            const unsigned char* src = in + base * BLOCK;
+            for (size_t j = 0; j < n; ++j) {
+                o ^= load(l_[__builtin_ctzll(first + base + j)]);
+                offs[j] = o;
+                Word p = load(src + j * BLOCK);
+                tmp[j] = p;
+                tmp[j] ^= o;
+                if (out && encrypt) s ^= p;
+            }
+            int len;
+            ok = EVP_CipherUpdate(ctx, (unsigned char*)tmp, &len, (unsigned char*)tmp, (int)(n * BLOCK)) == 1;
+            for (size_t j = 0; ok && j < n; ++j) {
+                if (!out) {
+                    s ^= tmp[j];
+                    continue;
+                }
+                Word r = tmp[j];
+                r ^= offs[j];
+                store(out + (base + j) * BLOCK, r);
+                if (!encrypt) s ^= r;
+            }
+        }
+        store(off, o);
+        store(sum, s);
+        OPENSSL_cleanse(tmp, sizeof(tmp));
+        return ok;
+    }
+
+    OcbParallel(const OcbParallel&);
+    OcbParallel& operator=(const OcbParallel&);
+
+    const EVP_CIPHER* ecb_;
+    EVP_CIPHER_CTX* enc_;
+    EVP_CIPHER_CTX* dec_;
+    unsigned threads_;
+    bool ok_;
+    bool encrypt_;
+    size_t tagLen_;
+    uint64_t blocks_;
+    unsigned char key_[32];
+    unsigned char lStar_[BLOCK], lDollar_[BLOCK], l_[64][BLOCK];
+    unsigned char offset0_[BLOCK], offset_[BLOCK], checksum_[BLOCK], hash_[BLOCK];
+};
+
+#endif
@@ -0,0 +1,258 @@
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_span.h"
+#include "siv_index.h"
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static void printHex(const char* label, const unsigned char* data, size_t len) {
+    std::cout << label;
+    for (size_t i = 0; i < len; ++i) printf("%02x", data[i]);
+    std::cout << std::endl;
+}
+
+static double since(std::chrono::steady_clock::time_point t0) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+// Splits text into its non-empty lines (SIV cannot seal an empty value).
+static std::vector<ConstByteSpan> splitLines(const std::string& text) {
+    std::vector<ConstByteSpan> lines;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos) end = text.size();
+        size_t len = end - pos;
+        if (len > 0 && text[pos + len - 1] == '\r') --len;
+        if (len > 0) lines.push_back(ConstByteSpan((const unsigned char*)text.data() + pos, len));
+        pos = end + 1;
+    }
+    return lines;
+}
+
+static void lookup(SivCipher* siv, const SivIndex& index, const std::string& aad, const std::string& value) {
+    std::vector<unsigned char> ct(SivCipher::SIV + value.size()), plain;
+    uint64_t hits[16];
+    size_t n = siv->seal(aad, value, ct) ? index.find(ct, hits, 16) : 0;
+    if (n == 0) {
+        std::cout << "[" << aad << "] " << value << ": not found" << std::endl;
+        return;
+    }
+    // Only the matching records are decrypted.
+    for (size_t i = 0; i < n; ++i) {
+        ConstByteSpan r = index.record(hits[i]);
+        plain.resize(r.size - SivCipher::SIV);
+        if (!siv->open(aad, r, plain)) handleErrors();
+        std::cout << "[" << aad << "] " << value << ": record " << hits[i] << " = "
+                  << std::string(plain.begin(), plain.end()) << std::endl;
+    }
+}
+
+static int bench(size_t count, unsigned threads) {
+    unsigned char key[32]; // AES-128-SIV
+    if (!RAND_bytes(key, sizeof(key))) handleErrors();
+    const std::string aad = "email";
+    std::string text;
+    char line[64];
+    for (size_t i = 0; i < count; ++i) {
+        snprintf(line, sizeof(line), "user%08zu@example.com\n", i);
+        text += line;
+    }
+    std::vector<ConstByteSpan> records = splitLines(text);
+    const char* path = "aes_siv_bench.idx";
+
+    auto t0 = std::chrono::steady_clock::now();
+    if (!SivIndex::build(path, key, sizeof(key), aad, records.data(), records.size(), threads)) handleErrors();
+    double sec = since(t0);
+    std::cout << "AES-128-SIV index of " << count << " records (" << text.size() - count << " bytes of values)"
+              << std::endl;
+    printf("Build, %u thread%s: %.2f s, %.0f records/s, %.1f MB/s\n", threads, threads == 1 ? "" : "s", sec,
+           count / sec, (text.size() - count) / sec / 1e6);
+
+    SivIndex index;
+    if (!index.open(path)) handleErrors();
+    SivCipher siv(key, sizeof(key));
+    if (!siv.ok()) handleErrors();
+    // Queries alternate between stored values and values that are absent.
+    const size_t queries = std::min<size_t>(count, 200000) * 2;
+    std::vector<std::string> values(queries);
+    for (size_t q = 0; q < queries; ++q) {
+        snprintf(line, sizeof(line), "user%08zu@example.%s", (q / 2) * 7919 % count, q % 2 ? "org" : "com");
+        values[q] = line;
+    }
+    std::vector<std::vector<unsigned char> > sealed(queries);
+    uint64_t hit;
+    size_t found = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (size_t q = 0; q < queries; ++q) {
+        sealed[q].resize(SivCipher::SIV + values[q].size());
+        if (!siv.seal(aad, values[q], sealed[q])) handleErrors();
+        found += index.find(sealed[q], &hit, 1);
+    }
+    sec = since(t0);
+    printf("Lookup (seal query + probe): %.0f lookups/s, %zu of %zu found\n", queries / sec, found, queries);
+    if (found != queries / 2) handleErrors();
+    found = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (int rep = 0; rep < 10; ++rep)
+        for (size_t q = 0; q < queries; ++q) found += index.find(sealed[q], &hit, 1);
+    sec = since(t0);
+    printf("Probe only (query already sealed): %.0f lookups/s\n", 10 * queries / sec);
+    if (found != 10 * (queries / 2)) handleErrors();
+
+    // The alternative without an index: decrypt every row and compare.
+    std::vector<unsigned char> plain(64);
+    const std::string wanted = values[0];
+    size_t matches = 0;
+    t0 = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < index.records(); ++i) {
+        ConstByteSpan r = index.record(i);
+        if (!siv.open(aad, r, plain)) handleErrors();
+        matches += r.size - SivCipher::SIV == wanted.size() && memcmp(plain.data(), wanted.data(), wanted.size()) == 0;
+    }
+    sec = since(t0);
+    printf("Decrypt-and-compare scan, 1 thread: %.0f ms per lookup (%zu match)\n", sec * 1e3, matches);
+
+    index.close();
+    unlink(path);
+    OPENSSL_cleanse(key, sizeof(key));
+    return matches == 1 ? 0 : 1;
+}
+
+static int demo() {
+    unsigned char key[32]; // AES-128-SIV: 256-bit key (CMAC key + CTR key)
+    if (!RAND_bytes(key, sizeof(key))) handleErrors();
+    SivCipher siv(key, sizeof(key));
+    if (!siv.ok()) handleErrors();
+    printHex("Key: ", key, sizeof(key));
+
+    // Deterministic: same value and AAD, same bytes; the AAD (here the
+    // column name) keeps equal values in different columns apart.
+    const std::string value = "alice@example.com";
+    std::vector<unsigned char> c1(SivCipher::SIV + value.size()), c2(c1.size()), c3(c1.size());
+    if (!siv.seal(std::string("email"), value, c1) || !siv.seal(std::string("email"), value, c2) ||
+        !siv.seal(std::string("backup_email"), value, c3))
+        handleErrors();
+    printHex("SIV || ciphertext (email):        ", c1.data(), c1.size());
+    printHex("SIV || ciphertext (email, again): ", c2.data(), c2.size());
+    printHex("SIV || ciphertext (backup_email): ", c3.data(), c3.size());
+    bool deterministic = c1 == c2 && c1 != c3;
+
+    std::vector<unsigned char> plain(value.size());
+    if (siv.open(std::string("email"), c1, plain))
+        std::cout << "Decrypted: " << std::string(plain.begin(), plain.end()) << std::endl;
+    else
+        std::cout << "Decryption failed!" << std::endl;
+    c1[SivCipher::SIV] ^= 1;
+    bool accepted = siv.open(std::string("email"), c1, plain);
+    std::cout << "Tampered ciphertext: " << (accepted ? "ACCEPTED" : "rejected") << std::endl;
+
+    // A small encrypted table with an equality index
+    const std::string table = "alice@example.com\nbob@example.com\ncarol@example.com\nalice@example.com\n";
+    std::vector<ConstByteSpan> rows = splitLines(table);
+    const char* path = "aes_siv_demo.idx";
+    SivIndex index;
+    if (!SivIndex::build(path, key, sizeof(key), std::string("email"), rows.data(), rows.size(), 1) ||
+        !index.open(path))
+        handleErrors();
+    std::cout << "Index: " << index.records() << " encrypted records" << std::endl;
+    lookup(&siv, index, "email", "alice@example.com");
+    lookup(&siv, index, "email", "carol@example.com");
+    lookup(&siv, index, "email", "mallory@example.com");
+    lookup(&siv, index, "backup_email", "bob@example.com");
+    index.close();
+    unlink(path);
+    OPENSSL_cleanse(key, sizeof(key));
+    return deterministic && !accepted ? 0 : 1;
+}
+
+static void usage(const char* prog) {
+    std::cerr << "Usage: " << prog << "                                            # demonstration\n"
+              << "       " << prog << " [-j threads] [-a aad] build <records.txt> <index>\n"
+              << "       " << prog << " [-a aad] lookup <index> <value>...\n"
+              << "       " << prog << " [-j threads] [-n records] bench\n"
+              << "       " << prog << " --cpu-report\n";
+}
+
+int main(int argc, char* argv[]) {
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    size_t count = 1000000;
+    std::string aad = "record";
+    int opt;
+    while ((opt = getopt(argc, argv, "j:n:a:")) != -1) {
+        if (opt == 'j')
+            threads = (unsigned)atoi(optarg);
+        else if (opt == 'n')
+            count = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'a')
+            aad = optarg;
+        else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind == argc) return demo();
+    std::string mode = optind < argc ? argv[optind] : "";
+    int args = argc - optind - 1;
+    bool valid = (mode == "bench" && args == 0) || (mode == "build" && args == 2) || (mode == "lookup" && args >= 2);
+    if (threads == 0 || count == 0 || !valid) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (mode == "bench") return bench(count, threads);
+
+    // aes_siv_key.bin holds 32 (AES-128-SIV) or 64 (AES-256-SIV) bytes; see
+    // aes_siv_create_key.
+    unsigned char key[64];
+    FILE* kf = fopen("aes_siv_key.bin", "rb");
+    size_t keyLen = kf ? fread(key, 1, sizeof(key), kf) : 0;
+    if (kf) fclose(kf);
+    if (keyLen != 32 && keyLen != 64) {
+        std::cerr << "Error: aes_siv_key.bin must hold an AES-SIV key (./aes_siv_create_key [128|256])" << std::endl;
+        return 1;
+    }
+
+    int rc = 0;
+    if (mode == "build") {
+        std::ifstream in(argv[optind + 1], std::ios::binary);
+        if (!in) {
+            std::cerr << "Cannot open " << argv[optind + 1] << std::endl;
+            return 1;
+        }
+        std::string text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        std::vector<ConstByteSpan> records = splitLines(text);
+        auto t0 = std::chrono::steady_clock::now();
+        if (SivIndex::build(argv[optind + 2], key, keyLen, aad, records.data(), records.size(), threads))
+            printf("Indexed %zu records in %.2f s\n", records.size(), since(t0));
+        else
+            rc = 1;
+    } else {
+        SivIndex index;
+        SivCipher siv(key, keyLen);
+        if (!index.open(argv[optind + 1]) || !siv.ok()) {
+            std::cerr << "Cannot open index " << argv[optind + 1] << std::endl;
+            rc = 1;
+        }
+        for (int i = optind + 2; rc == 0 && i < argc; ++i) lookup(&siv, index, aad, argv[i]);
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    if (rc) handleErrors();
+    return 0;
+}
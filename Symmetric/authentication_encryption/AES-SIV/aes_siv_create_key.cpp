@@ -0,0 +1,31 @@
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char* argv[]) {
+    // AES-128-SIV (default) or AES-256-SIV.  The SIV key is two AES keys
+    // back to back (S2V/CMAC key, then CTR key), so it is twice as long.
+    int bits = argc > 1 ? atoi(argv[1]) : 128;
+    if (bits != 128 && bits != 256) {
+        std::cerr << "Usage: " << argv[0] << " [128|256]" << std::endl;
+        return 1;
+    }
+    size_t len = (size_t)bits / 4;
+    unsigned char key[64];
+    if (!RAND_bytes(key, (int)len)) {
+        std::cerr << "Error generating AES-SIV key!" << std::endl;
+        return 1;
+    }
+    FILE* kf = fopen("aes_siv_key.bin", "wb");
+    if (!kf) {
+        std::cerr << "Cannot open aes_siv_key.bin for writing!" << std::endl;
+        return 1;
+    }
+    fwrite(key, 1, len, kf);
+    fclose(kf);
+    OPENSSL_cleanse(key, sizeof(key));
+    std::cout << "AES-" << bits << "-SIV key (" << 2 * bits << " bits) saved to aes_siv_key.bin" << std::endl;
+    return 0;
+}
@@ -0,0 +1,296 @@
+// Deterministic AES-SIV (RFC 5297) and a memory-mapped equality index over
+// SIV ciphertexts.
+//
+// SIV derives the IV from the AAD and the plaintext (S2V, a CMAC chain),
+// so sealing the same value under the same key and AAD always gives the
+// same SIV || ciphertext.  That lets a table store only ciphertexts and
+// still answer "which rows equal x?": seal x, then look the result up.
+// The 16-byte SIV is a PRF output, so its first 8 bytes serve directly as
+// the hash key of an open-addressing table; no further hashing is needed.
+//
+// Index file layout (host byte order):
+//
+//   Header   magic "SIVIDX1", records, slots, data size
+//   uint64   offsets[records + 1]   record i is data[offsets[i], offsets[i + 1])
+//   Slot     slots[slots]           { first 8 SIV bytes, record + 1 (0 = empty) }
+//   bytes    data                   SIV || ciphertext of every record
+//
+// The table is at most half full and probed linearly.  A lookup touches
+// one or two slots and compares one stored ciphertext; it decrypts
+// nothing.
+#ifndef SIV_INDEX_H
+#define SIV_INDEX_H
+
+#include <fcntl.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "cipher_span.h"
+
+class SivCipher {
+public:
+    static const size_t SIV = 16;
+
+    // key is 32, 48 or 64 bytes: AES-128/192/256-SIV take a CMAC key and a
+    // CTR key back to back.  Check ok() before use.
+    SivCipher(const unsigned char* key, size_t keyLen)
+        : cipher_(NULL), enc_(EVP_CIPHER_CTX_new()), dec_(EVP_CIPHER_CTX_new()), work_(EVP_CIPHER_CTX_new()) {
+        const char* name = keyLen == 32 ? "AES-128-SIV" : keyLen == 48 ? "AES-192-SIV" : keyLen == 64 ? "AES-256-SIV" : NULL;
+        if (name) cipher_ = EVP_CIPHER_fetch(NULL, name, NULL);
+        ok_ = cipher_ && enc_ && dec_ && work_ && EVP_EncryptInit_ex(enc_, cipher_, NULL, key, NULL) == 1 &&
+              EVP_DecryptInit_ex(dec_, cipher_, NULL, key, NULL) == 1;
+    }
+
+    ~SivCipher() {
+        EVP_CIPHER_CTX_free(enc_);
+        EVP_CIPHER_CTX_free(dec_);
+        EVP_CIPHER_CTX_free(work_);
+        EVP_CIPHER_free(cipher_);
+    }
+
+    bool ok() const { return ok_; }
+
+    // out receives SIV || ciphertext, so out.size >= SIV + in.size.  The same
+    // (aad, in) always gives the same bytes.  in must not be empty: OpenSSL's
+    // SIV computes the tag only when it sees plaintext.
+    bool seal(ConstByteSpan aad, ConstByteSpan in, ByteSpan out) {
+        int len;
+        return ok_ && in.size > 0 && in.size <= (size_t)INT_MAX && out.size >= SIV + in.size && start(enc_, aad) &&
+               EVP_EncryptUpdate(work_, out.data + SIV, &len, in.data, (int)in.size) == 1 &&
+               EVP_EncryptFinal_ex(work_, out.data + SIV + len, &len) == 1 &&
+               EVP_CIPHER_CTX_ctrl(work_, EVP_CTRL_AEAD_GET_TAG, (int)SIV, out.data) == 1;
+    }
+
+    // in is SIV || ciphertext; out.size >= in.size - SIV.  False if it does
+    // not verify, and out is then wiped.
+    bool open(ConstByteSpan aad, ConstByteSpan in, ByteSpan out) {
+        if (!ok_ || in.size <= SIV || in.size - SIV > (size_t)INT_MAX || out.size < in.size - SIV) return false;
+        int len;
+        bool ok = EVP_CIPHER_CTX_copy(work_, dec_) == 1 &&
+                  EVP_CIPHER_CTX_ctrl(work_, EVP_CTRL_AEAD_SET_TAG, (int)SIV, const_cast<unsigned char*>(in.data)) == 1 &&
+                  (aad.size == 0 || EVP_DecryptUpdate(work_, NULL, &len, aad.data, (int)aad.size) == 1) &&
+                  EVP_DecryptUpdate(work_, out.data, &len, in.data + SIV, (int)(in.size - SIV)) == 1 &&
+                  EVP_DecryptFinal_ex(work_, out.data + len, &len) == 1;
+        if (!ok) OPENSSL_cleanse(out.data, in.size - SIV);
+        return ok;
+    }
+
+private:
+    SivCipher(const SivCipher&);
+    SivCipher& operator=(const SivCipher&);
+
+    // OpenSSL's SIV context is single-use once keyed (the S2V state runs
+    // on and a re-armed context refuses a second message), so each message
+    // starts from a copy of a keyed template.  Copying is about 2.7 times
+    // cheaper than keying again, which re-derives both AES schedules and
+    // the CMAC subkeys.
+    bool start(EVP_CIPHER_CTX* tmpl, ConstByteSpan aad) {
+        int len;
+        return aad.size <= (size_t)INT_MAX && EVP_CIPHER_CTX_copy(work_, tmpl) == 1 &&
+               (aad.size == 0 || EVP_EncryptUpdate(work_, NULL, &len, aad.data, (int)aad.size) == 1);
+    }
+
+    EVP_CIPHER* cipher_;
+    EVP_CIPHER_CTX* enc_;
+    EVP_CIPHER_CTX* dec_;
+    EVP_CIPHER_CTX* work_;
+    bool ok_;
+};
+
+class SivIndex {
+public:
+    SivIndex() : base_(NULL), size_(0), header_(NULL), offsets_(NULL), slots_(NULL), data_(NULL) {}
+    ~SivIndex() { close(); }
+
+    // Seals records[0, count) with key under aad and writes them, with the
+    // hash table, to path.  Records are split into contiguous ranges, one
+    // per thread; each thread seals straight into the mapped file and
+    // claims its slots with a compare-and-swap.  Empty records are not
+    // allowed (see SivCipher::seal).
+    static bool build(const char* path, const unsigned char* key, size_t keyLen, ConstByteSpan aad,
+                      const ConstByteSpan* records, size_t count, unsigned threads) {
+        uint64_t slots = 16;
+        while (slots < 2 * (uint64_t)count) slots <<= 1;
+        std::vector<uint64_t> offsets(count + 1, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (records[i].size == 0) return false;
+            offsets[i + 1] = offsets[i] + SivCipher::SIV + records[i].size;
+        }
+        Layout l = layout(count, slots, offsets[count]);
+        int fd = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0) return false;
+        void* base = ftruncate(fd, (off_t)l.size) == 0
+                         ? mmap(NULL, l.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)
+                         : MAP_FAILED;
+        ::close(fd);
+        if (base == MAP_FAILED) {
+            unlink(path);
+            return false;
+        }
+        unsigned char* p = (unsigned char*)base;
+        Header* h = (Header*)p;
+        memcpy(h->magic, "SIVIDX1", sizeof(h->magic));
+        h->records = count;
+        h->slots = slots;
+        h->dataSize = offsets[count];
+        memcpy(p + l.offsets, offsets.data(), (count + 1) * sizeof(uint64_t));
+
+        // The file is zero-filled by ftruncate, so every slot starts empty.
+        Slot* table = (Slot*)(p + l.slots);
+        unsigned char* data = p + l.data;
+        std::atomic<bool> ok(true);
+        auto work = [&](size_t from, size_t to) {
+            SivCipher siv(key, keyLen);
+            if (!siv.ok()) {
+                ok = false;
+                return;
+            }
+            for (size_t i = from; i < to && ok; ++i) {
+                unsigned char* ct = data + offsets[i];
+                if (!siv.seal(aad, records[i], ByteSpan(ct, SivCipher::SIV + records[i].size))) {
+                    ok = false;
+                    return;
+                }
+                uint64_t k;
+                memcpy(&k, ct, sizeof(k));
+                for (uint64_t s = k & (slots - 1);; s = (s + 1) & (slots - 1)) {
+                    uint64_t empty = 0;
+                    if (__atomic_compare_exchange_n(&table[s].ref, &empty, (uint64_t)i + 1, false, __ATOMIC_RELAXED,
+                                                    __ATOMIC_RELAXED)) {
+                        table[s].key = k;
+                        break;
+                    }
+                }
+            }
+        };
+        // Fewer than 4096 records per thread is not worth a thread.
+        size_t n = threads ? threads : 1;
+        if (n > count / 4096) n = count / 4096 ? count / 4096 : 1;
+        std::vector<std::thread> pool;
+        for (size_t t = 1; t < n; ++t) pool.emplace_back(work, count * t / n, count * (t + 1) / n);
+        work(0, count / n);
+        for (size_t t = 0; t < pool.size(); ++t) pool[t].join();
+        bool written = ok && munmap(base, l.size) == 0;
+        if (!written) {
+            if (!ok) munmap(base, l.size);
+            unlink(path);
+        }
+        return written;
+    }
+
+    // Maps an index file read-only.
+    bool open(const char* path) {
+        close();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat st;
+        void* base = fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(Header)
+                         ? mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+                         : MAP_FAILED;
+        ::close(fd);
+        if (base == MAP_FAILED) return false;
+        base_ = base;
+        size_ = (size_t)st.st_size;
+        const unsigned char* p = (const unsigned char*)base;
+        header_ = (const Header*)p;
+        // Reject anything whose sizes do not add up to the file (bounding
+        // each count by the file size first, so the layout cannot overflow).
+        bool valid = memcmp(header_->magic, "SIVIDX1", sizeof(header_->magic)) == 0 && header_->slots >= 16 &&
+                     (header_->slots & (header_->slots - 1)) == 0 && header_->slots / 2 >= header_->records &&
+                     header_->slots <= size_ / sizeof(Slot) && header_->dataSize <= size_ &&
+                     layout(header_->records, header_->slots, header_->dataSize).size == size_;
+        if (valid) {
+            Layout l = layout(header_->records, header_->slots, header_->dataSize);
+            offsets_ = (const uint64_t*)(p + l.offsets);
+            slots_ = (const Slot*)(p + l.slots);
+            data_ = p + l.data;
+            valid = offsets_[0] == 0 && offsets_[header_->records] == header_->dataSize;
+        }
+        if (!valid) close();
+        return valid;
+    }
+
+    void close() {
+        if (base_) munmap(base_, size_);
+        base_ = NULL;
+        size_ = 0;
+        header_ = NULL;
+        offsets_ = NULL;
+        slots_ = NULL;
+        data_ = NULL;
+    }
+
+    uint64_t records() const { return header_ ? header_->records : 0; }
+
+    // SIV || ciphertext of record i, as written by build.
+    ConstByteSpan record(uint64_t i) const {
+        if (!header_ || i >= header_->records || offsets_[i] > offsets_[i + 1] || offsets_[i + 1] > header_->dataSize)
+            return ConstByteSpan();
+        return ConstByteSpan(data_ + offsets_[i], (size_t)(offsets_[i + 1] - offsets_[i]));
+    }
+
+    // Stores up to max record numbers whose stored ciphertext equals ct
+    // (SIV || ciphertext, as SivCipher::seal produces) and returns how
+    // many it stored.  Equal plaintexts under the same key and AAD seal
+    // identically, so duplicates all match.
+    size_t find(ConstByteSpan ct, uint64_t* matches, size_t max) const {
+        if (!header_ || ct.size <= SivCipher::SIV) return 0;
+        uint64_t k, mask = header_->slots - 1;
+        memcpy(&k, ct.data, sizeof(k));
+        size_t found = 0;
+        for (uint64_t s = k & mask, probes = 0; found < max && probes <= mask; s = (s + 1) & mask, ++probes) {
+            const Slot& slot = slots_[s];
+            if (slot.ref == 0) break;
+            if (slot.key != k) continue;
+            ConstByteSpan r = record(slot.ref - 1);
+            if (r.size == ct.size && memcmp(r.data, ct.data, ct.size) == 0) matches[found++] = slot.ref - 1;
+        }
+        return found;
+    }
+
+private:
+    SivIndex(const SivIndex&);
+    SivIndex& operator=(const SivIndex&);
+
+    struct Header {
+        char magic[8];
+        uint64_t records;
+        uint64_t slots;
+        uint64_t dataSize;
+    };
+
+    struct Slot {
+        uint64_t key;
+        uint64_t ref;
+    };
+
+    struct Layout {
+        size_t offsets, slots, data, size;
+    };
+
+    static Layout layout(uint64_t records, uint64_t slots, uint64_t dataSize) {
+        Layout l;
+        l.offsets = sizeof(Header);
+        l.slots = l.offsets + (size_t)(records + 1) * sizeof(uint64_t);
+        l.data = l.slots + (size_t)slots * sizeof(Slot);
+        l.size = l.data + (size_t)dataSize;
+        return l;
+    }
+
+    void* base_;
+    size_t size_;
+    const Header* header_;
+    const uint64_t* offsets_;
+    const Slot* slots_;
+    const unsigned char* data_;
+};
+
+#endif
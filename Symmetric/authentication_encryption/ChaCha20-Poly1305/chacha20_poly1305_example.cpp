@@ -2,6 +2,9 @@
 #include <openssl/rand.h>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 int main() {
     // Key and nonce sizes for ChaCha20-Poly1305
@@ -15,30 +18,25 @@ int main() {
     // Plaintext and AAD
     const char* plaintext = "OpenSSL ChaCha20-Poly1305 Example!";
     const char* aad = "header-data";
-    int pt_len = strlen(plaintext);
-    int aad_len = strlen(aad);
 
-    // Buffers
-    unsigned char ciphertext[128];
+    // Buffers: the message is sealed and opened in place
+    std::vector<unsigned char> message(plaintext, plaintext + strlen(plaintext));
     unsigned char tag[16];
-    unsigned char decrypted[128];
 
     // Encrypt
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     EVP_EncryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL);
     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, nonce_len, NULL);
     EVP_EncryptInit_ex(ctx, NULL, NULL, key, nonce);
-    int outlen;
-    EVP_EncryptUpdate(ctx, NULL, &outlen, (unsigned char*)aad, aad_len); // AAD
-    EVP_EncryptUpdate(ctx, ciphertext, &outlen, (unsigned char*)plaintext, pt_len);
-    int ciphertext_len = outlen;
-    EVP_EncryptFinal_ex(ctx, ciphertext + outlen, &outlen);
-    ciphertext_len += outlen;
-    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, 16, tag);
+    bool ok = CipherSpan::seal(ctx, ConstByteSpan(aad, strlen(aad)), message, message, ByteSpan(tag, sizeof(tag)));
     EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        std::cout << "Encryption failed!" << std::endl;
+        return 1;
+    }
 
     std::cout << "Ciphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i) printf("%02x", ciphertext[i]);
+    for (size_t i = 0; i < message.size(); ++i) printf("%02x", message[i]);
     std::cout << "\nTag: ";
     for (int i = 0; i < 16; ++i) printf("%02x", tag[i]);
     std::cout << std::endl;
@@ -48,16 +46,13 @@ int main() {
     EVP_DecryptInit_ex(ctx, EVP_chacha20_poly1305(), NULL, NULL, NULL);
     EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_IVLEN, nonce_len, NULL);
     EVP_DecryptInit_ex(ctx, NULL, NULL, key, nonce);
-    EVP_DecryptUpdate(ctx, NULL, &outlen, (unsigned char*)aad, aad_len); // AAD
-    EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, 16, tag);
-    int len;
-    int ret = EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len);
-    if (ret > 0 && EVP_DecryptFinal_ex(ctx, decrypted + len, &outlen) > 0) {
-        decrypted[len + outlen] = '\0';
-        std::cout << "Decrypted: " << decrypted << std::endl;
+    ok = CipherSpan::open(ctx, ConstByteSpan(aad, strlen(aad)), message, message, ConstByteSpan(tag, sizeof(tag)));
+    EVP_CIPHER_CTX_free(ctx);
+
+    if (ok) {
+        std::cout << "Decrypted: " << std::string(message.begin(), message.end()) << std::endl;
     } else {
         std::cout << "Decryption failed!" << std::endl;
     }
-    EVP_CIPHER_CTX_free(ctx);
     return 0;
 }
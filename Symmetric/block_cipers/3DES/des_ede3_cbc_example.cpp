@@ -2,6 +2,9 @@
 #include <openssl/rand.h>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 int main() {
     // Key and IV sizes for 3DES
@@ -44,32 +47,35 @@ int main() {
 
     // Plaintext
     const char* plaintext = "OpenSSL 3DES Example!";
-    int pt_len = strlen(plaintext);
-    unsigned char ciphertext[128];
-    unsigned char decrypted[128];
+    size_t pt_len = strlen(plaintext);
 
-    // Encrypt
+    // Encrypt into a buffer sized for the padded output
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     EVP_EncryptInit_ex(ctx, EVP_des_ede3_cbc(), NULL, key, iv);
-    int outlen1, outlen2;
-    EVP_EncryptUpdate(ctx, ciphertext, &outlen1, (unsigned char*)plaintext, pt_len);
-    EVP_EncryptFinal_ex(ctx, ciphertext + outlen1, &outlen2);
-    int ct_len = outlen1 + outlen2;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, pt_len));
+    size_t ct_len = 0;
+    bool ok = CipherSpan::run(ctx, ConstByteSpan(plaintext, pt_len), ciphertext, &ct_len);
     EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        std::cerr << "Encryption failed!" << std::endl;
+        return 1;
+    }
 
     std::cout << "Ciphertext: ";
-    for (int i = 0; i < ct_len; ++i) printf("%02x", ciphertext[i]);
+    for (size_t i = 0; i < ct_len; ++i) printf("%02x", ciphertext[i]);
     std::cout << std::endl;
 
-    // Decrypt
+    // Decrypt in place
     ctx = EVP_CIPHER_CTX_new();
     EVP_DecryptInit_ex(ctx, EVP_des_ede3_cbc(), NULL, key, iv);
-    int declen1, declen2;
-    EVP_DecryptUpdate(ctx, decrypted, &declen1, ciphertext, ct_len);
-    EVP_DecryptFinal_ex(ctx, decrypted + declen1, &declen2);
-    decrypted[declen1 + declen2] = '\0';
+    size_t dec_len = 0;
+    ok = CipherSpan::inPlace(ctx, ciphertext, ct_len, &dec_len);
     EVP_CIPHER_CTX_free(ctx);
+    if (!ok) {
+        std::cerr << "Decryption failed!" << std::endl;
+        return 1;
+    }
 
-    std::cout << "Decrypted: " << decrypted << std::endl;
+    std::cout << "Decrypted: " << std::string((const char*)ciphertext.data(), dec_len) << std::endl;
     return 0;
 }
@@ -1,82 +1,436 @@
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
 #include <openssl/hmac.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_span.h"
+#include "hmac_engine.h"
 
 void handleErrors() {
     std::cerr << "Error occurred!" << std::endl;
     exit(1);
 }
 
-int main()
+// Compares per-message MAC cost of the old two one-shot HMAC() calls with
+// the cached-key engine over IV || ciphertext.
+static void benchmark()
 {
+    unsigned char hmac_key[32];
+    unsigned char iv[16];
+    if (!RAND_bytes(hmac_key, sizeof(hmac_key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    std::vector<unsigned char> ciphertext(16384);
+    RAND_bytes(&ciphertext[0], (int)ciphertext.size());
+    HmacEngine engine;
+    unsigned char hmac[EVP_MAX_MD_SIZE];
+    unsigned int hmac_len;
+    size_t mac_len;
+    const int iterations = 200000;
+    std::cout << "Message   one-shot x2   engine   speedup   (ns per message)" << std::endl;
+    for (size_t size = 16; size <= ciphertext.size(); size *= 4)
+    {
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            HMAC(EVP_sha256(), hmac_key, sizeof(hmac_key), iv, sizeof(iv), hmac, &hmac_len);
+            HMAC(EVP_sha256(), hmac_key, sizeof(hmac_key), &ciphertext[0], size, hmac, &hmac_len);
+        }
+        double oneShot = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / iterations;
+        t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+        {
+            HmacSegment segs[2] = { { iv, sizeof(iv) }, { &ciphertext[0], size } };
+            engine.mac(hmac_key, sizeof(hmac_key), segs, 2, hmac, &mac_len);
+        }
+        double cached = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / iterations;
+        printf("%7zu   %11.0f   %6.0f   %6.2fx\n", size, oneShot, cached, oneShot / cached);
+    }
+}
+
+// Encrypt-then-MAC wire format:
+//   version (1) | IV (16) | AES-CBC ciphertext, PKCS#7 | HMAC-SHA256 tag (32)
+// The tag covers version || IV || ciphertext and is checked before any
+// plaintext is released or padding is looked at.
+static const unsigned char ETM_VERSION = 0x01;
+static const size_t ETM_HEADER = 17;
+static const size_t ETM_TAG = 32;
+// Interleave granularity: each chunk is encrypted and MACed while it is
+// still in L1, so the data crosses the memory bus once instead of twice.
+static const size_t ETM_CHUNK = 8192;
+
+// Streaming sealer: begin(), any number of update() calls, final().
+class EtmSealer
+{
+public:
+    // aes is AES-128-, AES-192- or AES-256-CBC; keys passed to begin()
+    // are that long.
+    EtmSealer(HmacEngine& engine, const EVP_CIPHER* aes)
+        : engine_(engine), aes_(aes), keyLen_((size_t)EVP_CIPHER_get_key_length(aes)), ctx_(EVP_CIPHER_CTX_new()),
+          keyed_(false)
+    {
+        if (!ctx_) handleErrors();
+    }
+    ~EtmSealer()
+    {
+        EVP_CIPHER_CTX_free(ctx_);
+        OPENSSL_cleanse(key_, sizeof(key_));
+    }
+
+    // Writes the ETM_HEADER-byte header to out.
+    size_t begin(const unsigned char* key, const unsigned char* macKey, size_t macKeyLen, const unsigned char* iv,
+                 unsigned char* out)
+    {
+        // The AES key schedule is kept while the key stays the same; each
+        // message then only loads its IV.
+        if (keyed_ && CRYPTO_memcmp(key, key_, keyLen_) == 0)
+        {
+            if (1 != EVP_EncryptInit_ex(ctx_, NULL, NULL, NULL, iv)) handleErrors();
+        }
+        else
+        {
+            if (1 != EVP_EncryptInit_ex(ctx_, aes_, NULL, key, iv)) handleErrors();
+            memcpy(key_, key, keyLen_);
+            keyed_ = true;
+        }
+        out[0] = ETM_VERSION;
+        memcpy(out + 1, iv, 16);
+        if (!engine_.begin(macKey, macKeyLen) || !engine_.update(out, ETM_HEADER)) handleErrors();
+        return ETM_HEADER;
+    }
+
+    // out needs room for len + 16 bytes.
+    size_t update(const unsigned char* in, size_t len, unsigned char* out)
+    {
+        size_t total = 0;
+        while (len > 0)
+        {
+            size_t n = len < ETM_CHUNK ? len : ETM_CHUNK;
+            int outLen;
+            if (1 != EVP_EncryptUpdate(ctx_, out + total, &outLen, in, (int)n)) handleErrors();
+            if (!engine_.update(out + total, (size_t)outLen)) handleErrors();
+            total += (size_t)outLen;
+            in += n;
+            len -= n;
+        }
+        return total;
+    }
+
+    // Final padded block and tag; out needs 16 + ETM_TAG bytes.
+    size_t final(unsigned char* out)
+    {
+        int outLen;
+        if (1 != EVP_EncryptFinal_ex(ctx_, out, &outLen)) handleErrors();
+        size_t tagLen;
+        if (!engine_.update(out, (size_t)outLen) || !engine_.final(out + outLen, &tagLen)) handleErrors();
+        return (size_t)outLen + tagLen;
+    }
+
+private:
+    HmacEngine& engine_;
+    const EVP_CIPHER* aes_;
+    size_t keyLen_;
+    EVP_CIPHER_CTX* ctx_;
+    unsigned char key_[32];
+    bool keyed_;
+    EtmSealer(const EtmSealer&);
+    EtmSealer& operator=(const EtmSealer&);
+};
+
+// Opens a sealed message in one interleaved pass: each chunk is MACed and
+// then decrypted into out while cached.  Nothing in out is valid, and the
+// padding is not examined, until the tag has verified; on failure out is
+// wiped and a single error covers every cause.
+static bool etmOpen(HmacEngine& engine, const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* macKey,
+                    size_t macKeyLen, const unsigned char* msg, size_t len, unsigned char* out, size_t* outLen)
+{
+    if (len < ETM_HEADER + 16 + ETM_TAG || (len - ETM_HEADER - ETM_TAG) % 16 != 0 || msg[0] != ETM_VERSION) return false;
+    size_t ctLen = len - ETM_HEADER - ETM_TAG;
+    const unsigned char* ct = msg + ETM_HEADER;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_DecryptInit_ex(ctx, aes, NULL, key, msg + 1) == 1 &&
+              EVP_CIPHER_CTX_set_padding(ctx, 0) == 1 && engine.begin(macKey, macKeyLen) &&
+              engine.update(msg, ETM_HEADER);
+    for (size_t off = 0; ok && off < ctLen; off += ETM_CHUNK)
+    {
+        size_t n = ctLen - off < ETM_CHUNK ? ctLen - off : ETM_CHUNK;
+        int decLen;
+        ok = engine.update(ct + off, n) && EVP_DecryptUpdate(ctx, out + off, &decLen, ct + off, (int)n) == 1;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    unsigned char tag[EVP_MAX_MD_SIZE];
+    size_t tagLen = 0;
+    ok = engine.final(tag, &tagLen) && ok && tagLen == ETM_TAG && CRYPTO_memcmp(tag, ct + ctLen, ETM_TAG) == 0;
+    if (ok)
+    {
+        // Authentic ciphertext, so the padding came from the sender.
+        unsigned char pad = out[ctLen - 1];
+        ok = pad >= 1 && pad <= 16;
+        for (size_t i = 0; ok && i < pad; ++i) ok = out[ctLen - 1 - i] == pad;
+        *outLen = ok ? ctLen - pad : 0;
+    }
+    if (!ok) OPENSSL_cleanse(out, ctLen);
+    return ok;
+}
+
+// The previous two-pass construction, same wire format: CBC over the whole
+// message, then a separate HMAC pass over header || ciphertext.
+static size_t twoPassSeal(HmacEngine& engine, EVP_CIPHER_CTX* ctx, const EVP_CIPHER* aes, const unsigned char* key,
+                          const unsigned char* macKey, size_t macKeyLen, const unsigned char* iv,
+                          const unsigned char* in, size_t len, unsigned char* out)
+{
+    out[0] = ETM_VERSION;
+    memcpy(out + 1, iv, 16);
+    int n1, n2;
+    if (1 != EVP_EncryptInit_ex(ctx, aes, NULL, key, iv)) handleErrors();
+    if (1 != EVP_EncryptUpdate(ctx, out + ETM_HEADER, &n1, in, (int)len)) handleErrors();
+    if (1 != EVP_EncryptFinal_ex(ctx, out + ETM_HEADER + n1, &n2)) handleErrors();
+    size_t ctLen = (size_t)(n1 + n2);
+    HmacSegment segs[2] = { { out, ETM_HEADER }, { out + ETM_HEADER, ctLen } };
+    size_t tagLen;
+    if (!engine.mac(macKey, macKeyLen, segs, 2, out + ETM_HEADER + ctLen, &tagLen)) handleErrors();
+    return ETM_HEADER + ctLen + tagLen;
+}
+
+// OpenSSL's stitched AES-CBC-HMAC-SHA256 cipher, when the CPU supports it,
+// in the only mode that yields a usable MAC: TLS 1.2 records.  Those are
+// MAC-then-encrypt (the MAC covers the plaintext and is encrypted with it),
+// so this cannot produce the encrypt-then-MAC format above; it is measured
+// here only to show what stitching is worth on this host.  Records carry at
+// most 16 KiB, as in TLS.  OpenSSL stitches AES-128 and AES-256 only.
+class StitchedTls
+{
+public:
+    StitchedTls(int bits, const unsigned char* key, const unsigned char* macKey, size_t macKeyLen)
+        : ctx_(NULL), seq_(0)
+    {
+        const EVP_CIPHER* cipher = NULL;
+        if (bits == 128)
+            cipher = EVP_aes_128_cbc_hmac_sha256();
+        else if (bits == 256)
+            cipher = EVP_aes_256_cbc_hmac_sha256();
+        unsigned char iv[16] = { 0 };
+        ctx_ = cipher ? EVP_CIPHER_CTX_new() : NULL;
+        if (ctx_ && (EVP_EncryptInit_ex(ctx_, cipher, NULL, key, iv) != 1 ||
+                     EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_SET_MAC_KEY, (int)macKeyLen, (void*)macKey) <= 0))
+        {
+            EVP_CIPHER_CTX_free(ctx_);
+            ctx_ = NULL;
+        }
+    }
+    ~StitchedTls() { EVP_CIPHER_CTX_free(ctx_); }
+
+    bool available() const { return ctx_ != NULL; }
+
+    // Seals len bytes of buf (explicit IV already in the first 16 bytes,
+    // payload after it) in place; buf needs room for MAC and padding.
+    bool sealRecord(unsigned char* buf, size_t payload)
+    {
+        unsigned char aad[13];
+        for (int i = 0; i < 8; ++i) aad[i] = (unsigned char)(seq_ >> (56 - 8 * i));
+        ++seq_;
+        size_t len = 16 + payload;
+        aad[8] = 0x17;
+        aad[9] = 0x03;
+        aad[10] = 0x03;
+        aad[11] = (unsigned char)(len >> 8);
+        aad[12] = (unsigned char)len;
+        int pad = EVP_CIPHER_CTX_ctrl(ctx_, EVP_CTRL_AEAD_TLS1_AAD, sizeof(aad), aad);
+        return pad > 0 && EVP_Cipher(ctx_, buf, buf, (unsigned int)(len + pad)) > 0;
+    }
+
+private:
+    EVP_CIPHER_CTX* ctx_;
+    unsigned long long seq_;
+    StitchedTls(const StitchedTls&);
+    StitchedTls& operator=(const StitchedTls&);
+};
+
+// Throughput of the two-pass and the interleaved single-pass seal (same
+// output, checked) and, for reference, the stitched TLS cipher.
+static void benchmarkSeal(const EVP_CIPHER* aes)
+{
+    unsigned char key[32], macKey[32], iv[16];
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(macKey, sizeof(macKey)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    const size_t maxSize = 1 << 20;
+    std::vector<unsigned char> in(maxSize), a(maxSize + 128), b(maxSize + 128), rec(16 + 16384 + 64);
+    RAND_bytes(&in[0], (int)in.size());
+    HmacEngine engine;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    EtmSealer sealer(engine, aes);
+    StitchedTls stitched(EVP_CIPHER_get_key_length(aes) * 8, key, macKey, sizeof(macKey));
+    std::cout << EVP_CIPHER_get0_name(aes) << " + HMAC-SHA256" << std::endl;
+    std::cout << "Message   two-pass MB/s   single-pass MB/s   speedup   stitched TLS (MtE) MB/s" << std::endl;
+    for (size_t size = 64; size <= maxSize; size *= 4)
+    {
+        int iterations = (int)((64u << 20) / size);
+        if (iterations < 200) iterations = 200;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        size_t lenA = 0;
+        for (int i = 0; i < iterations; ++i)
+            lenA = twoPassSeal(engine, ctx, aes, key, macKey, sizeof(macKey), iv, &in[0], size, &a[0]);
+        double twoPass = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        t0 = std::chrono::steady_clock::now();
+        size_t lenB = 0;
+        for (int i = 0; i < iterations; ++i)
+        {
+            lenB = sealer.begin(key, macKey, sizeof(macKey), iv, &b[0]);
+            lenB += sealer.update(&in[0], size, &b[lenB]);
+            lenB += sealer.final(&b[lenB]);
+        }
+        double onePass = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (lenA != lenB || memcmp(&a[0], &b[0], lenA) != 0) handleErrors();
+        double mb = (double)size * iterations / 1e6;
+        printf("%7zu   %13.0f   %16.0f   %6.2fx", size, mb / twoPass, mb / onePass, twoPass / onePass);
+        if (stitched.available())
+        {
+            t0 = std::chrono::steady_clock::now();
+            for (int i = 0; i < iterations; ++i)
+            {
+                for (size_t off = 0; off < size; off += 16384)
+                {
+                    size_t n = size - off < 16384 ? size - off : 16384;
+                    memcpy(&rec[16], &in[off], n);
+                    if (!stitched.sealRecord(&rec[0], n)) handleErrors();
+                }
+            }
+            double tls = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            printf("   %13.0f", mb / tls);
+        }
+        else
+        {
+            printf("   %13s", "n/a");
+        }
+        printf("\n");
+    }
+    EVP_CIPHER_CTX_free(ctx);
+}
+
+int main(int argc, char* argv[])
+{
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    bool macBench = false, sealBench = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "bck:")) != -1)
+    {
+        if (opt == 'b')
+            macBench = true;
+        else if (opt == 'c')
+            sealBench = true;
+        else if (opt == 'k')
+            bits = atoi(optarg);
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* aes = AesDispatch::cipher("CBC", bits);
+    if (!aes || optind != argc)
+    {
+        std::cerr << "Usage: " << argv[0] << " [-k 128|192|256] [-b | -c]   # demo, MAC benchmark, seal benchmark\n"
+                  << "       " << argv[0] << " --cpu-report" << std::endl;
+        return 1;
+    }
+    if (macBench)
+    {
+        benchmark();
+        return 0;
+    }
+    if (sealBench)
+    {
+        benchmarkSeal(aes);
+        return 0;
+    }
+
     // Key and IV
-    unsigned char key[16];      // 128-bit key
+    const int keyLen = bits / 8;
+    unsigned char key[32];      // 128-, 192- or 256-bit key
     unsigned char hmac_key[32]; // 256-bit key for HMAC
     unsigned char iv[16];       // 128-bit IV for CBC
-    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(hmac_key, sizeof(hmac_key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    if (!RAND_bytes(key, keyLen) || !RAND_bytes(hmac_key, sizeof(hmac_key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
 
     // Data
     const char* plaintext = "This is AES CBC";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
+    size_t plaintext_len = strlen(plaintext);
     // No tag needed for CBC
 
     // Encrypt
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
-    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, NULL, NULL)) handleErrors();
+    if (1 != EVP_EncryptInit_ex(ctx, aes, NULL, NULL, NULL)) handleErrors();
     if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
 
-    int len;
-    int ciphertext_len;
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, (unsigned char*)plaintext, plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    size_t ciphertext_len = 0;
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     std::cout << "Key: ";
-    for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)key[i];
+    for (int i = 0; i < keyLen; ++i) std::cout << std::hex << (int)key[i];
     std::cout << "\nHMAC Key: ";
     for (int i = 0; i < 32; ++i) std::cout << std::hex << (int)hmac_key[i];
     std::cout << "\nIV: ";
     for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)iv[i];
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
+    for (size_t i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
 
-    // Calculate HMAC over (IV + ciphertext)
+    // Encrypt-then-MAC: one HMAC over IV || ciphertext, fed as two segments
+    HmacEngine engine;
+    HmacSegment segs[2] = { { iv, sizeof(iv) }, { ciphertext.data(), ciphertext_len } };
     unsigned char hmac[EVP_MAX_MD_SIZE];
-    unsigned int hmac_len;
-    HMAC(EVP_sha256(), hmac_key, sizeof(hmac_key), iv, sizeof(iv), hmac, &hmac_len);
-    std::cout << "\nHMAC1: ";
-    for (unsigned int i = 0; i < hmac_len; ++i) std::cout << std::hex << (int)hmac[i];
-    HMAC(EVP_sha256(), hmac_key, sizeof(hmac_key), ciphertext, ciphertext_len, hmac, &hmac_len);
-    std::cout << "\nHMAC2: ";
-    for (unsigned int i = 0; i < hmac_len; ++i) std::cout << std::hex << (int)hmac[i];
+    size_t hmac_len;
+    if (!engine.mac(hmac_key, sizeof(hmac_key), segs, 2, hmac, &hmac_len)) handleErrors();
+    std::cout << "\nHMAC: ";
+    for (size_t i = 0; i < hmac_len; ++i) std::cout << std::hex << (int)hmac[i];
     std::cout << std::endl;
 
     EVP_CIPHER_CTX_free(ctx);
 
-    // Decrypt
+    // Verify the tag before touching the ciphertext
+    if (!engine.verify(hmac_key, sizeof(hmac_key), segs, 2, hmac, hmac_len))
+    {
+        std::cout << "HMAC verification failed!" << std::endl;
+        return 1;
+    }
+    std::cout << "HMAC verified" << std::endl;
+
+    // Decrypt in place over the verified ciphertext
     ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, NULL, NULL)) handleErrors();
+    if (1 != EVP_DecryptInit_ex(ctx, aes, NULL, NULL, NULL)) handleErrors();
     if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
-    unsigned char decrypted[128];
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    int decrypted_len = len;
-    int ret = EVP_DecryptFinal_ex(ctx, decrypted + len, &len);
-    if (ret > 0)
+    size_t decrypted_len = 0;
+    if (CipherSpan::inPlace(ctx, ciphertext, ciphertext_len, &decrypted_len))
     {
-        decrypted_len += len;
-        decrypted[decrypted_len] = '\0';
-        std::cout << "Decrypted: " << decrypted << std::endl;
+        std::cout << "Decrypted: " << std::string((const char*)ciphertext.data(), decrypted_len) << std::endl;
     }
     else
     {
         std::cout << "Decryption failed!" << std::endl;
     }
     EVP_CIPHER_CTX_free(ctx);
+
+    // The same message in the single-pass encrypt-then-MAC wire format
+    EtmSealer sealer(engine, aes);
+    std::vector<unsigned char> sealed(ETM_HEADER + CipherSpan::outputSize(aes, plaintext_len, true) + ETM_TAG);
+    size_t sealed_len = sealer.begin(key, hmac_key, sizeof(hmac_key), iv, sealed.data());
+    sealed_len += sealer.update((const unsigned char*)plaintext, plaintext_len, sealed.data() + sealed_len);
+    sealed_len += sealer.final(sealed.data() + sealed_len);
+    std::vector<unsigned char> opened(sealed_len);
+    size_t opened_len;
+    if (!etmOpen(engine, aes, key, hmac_key, sizeof(hmac_key), sealed.data(), sealed_len, opened.data(), &opened_len))
+    {
+        std::cout << "Sealed message rejected!" << std::endl;
+        return 1;
+    }
+    std::cout << "Sealed (" << std::dec << sealed_len << " bytes), opened: "
+              << std::string((const char*)opened.data(), opened_len) << std::endl;
     return 0;
 }
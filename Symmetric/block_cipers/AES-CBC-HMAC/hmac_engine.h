@@ -0,0 +1,160 @@
+// HMAC with precomputed key state.
+//
+// One-shot HMAC() rebuilds the ipad/opad blocks (two compression-function
+// calls plus context allocation) on every call.  HmacEngine keys one
+// EVP_MAC_CTX per distinct key and keeps it; each message then re-arms that
+// context with EVP_MAC_init(ctx, NULL, 0, NULL), which restores the cached
+// inner/outer digest state instead of re-deriving it and allocates nothing.
+//
+// An engine is not thread-safe; use one per thread.
+#ifndef HMAC_ENGINE_H
+#define HMAC_ENGINE_H
+
+#include <openssl/core_names.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/params.h>
+#include <cstddef>
+#include <list>
+#include <map>
+#include <string>
+
+// One piece of a scatter/gather MAC input.
+struct HmacSegment
+{
+    const unsigned char* data;
+    size_t len;
+};
+
+class HmacEngine
+{
+public:
+    explicit HmacEngine(const char* digest = "SHA256", size_t capacity = 64)
+        : mac_(EVP_MAC_fetch(NULL, "HMAC", NULL)), digest_(digest), capacity_(capacity), current_(NULL)
+    {
+    }
+
+    ~HmacEngine()
+    {
+        while (!lru_.empty()) evictOldest();
+        EVP_MAC_free(mac_);
+    }
+
+    // MAC over the concatenation of segs[0..count) without copying them
+    // together.  out must hold EVP_MAX_MD_SIZE bytes.
+    bool mac(const unsigned char* key, size_t keyLen, const HmacSegment* segs, size_t count,
+             unsigned char* out, size_t* outLen)
+    {
+        EVP_MAC_CTX* ctx = keyed(key, keyLen);
+        if (!ctx || !EVP_MAC_init(ctx, NULL, 0, NULL)) return false;
+        for (size_t i = 0; i < count; ++i)
+        {
+            if (!EVP_MAC_update(ctx, segs[i].data, segs[i].len)) return false;
+        }
+        return EVP_MAC_final(ctx, out, outLen, EVP_MAX_MD_SIZE) == 1;
+    }
+
+    // Incremental form of mac() for data produced piece by piece: begin()
+    // re-arms the cached context for key, then update() and final().  Only
+    // one incremental MAC per engine may be open at a time.
+    bool begin(const unsigned char* key, size_t keyLen)
+    {
+        current_ = keyed(key, keyLen);
+        return current_ && EVP_MAC_init(current_, NULL, 0, NULL);
+    }
+
+    bool update(const unsigned char* data, size_t len) { return current_ && EVP_MAC_update(current_, data, len); }
+
+    bool final(unsigned char* out, size_t* outLen)
+    {
+        bool ok = current_ && EVP_MAC_final(current_, out, outLen, EVP_MAX_MD_SIZE) == 1;
+        current_ = NULL;
+        return ok;
+    }
+
+    // Constant-time check of an expected tag.
+    bool verify(const unsigned char* key, size_t keyLen, const HmacSegment* segs, size_t count,
+                const unsigned char* tag, size_t tagLen)
+    {
+        unsigned char computed[EVP_MAX_MD_SIZE];
+        size_t len;
+        if (!mac(key, keyLen, segs, count, computed, &len) || len != tagLen) return false;
+        bool ok = CRYPTO_memcmp(computed, tag, len) == 0;
+        OPENSSL_cleanse(computed, sizeof(computed));
+        return ok;
+    }
+
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+private:
+    typedef std::list<std::string> Lru; // most recently used first
+
+    struct Entry
+    {
+        EVP_MAC_CTX* ctx;
+        Lru::iterator pos;
+    };
+
+    // Cached context for key, keyed on first use; evicts the least recently
+    // used key when the cache is full.
+    EVP_MAC_CTX* keyed(const unsigned char* key, size_t keyLen)
+    {
+        std::string id(reinterpret_cast<const char*>(key), keyLen);
+        std::map<std::string, Entry>::iterator it = cache_.find(id);
+        if (it != cache_.end())
+        {
+            ++hits_;
+            lru_.splice(lru_.begin(), lru_, it->second.pos);
+            OPENSSL_cleanse(&id[0], id.size());
+            return it->second.ctx;
+        }
+        ++misses_;
+        if (!mac_) return NULL;
+        EVP_MAC_CTX* ctx = EVP_MAC_CTX_new(mac_);
+        OSSL_PARAM params[2];
+        params[0] = OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, const_cast<char*>(digest_.c_str()), 0);
+        params[1] = OSSL_PARAM_construct_end();
+        if (!ctx || !EVP_MAC_init(ctx, key, keyLen, params))
+        {
+            EVP_MAC_CTX_free(ctx);
+            OPENSSL_cleanse(&id[0], id.size());
+            return NULL;
+        }
+        if (cache_.size() >= capacity_) evictOldest();
+        lru_.push_front(id);
+        Entry e;
+        e.ctx = ctx;
+        e.pos = lru_.begin();
+        cache_[id] = e;
+        OPENSSL_cleanse(&id[0], id.size());
+        return ctx;
+    }
+
+    void evictOldest()
+    {
+        std::string& id = lru_.back();
+        std::map<std::string, Entry>::iterator it = cache_.find(id);
+        if (it->second.ctx == current_) current_ = NULL;
+        EVP_MAC_CTX_free(it->second.ctx);
+        // The map key is a copy of the raw key bytes; wipe both copies.
+        OPENSSL_cleanse(const_cast<char*>(it->first.data()), it->first.size());
+        cache_.erase(it);
+        OPENSSL_cleanse(&id[0], id.size());
+        lru_.pop_back();
+    }
+
+    EVP_MAC* mac_;
+    std::string digest_;
+    size_t capacity_;
+    EVP_MAC_CTX* current_;
+    std::map<std::string, Entry> cache_;
+    Lru lru_;
+    size_t hits_ = 0;
+    size_t misses_ = 0;
+
+    HmacEngine(const HmacEngine&);
+    HmacEngine& operator=(const HmacEngine&);
+};
+
+#endif
@@ -1,17 +1,255 @@
+#include <openssl/crypto.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
+#include <chrono>
+#include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+#include "cipher_ctx_pool.h"
+#include "cipher_span.h"
+
+static const size_t BLOCK = 16;
+// Large files are decrypted in batches of this size to bound memory.
+static const size_t BATCH = 64 << 20;
 
 void handleErrors() {
     std::cerr << "Error occurred!" << std::endl;
     exit(1);
 }
 
-int main()
+// Plain CBC decryption (no padding handling) of one block-aligned range.
+static bool cbcDecryptRange(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                            const unsigned char* in, unsigned char* out, size_t len)
+{
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_DecryptInit_ex(ctx, aes, NULL, key, iv) == 1 &&
+              EVP_CIPHER_CTX_set_padding(ctx, 0) == 1;
+    while (ok && len > 0)
+    {
+        int piece = len > (1u << 30) ? (1 << 30) : (int)len;
+        int outLen;
+        ok = EVP_DecryptUpdate(ctx, out, &outLen, in, piece) == 1;
+        in += piece;
+        out += piece;
+        len -= (size_t)piece;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+// CBC decryption is P[i] = D(C[i]) ^ C[i-1]: every plaintext block needs
+// only two ciphertext blocks, so the ciphertext can be cut at any block
+// boundary and each chunk decrypted on its own thread, with the last
+// ciphertext block before the chunk (or the IV) as that chunk's IV.
+static bool cbcDecryptParallel(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                               const unsigned char* in, unsigned char* out, size_t len, unsigned threads)
+{
+    size_t blocks = len / BLOCK;
+    if (threads > blocks) threads = blocks ? (unsigned)blocks : 1;
+    if (threads <= 1) return cbcDecryptRange(aes, key, iv, in, out, len);
+    std::vector<std::thread> workers;
+    std::vector<char> ok(threads, 0);
+    size_t per = blocks / threads, extra = blocks % threads, off = 0;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        size_t n = (per + (t < extra ? 1 : 0)) * BLOCK;
+        const unsigned char* chunkIv = off == 0 ? iv : in + off - BLOCK;
+        workers.push_back(std::thread([=, &ok] { ok[t] = cbcDecryptRange(aes, key, chunkIv, in + off, out + off, n); }));
+        off += n;
+    }
+    bool all = true;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers[t].join();
+        all = all && ok[t];
+    }
+    return all;
+}
+
+// PKCS#7 check on the final plaintext block only; returns the padding
+// length, or 0 if the padding is malformed.  Every byte is examined so the
+// time taken does not depend on where a bad byte sits.
+static size_t pkcs7Padding(const unsigned char* last)
+{
+    unsigned char pad = last[BLOCK - 1];
+    unsigned char bad = (unsigned char)((pad == 0) | (pad > BLOCK));
+    for (size_t i = 0; i < BLOCK; ++i)
+    {
+        unsigned char inPad = (unsigned char)(BLOCK - i <= pad);
+        bad |= (unsigned char)(inPad & (last[i] != pad));
+    }
+    return bad ? 0 : pad;
+}
+
+static bool writeAll(FILE* f, const unsigned char* data, size_t len)
+{
+    return len == 0 || fwrite(data, 1, len, f) == len;
+}
+
+// Streams a large CBC ciphertext through the parallel decryptor.  The last
+// plaintext block of each batch is held back until end of file is known,
+// so padding is checked and stripped exactly once, on the final block.
+static int decryptFile(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv, const char* inPath,
+                       const char* outPath, unsigned threads)
+{
+    FILE* in = fopen(inPath, "rb");
+    FILE* out = in ? fopen(outPath, "wb") : NULL;
+    if (!in || !out)
+    {
+        std::cerr << "Error: Cannot open " << (in ? outPath : inPath) << std::endl;
+        return 1;
+    }
+    std::vector<unsigned char> cipher(BATCH), plain(BATCH);
+    unsigned char chainIv[BLOCK], held[BLOCK];
+    memcpy(chainIv, iv, BLOCK);
+    bool haveHeld = false, ok = true;
+    unsigned long long total = 0;
+    auto start = std::chrono::steady_clock::now();
+    size_t n;
+    while (ok && (n = fread(cipher.data(), 1, BATCH, in)) > 0)
+    {
+        if (n % BLOCK != 0)
+        {
+            ok = false;
+            break;
+        }
+        ok = cbcDecryptParallel(aes, key, chainIv, cipher.data(), plain.data(), n, threads) &&
+             (!haveHeld || writeAll(out, held, BLOCK)) && writeAll(out, plain.data(), n - BLOCK);
+        memcpy(held, plain.data() + n - BLOCK, BLOCK);
+        memcpy(chainIv, cipher.data() + n - BLOCK, BLOCK);
+        haveHeld = true;
+        total += n;
+    }
+    size_t pad = haveHeld ? pkcs7Padding(held) : 0;
+    ok = ok && pad != 0 && writeAll(out, held, BLOCK - pad);
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    OPENSSL_cleanse(held, sizeof(held));
+    OPENSSL_cleanse(plain.data(), plain.size());
+    fclose(in);
+    ok = fclose(out) == 0 && ok;
+    if (!ok)
+    {
+        // One message for short input, bad padding and I/O errors alike, so
+        // the tool cannot serve as a padding oracle.
+        remove(outPath);
+        std::cout << "Decryption failed!" << std::endl;
+        return 1;
+    }
+    std::cout << "Decrypted " << total << " bytes with " << threads << " threads, "
+              << (s > 0 ? total / s / 1e9 : 0) << " GB/s" << std::endl;
+    return 0;
+}
+
+// Serial CBC encryption with PKCS#7 padding, for producing test input.
+static int encryptFile(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv, const char* inPath,
+                       const char* outPath)
+{
+    FILE* in = fopen(inPath, "rb");
+    FILE* out = in ? fopen(outPath, "wb") : NULL;
+    if (!in || !out)
+    {
+        std::cerr << "Error: Cannot open " << (in ? outPath : inPath) << std::endl;
+        return 1;
+    }
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx) handleErrors();
+    if (1 != EVP_EncryptInit_ex(ctx, aes, NULL, key, iv)) handleErrors();
+    std::vector<unsigned char> plain(BATCH), cipher(BATCH + BLOCK);
+    int len;
+    size_t n;
+    while ((n = fread(plain.data(), 1, BATCH, in)) > 0)
+    {
+        if (1 != EVP_EncryptUpdate(ctx, cipher.data(), &len, plain.data(), (int)n)) handleErrors();
+        if (!writeAll(out, cipher.data(), (size_t)len)) handleErrors();
+    }
+    if (1 != EVP_EncryptFinal_ex(ctx, cipher.data(), &len)) handleErrors();
+    if (!writeAll(out, cipher.data(), (size_t)len)) handleErrors();
+    EVP_CIPHER_CTX_free(ctx);
+    fclose(in);
+    if (fclose(out) != 0) handleErrors();
+    return 0;
+}
+
+// Round trip (encrypt + decrypt) of one message through a fresh context
+// per direction, the pattern of the demo below before the pool.
+static bool roundTripFresh(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                           const unsigned char* in, int len, unsigned char* ct, unsigned char* pt)
+{
+    int n1, n2, ctLen;
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_EncryptInit_ex(ctx, aes, NULL, key, iv) == 1 &&
+              EVP_EncryptUpdate(ctx, ct, &n1, in, len) == 1 && EVP_EncryptFinal_ex(ctx, ct + n1, &n2) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok) return false;
+    ctLen = n1 + n2;
+    ctx = EVP_CIPHER_CTX_new();
+    ok = ctx && EVP_DecryptInit_ex(ctx, aes, NULL, key, iv) == 1 &&
+         EVP_DecryptUpdate(ctx, pt, &n1, ct, ctLen) == 1 && EVP_DecryptFinal_ex(ctx, pt + n1, &n2) == 1;
+    EVP_CIPHER_CTX_free(ctx);
+    return ok && n1 + n2 == len;
+}
+
+// Same round trip through the per-thread pool: only the IV is re-armed.
+static bool roundTripPooled(const EVP_CIPHER* aes, const unsigned char* key, const unsigned char* iv,
+                            const unsigned char* in, int len, unsigned char* ct, unsigned char* pt)
+{
+    int n1, n2, ctLen;
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(aes, key, iv, true);
+    if (!ctx || EVP_EncryptUpdate(ctx, ct, &n1, in, len) != 1 || EVP_EncryptFinal_ex(ctx, ct + n1, &n2) != 1)
+        return false;
+    ctLen = n1 + n2;
+    ctx = CipherCtxPool::arm(aes, key, iv, false);
+    if (!ctx || EVP_DecryptUpdate(ctx, pt, &n1, ct, ctLen) != 1 || EVP_DecryptFinal_ex(ctx, pt + n1, &n2) != 1)
+        return false;
+    return n1 + n2 == len;
+}
+
+static int benchPool(const EVP_CIPHER* aes)
 {
+    unsigned char key[32], iv[16], in[1024], ct[1024 + 16], pt[1024 + 16];
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv)) || !RAND_bytes(in, sizeof(in))) handleErrors();
+    const int iterations = 500000;
+    std::cout << EVP_CIPHER_get0_name(aes) << " round trips (encrypt + decrypt), messages/sec" << std::endl;
+    std::cout << "Message      fresh ctx       pooled   speedup" << std::endl;
+    for (int size = 64; size <= 1024; size *= 16)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            if (!roundTripFresh(aes, key, iv, in, size, ct, pt)) handleErrors();
+        double fresh = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; ++i)
+            if (!roundTripPooled(aes, key, iv, in, size, ct, pt)) handleErrors();
+        double pooled = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        if (memcmp(in, pt, (size_t)size) != 0) handleErrors();
+        printf("%5d B   %12.0f %12.0f   %6.2fx\n", size, iterations / fresh, iterations / pooled, fresh / pooled);
+    }
+    std::cout << "Pool hits " << CipherCtxPool::hits() << ", misses " << CipherCtxPool::misses() << std::endl;
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0)
+    {
+        int bits = argc == 2 ? 128 : argc == 4 && strcmp(argv[2], "-b") == 0 ? atoi(argv[3]) : 0;
+        const EVP_CIPHER* aes = AesDispatch::cipher("CBC", bits);
+        if (!aes)
+        {
+            std::cerr << "Usage: " << argv[0] << " bench [-b 128|192|256]" << std::endl;
+            return 1;
+        }
+        return benchPool(aes);
+    }
+
     // Key and IV
-    unsigned char key[16]; // 128-bit key for AES
+    unsigned char key[32]; // 128-, 192- or 256-bit key for AES
     unsigned char iv[16];  // 128-bit IV for CBC
     // Load key from file
     FILE* kf = fopen("aes_key.bin", "rb");
@@ -20,9 +258,12 @@ int main()
         std::cerr << "Error: Cannot open aes_key.bin for reading!" << std::endl;
         return 1;
     }
-    if (fread(key, 1, sizeof(key), kf) != sizeof(key))
+    // The key size follows the file: 16, 24 or 32 bytes (aes_create_key).
+    size_t keyLen = fread(key, 1, sizeof(key), kf);
+    const EVP_CIPHER* aes = AesDispatch::cipher("CBC", AesDispatch::bitsForKeyLength(keyLen));
+    if (!aes || fgetc(kf) != EOF)
     {
-        std::cerr << "Error: Failed to read AES key from file!" << std::endl;
+        std::cerr << "Error: aes_key.bin must hold a 128-, 192- or 256-bit AES key!" << std::endl;
         fclose(kf);
         return 1;
     }
@@ -42,53 +283,64 @@ int main()
     }
     fclose(ivf);
 
+    // File modes: aes_cbc encrypt <in> <out> | aes_cbc decrypt [-j threads] <in> <out>
+    if (argc > 1)
+    {
+        std::string mode = argv[1];
+        unsigned threads = std::thread::hardware_concurrency();
+        if (threads == 0) threads = 1;
+        optind = 2;
+        int opt;
+        while ((opt = getopt(argc, argv, "j:")) != -1)
+        {
+            if (opt == 'j')
+                threads = (unsigned)atoi(optarg);
+            else
+            {
+                optind = argc + 1;
+                break;
+            }
+        }
+        if ((mode != "encrypt" && mode != "decrypt") || optind != argc - 2 || threads == 0)
+        {
+            std::cerr << "Usage: " << argv[0] << " [encrypt <in> <out> | decrypt [-j threads] <in> <out> | bench [-b bits] | --cpu-report]" << std::endl;
+            return 1;
+        }
+        if (mode == "encrypt") return encryptFile(aes, key, iv, argv[optind], argv[optind + 1]);
+        return decryptFile(aes, key, iv, argv[optind], argv[optind + 1], threads);
+    }
+
     // Data
     const char* plaintext = "This is AES CBC HMAC";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
+    size_t plaintext_len = strlen(plaintext);
 
-    // Encrypt
-    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    // Encrypt: a pooled context keyed once per thread, re-armed with the IV
+    EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(aes, key, iv, true);
     if (!ctx) handleErrors();
-    if (1 != EVP_EncryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, NULL, NULL)) handleErrors();
-    if (1 != EVP_EncryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
 
-    int len;
-    int ciphertext_len;
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, (unsigned char*)plaintext, plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    size_t ciphertext_len = 0;
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     std::cout << "Key: ";
-    for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)key[i];
+    for (size_t i = 0; i < keyLen; ++i) std::cout << std::hex << (int)key[i];
     std::cout << "\nIV: ";
     for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)iv[i];
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
+    for (size_t i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
     std::cout << std::endl;
 
-    EVP_CIPHER_CTX_free(ctx);
-
-    // Decrypt
-    ctx = EVP_CIPHER_CTX_new();
+    // Decrypt in place over the ciphertext
+    ctx = CipherCtxPool::arm(aes, key, iv, false);
     if (!ctx) handleErrors();
-    if (1 != EVP_DecryptInit_ex(ctx, EVP_aes_128_cbc(), NULL, NULL, NULL)) handleErrors();
-    if (1 != EVP_DecryptInit_ex(ctx, NULL, NULL, key, iv)) handleErrors();
-    unsigned char decrypted[128];
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    int decrypted_len = len;
-    int ret = EVP_DecryptFinal_ex(ctx, decrypted + len, &len);
-    if (ret > 0)
-    {
-        decrypted_len += len;
-        decrypted[decrypted_len] = '\0';
-        std::cout << "Decrypted: " << decrypted << std::endl;
+    size_t decrypted_len = 0;
+    if (CipherSpan::inPlace(ctx, ciphertext, ciphertext_len, &decrypted_len))
+    {
+        std::cout << "Decrypted: " << std::string((const char*)ciphertext.data(), decrypted_len) << std::endl;
     }
     else
     {
         std::cout << "Decryption failed!" << std::endl;
     }
-    EVP_CIPHER_CTX_free(ctx);
     return 0;
 }
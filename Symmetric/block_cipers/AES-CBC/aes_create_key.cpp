@@ -1,12 +1,22 @@
 #include <openssl/rand.h>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
 
-int main()
+int main(int argc, char* argv[])
 {
-    unsigned char key[16]; // 128-bit key
+    // Optional key size in bits (128, 192 or 256).  aes_cbc takes the
+    // size from the file; aes_ctr needs a matching -b.
+    int bits = argc > 1 ? atoi(argv[1]) : 128;
+    if (bits != 128 && bits != 192 && bits != 256)
+    {
+        std::cerr << "Usage: " << argv[0] << " [128|192|256]" << std::endl;
+        return 1;
+    }
+    size_t keyLen = (size_t)bits / 8;
+    unsigned char key[32]; // up to 256-bit key
     unsigned char iv[16];  // 128-bit IV
-    if (!RAND_bytes(key, sizeof(key)))
+    if (!RAND_bytes(key, (int)keyLen))
     {
         std::cerr << "Error generating AES key!" << std::endl;
         return 1;
@@ -22,7 +32,7 @@ int main()
         std::cerr << "Cannot open aes_key.bin for writing!" << std::endl;
         return 1;
     }
-    fwrite(key, 1, sizeof(key), kf);
+    fwrite(key, 1, keyLen, kf);
     fclose(kf);
     FILE* ivf = fopen("aes_iv.bin", "wb");
     if (!ivf)
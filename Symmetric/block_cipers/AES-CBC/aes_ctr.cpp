@@ -0,0 +1,225 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "aes_dispatch.h"
+
+// Multi-threaded AES-CTR.  The keystream block for block index b is
+// AES(key, IV + b), so any range of the message can be processed on its
+// own: a worker starting at block b simply starts its own context with
+// counter IV + b.  Ranges are block-aligned, so no worker ever holds a
+// partial keystream block and the output is identical to one
+// EVP_EncryptUpdate over the whole buffer.
+
+static const size_t BLOCK = 16;
+// Files are processed in batches of this size to keep memory bounded.
+static const size_t BATCH = 64 << 20;
+
+void handleErrors() {
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+// counter = iv + blocks, as a 128-bit big-endian addition (the same
+// increment OpenSSL applies between blocks).
+static void counterAt(const unsigned char* iv, unsigned long long blocks, unsigned char* counter)
+{
+    memcpy(counter, iv, BLOCK);
+    unsigned int carry = 0;
+    for (int i = BLOCK - 1; i >= 0; --i)
+    {
+        unsigned int sum = counter[i] + (unsigned int)(blocks & 0xff) + carry;
+        counter[i] = (unsigned char)sum;
+        carry = sum >> 8;
+        blocks >>= 8;
+    }
+}
+
+static bool ctrRange(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv,
+                     unsigned long long firstBlock, const unsigned char* in, unsigned char* out, size_t len)
+{
+    unsigned char counter[BLOCK];
+    counterAt(iv, firstBlock, counter);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    bool ok = ctx && EVP_EncryptInit_ex(ctx, cipher, NULL, key, counter) == 1;
+    // EVP lengths are int; feed large ranges in pieces.
+    while (ok && len > 0)
+    {
+        int piece = len > (1u << 30) ? (1 << 30) : (int)len;
+        int outLen;
+        ok = EVP_EncryptUpdate(ctx, out, &outLen, in, piece) == 1;
+        in += piece;
+        out += piece;
+        len -= (size_t)piece;
+    }
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+// Encrypts (or, identically, decrypts) len bytes that start at block
+// firstBlock of the message, split across threads.
+static bool ctrParallel(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv,
+                        unsigned long long firstBlock, const unsigned char* in, unsigned char* out, size_t len,
+                        unsigned threads)
+{
+    size_t blocks = (len + BLOCK - 1) / BLOCK;
+    if (threads > blocks) threads = blocks ? (unsigned)blocks : 1;
+    if (threads <= 1) return ctrRange(cipher, key, iv, firstBlock, in, out, len);
+    std::vector<std::thread> workers;
+    std::vector<char> ok(threads, 0);
+    size_t per = blocks / threads, extra = blocks % threads, block = 0;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        size_t count = per + (t < extra ? 1 : 0);
+        size_t off = block * BLOCK;
+        size_t n = std::min(count * BLOCK, len - off);
+        workers.push_back(std::thread([=, &ok] {
+            ok[t] = ctrRange(cipher, key, iv, firstBlock + block, in + off, out + off, n);
+        }));
+        block += count;
+    }
+    bool all = true;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers[t].join();
+        all = all && ok[t];
+    }
+    return all;
+}
+
+static bool readFile(const char* path, unsigned char* buf, size_t len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fread(buf, 1, len, f) == len;
+    fclose(f);
+    return ok;
+}
+
+static int bench(const EVP_CIPHER* cipher, int bits, unsigned maxThreads, size_t mib)
+{
+    unsigned char key[32], iv[BLOCK];
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    // Start the counter near a carry into the upper 64 bits so the
+    // per-thread counter arithmetic is exercised across it.
+    memset(iv + 8, 0xff, 8);
+    size_t len = mib << 20;
+    std::vector<unsigned char> in(len), reference(len), out(len);
+    if (!RAND_bytes(in.data(), (int)std::min(len, (size_t)1 << 20))) handleErrors();
+    if (!ctrRange(cipher, key, iv, 0, in.data(), reference.data(), len)) handleErrors();
+
+    std::cout << "AES-" << bits << "-CTR, " << mib << " MiB" << std::endl;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        double best = 0;
+        for (int rep = 0; rep < 3; ++rep)
+        {
+            auto start = std::chrono::steady_clock::now();
+            if (!ctrParallel(cipher, key, iv, 0, in.data(), out.data(), len, threads)) handleErrors();
+            double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            if (best == 0 || s < best) best = s;
+        }
+        bool same = memcmp(out.data(), reference.data(), len) == 0;
+        printf("  %2u thread%s %8.2f GB/s  %s\n", threads, threads == 1 ? " " : "s", len / best / 1e9,
+               same ? "matches single-threaded" : "MISMATCH");
+        if (!same) return 1;
+        if (threads == maxThreads) break;
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    return 0;
+}
+
+int main(int argc, char* argv[])
+{
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    size_t mib = 256;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:j:m:")) != -1)
+    {
+        if (opt == 'b')
+            bits = atoi(optarg);
+        else if (opt == 'j')
+            threads = (unsigned)atoi(optarg);
+        else if (opt == 'm')
+            mib = (size_t)strtoul(optarg, NULL, 10);
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* cipher = AesDispatch::cipher("CTR", bits);
+    bool isBench = optind == argc - 1 && strcmp(argv[optind], "bench") == 0;
+    if (!cipher || threads == 0 || (!isBench && optind != argc - 2))
+    {
+        std::cerr << "Usage: " << argv[0] << " [-b 128|192|256] [-j threads] <input> <output>\n"
+                  << "       " << argv[0] << " [-b 128|192|256] [-j max_threads] [-m mib] bench\n"
+                  << "       " << argv[0] << " --cpu-report\n";
+        return 1;
+    }
+    if (isBench) return bench(cipher, bits, threads, mib);
+
+    // Same key material as aes_cbc: aes_key.bin (bits / 8 bytes, see
+    // aes_create_key) and the 16-byte aes_iv.bin as the initial counter.
+    unsigned char key[32], iv[BLOCK];
+    if (!readFile("aes_key.bin", key, (size_t)bits / 8))
+    {
+        std::cerr << "Error: aes_key.bin must hold a " << bits << "-bit key (./aes_create_key " << bits << ")"
+                  << std::endl;
+        return 1;
+    }
+    if (!readFile("aes_iv.bin", iv, sizeof(iv)))
+    {
+        std::cerr << "Error: Cannot read aes_iv.bin!" << std::endl;
+        return 1;
+    }
+    FILE* in = fopen(argv[optind], "rb");
+    FILE* out = in ? fopen(argv[optind + 1], "wb") : NULL;
+    if (!in || !out)
+    {
+        std::cerr << "Error: Cannot open " << (in ? argv[optind + 1] : argv[optind]) << ": " << strerror(errno)
+                  << std::endl;
+        return 1;
+    }
+    std::vector<unsigned char> inBuf(BATCH), outBuf(BATCH);
+    unsigned long long block = 0, total = 0;
+    auto start = std::chrono::steady_clock::now();
+    size_t n;
+    while ((n = fread(inBuf.data(), 1, BATCH, in)) > 0)
+    {
+        // BATCH is a block multiple, so every batch but the last starts
+        // on a block boundary.
+        if (!ctrParallel(cipher, key, iv, block, inBuf.data(), outBuf.data(), n, threads)) handleErrors();
+        if (fwrite(outBuf.data(), 1, n, out) != n)
+        {
+            std::cerr << "Error: Write failed!" << std::endl;
+            return 1;
+        }
+        block += n / BLOCK;
+        total += n;
+    }
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    OPENSSL_cleanse(key, sizeof(key));
+    fclose(in);
+    if (fclose(out) != 0)
+    {
+        std::cerr << "Error: Write failed!" << std::endl;
+        return 1;
+    }
+    std::cout << "AES-" << bits << "-CTR: " << total << " bytes, " << threads << " threads, "
+              << (s > 0 ? total / s / 1e9 : 0) << " GB/s" << std::endl;
+    return 0;
+}
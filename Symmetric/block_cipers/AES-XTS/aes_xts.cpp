@@ -0,0 +1,527 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
+
+#include "aes_dispatch.h"
+#include "cipher_ctx_pool.h"
+
+// AES-XTS (IEEE 1619) for disk images.  An image is a sequence of
+// fixed-size data units (sectors).  Sector n is encrypted on its own with
+// tweak n, a 128-bit little-endian sector number (dm-crypt's "plain64"),
+// so any sector can be read or rewritten without touching its neighbours
+// and any set of sectors can be processed in parallel.  Ciphertext is the
+// same size as plaintext: there is no IV to store and no padding.
+//
+// An XTS key is two AES keys, one for the data and one for the tweak, so
+// AES-128-XTS takes 32 key bytes and AES-256-XTS takes 64.
+
+static const size_t BLOCK = 16;
+// Files are processed in batches of about this size with pread/pwrite.
+static const size_t BATCH = 64 << 20;
+// OpenSSL rejects XTS data units longer than 2^20 blocks; real sectors are
+// 512 or 4096 bytes.
+static const size_t MAX_SECTOR = 1 << 20;
+
+void handleErrors()
+{
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static const EVP_CIPHER* xtsCipher(int bits)
+{
+    if (bits == 128) return EVP_aes_128_xts();
+    if (bits == 256) return EVP_aes_256_xts();
+    return NULL;
+}
+
+static void tweakFor(unsigned long long sector, unsigned char* tweak)
+{
+    memset(tweak, 0, BLOCK);
+    for (int i = 0; i < 8; ++i) tweak[i] = (unsigned char)(sector >> (8 * i));
+}
+
+// Encrypts or decrypts count sectors in place, the first being sector
+// number first.  Each sector only re-arms the tweak on this thread's
+// already-keyed context (see cipher_ctx_pool.h), so there is no key
+// expansion or allocation per sector.
+static bool xtsSectors(const EVP_CIPHER* cipher, const unsigned char* key, bool encrypt, unsigned long long first,
+                       unsigned char* buf, size_t count, size_t sectorSize)
+{
+    unsigned char tweak[BLOCK];
+    for (size_t i = 0; i < count; ++i)
+    {
+        tweakFor(first + i, tweak);
+        EVP_CIPHER_CTX* ctx = CipherCtxPool::arm(cipher, key, tweak, encrypt);
+        int len;
+        unsigned char* sector = buf + i * sectorSize;
+        if (!ctx || EVP_CipherUpdate(ctx, sector, &len, sector, (int)sectorSize) != 1) return false;
+    }
+    return true;
+}
+
+// xtsSectors split across threads in contiguous runs of sectors.
+static bool xtsParallel(const EVP_CIPHER* cipher, const unsigned char* key, bool encrypt, unsigned long long first,
+                        unsigned char* buf, size_t count, size_t sectorSize, unsigned threads)
+{
+    if (threads > count) threads = count ? (unsigned)count : 1;
+    if (threads <= 1) return xtsSectors(cipher, key, encrypt, first, buf, count, sectorSize);
+    std::vector<std::thread> workers;
+    std::vector<char> ok(threads, 0);
+    size_t per = count / threads, extra = count % threads, start = 0;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        size_t n = per + (t < extra ? 1 : 0);
+        workers.push_back(std::thread([=, &ok] {
+            ok[t] = xtsSectors(cipher, key, encrypt, first + start, buf + start * sectorSize, n, sectorSize);
+        }));
+        start += n;
+    }
+    bool all = true;
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers[t].join();
+        all = all && ok[t];
+    }
+    return all;
+}
+
+static bool preadFull(int fd, unsigned char* buf, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return true;
+}
+
+static bool pwriteFull(int fd, const unsigned char* buf, size_t len, off_t off)
+{
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, buf, len, off);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        buf += n;
+        len -= (size_t)n;
+        off += n;
+    }
+    return true;
+}
+
+// Sectors [first, first + count) of inFd, encrypted or decrypted into the
+// same sectors of outFd (which may be inFd), one batch at a time.
+static bool processSectors(const EVP_CIPHER* cipher, const unsigned char* key, bool encrypt, int inFd, int outFd,
+                           unsigned long long first, unsigned long long count, size_t sectorSize, unsigned threads)
+{
+    size_t perBatch = std::max<size_t>(BATCH / sectorSize, 1);
+    std::vector<unsigned char> buf(perBatch * sectorSize);
+    bool ok = true;
+    for (unsigned long long done = 0; ok && done < count;)
+    {
+        size_t n = (size_t)std::min<unsigned long long>(perBatch, count - done);
+        off_t off = (off_t)((first + done) * sectorSize);
+        ok = preadFull(inFd, buf.data(), n * sectorSize, off) &&
+             xtsParallel(cipher, key, encrypt, first + done, buf.data(), n, sectorSize, threads) &&
+             pwriteFull(outFd, buf.data(), n * sectorSize, off);
+        done += n;
+    }
+    OPENSSL_cleanse(buf.data(), buf.size());
+    return ok;
+}
+
+static double seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+// Random single-sector rewrites from threads workers sharing one fd: each
+// op encrypts plain's copy of a random sector and pwrites it in place.
+// Returns operations per second, or 0 on failure.
+static double randomWrites(const EVP_CIPHER* cipher, const unsigned char* key, int fd, const unsigned char* plain,
+                           size_t sectors, size_t sectorSize, unsigned threads, size_t ops)
+{
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned t = 0; t < threads; ++t)
+    {
+        workers.push_back(std::thread([=, &failed] {
+            std::vector<unsigned char> sector(sectorSize);
+            unsigned long long x = 0x9e3779b97f4a7c15ULL * (t + 1); // xorshift64 state
+            for (size_t i = t; i < ops && !failed; i += threads)
+            {
+                x ^= x << 13;
+                x ^= x >> 7;
+                x ^= x << 17;
+                size_t s = (size_t)(x % sectors);
+                memcpy(sector.data(), plain + s * sectorSize, sectorSize);
+                if (!xtsSectors(cipher, key, true, s, sector.data(), 1, sectorSize) ||
+                    !pwriteFull(fd, sector.data(), sectorSize, (off_t)(s * sectorSize)))
+                    failed = true;
+            }
+        }));
+    }
+    for (unsigned t = 0; t < threads; ++t) workers[t].join();
+    double s = seconds(start);
+    return failed ? 0 : ops / s;
+}
+
+static int bench(const EVP_CIPHER* cipher, int bits, size_t sectorSize, unsigned maxThreads, size_t mib, size_t ops)
+{
+    unsigned char key[64];
+    if (!RAND_bytes(key, sizeof(key))) handleErrors();
+    size_t len = mib << 20;
+    size_t sectors = len / sectorSize;
+    len = sectors * sectorSize;
+    std::vector<unsigned char> plain(len), reference(len), buf(len);
+    if (!RAND_bytes(plain.data(), (int)std::min(len, (size_t)1 << 20))) handleErrors();
+    reference = plain;
+    if (!xtsSectors(cipher, key, true, 0, reference.data(), sectors, sectorSize)) handleErrors();
+
+    std::cout << "AES-" << bits << "-XTS, " << mib << " MiB, " << sectorSize << "-byte sectors" << std::endl;
+    std::cout << "sequential, in memory:" << std::endl;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        double best = 0;
+        for (int rep = 0; rep < 3; ++rep)
+        {
+            buf = plain;
+            auto start = std::chrono::steady_clock::now();
+            if (!xtsParallel(cipher, key, true, 0, buf.data(), sectors, sectorSize, threads)) handleErrors();
+            double s = seconds(start);
+            if (best == 0 || s < best) best = s;
+        }
+        bool same = buf == reference;
+        printf("  %2u thread%s %8.2f GB/s  %s\n", threads, threads == 1 ? " " : "s", len / best / 1e9,
+               same ? "matches single-threaded" : "MISMATCH");
+        if (!same) return 1;
+        if (threads == maxThreads) break;
+    }
+
+    const char* dir = getenv("TMPDIR");
+    std::string pattern = std::string(dir ? dir : "/tmp") + "/aes_xts.XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0)
+    {
+        std::cerr << "Error: Cannot create temporary image: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    unlink(name.data());
+    if (!pwriteFull(fd, plain.data(), len, 0)) handleErrors();
+
+    // The image in place, as a disk would be converted: pread, encrypt,
+    // pwrite in BATCH-sized runs.
+    auto start = std::chrono::steady_clock::now();
+    if (!processSectors(cipher, key, true, fd, fd, 0, sectors, sectorSize, maxThreads)) handleErrors();
+    double s = seconds(start);
+    if (!preadFull(fd, buf.data(), len, 0)) handleErrors();
+    bool same = buf == reference;
+    printf("sequential, image in place (pread/pwrite, %u thread%s): %.2f GB/s  %s\n", maxThreads,
+           maxThreads == 1 ? "" : "s", len / s / 1e9, same ? "matches in-memory" : "MISMATCH");
+    if (!same) return 1;
+
+    // Each random write re-encrypts a sector's original plaintext, so the
+    // image must still equal the reference afterwards: a write under the
+    // wrong tweak, or one that spilled into a neighbour, shows up here.
+    std::cout << "random " << sectorSize << "-byte sector writes (page cache, no fsync):" << std::endl;
+    for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads))
+    {
+        double iops = randomWrites(cipher, key, fd, plain.data(), sectors, sectorSize, threads, ops);
+        if (iops == 0) handleErrors();
+        printf("  %2u thread%s %10.0f IOPS\n", threads, threads == 1 ? " " : "s", iops);
+        if (threads == maxThreads) break;
+    }
+    if (!preadFull(fd, buf.data(), len, 0)) handleErrors();
+    same = buf == reference;
+    std::cout << "image after random writes: " << (same ? "unchanged, neighbours intact" : "MISMATCH") << std::endl;
+    close(fd);
+    OPENSSL_cleanse(key, sizeof(key));
+    return same ? 0 : 1;
+}
+
+static bool readFile(const char* path, unsigned char* buf, size_t len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fread(buf, 1, len, f) == len;
+    fclose(f);
+    return ok;
+}
+
+// Size of an image file or block device in bytes.  st_size is 0 for a
+// block device, so its size comes from the device itself.  Returns NULL,
+// or why fd cannot be used.
+static const char* imageBytes(int fd, unsigned long long* bytes)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0) return strerror(errno);
+    if (S_ISREG(st.st_mode))
+    {
+        *bytes = (unsigned long long)st.st_size;
+        return NULL;
+    }
+    if (!S_ISBLK(st.st_mode)) return "not a regular file or block device";
+#ifdef BLKGETSIZE64
+    uint64_t size;
+    if (ioctl(fd, BLKGETSIZE64, &size) != 0) return strerror(errno);
+    *bytes = size;
+#else
+    off_t end = lseek(fd, 0, SEEK_END);
+    if (end < 0) return strerror(errno);
+    *bytes = (unsigned long long)end;
+#endif
+    return NULL;
+}
+
+// Number of whole sectors in fd; returns NULL, or why fd cannot be used.
+static const char* sectorCount(int fd, size_t sectorSize, unsigned long long* count)
+{
+    unsigned long long bytes = 0;
+    const char* error = imageBytes(fd, &bytes);
+    if (error) return error;
+    if (bytes % sectorSize != 0) return "size is not a multiple of the sector size";
+    *count = bytes / sectorSize;
+    return NULL;
+}
+
+static void usage(const char* prog)
+{
+    std::cerr << "Usage: " << prog << " [-b 128|256] [-s sector] [-j threads] encrypt|decrypt <in> <out>\n"
+              << "       " << prog << " [-b 128|256] [-s sector] read <image> <sector> <count> <out>\n"
+              << "       " << prog << " [-b 128|256] [-s sector] write <image> <sector> <in>\n"
+              << "       " << prog << " [-b 128|256] [-s sector] [-j max_threads] [-m mib] [-n ops] bench\n"
+              << "       " << prog << " --cpu-report\n";
+}
+
+int main(int argc, char* argv[])
+{
+    if (AesDispatch::wantsReport(argc, argv)) return AesDispatch::cpuReport();
+    int bits = 128;
+    size_t sectorSize = 4096;
+    unsigned threads = std::thread::hardware_concurrency();
+    if (threads == 0) threads = 1;
+    size_t mib = 256, ops = 200000;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:s:j:m:n:")) != -1)
+    {
+        if (opt == 'b')
+            bits = atoi(optarg);
+        else if (opt == 's')
+            sectorSize = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'j')
+            threads = (unsigned)atoi(optarg);
+        else if (opt == 'm')
+            mib = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'n')
+            ops = (size_t)strtoul(optarg, NULL, 10);
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* cipher = xtsCipher(bits);
+    std::string mode = optind < argc ? argv[optind] : "";
+    int args = argc - optind - 1;
+    bool valid = (mode == "bench" && args == 0) || ((mode == "encrypt" || mode == "decrypt") && args == 2) ||
+                 (mode == "read" && args == 4) || (mode == "write" && args == 3);
+    // Sectors are whole blocks: XTS could steal ciphertext for a partial
+    // final block, but no disk has such sectors.
+    if (!cipher || threads == 0 || sectorSize < BLOCK || sectorSize > MAX_SECTOR || sectorSize % BLOCK != 0 ||
+        (mode == "bench" && (mib == 0 || (mib << 20) < sectorSize || ops == 0)) || !valid)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (mode == "bench") return bench(cipher, bits, sectorSize, threads, mib, ops);
+
+    // aes_xts_key.bin holds both XTS keys: 2 * bits / 8 bytes (see
+    // aes_xts_create_key).
+    unsigned char key[64];
+    size_t keyLen = (size_t)EVP_CIPHER_get_key_length(cipher);
+    if (!readFile("aes_xts_key.bin", key, keyLen))
+    {
+        std::cerr << "Error: aes_xts_key.bin must hold a " << keyLen * 8 << "-bit XTS key (./aes_xts_create_key "
+                  << bits << ")" << std::endl;
+        return 1;
+    }
+
+    int rc = 0;
+    if (mode == "encrypt" || mode == "decrypt")
+    {
+        // An output that resolves to the input (same path, ./path, a hard
+        // link or a symlink) converts the image in place.  The test is on
+        // st_dev/st_ino, never on the names, so the image is never
+        // truncated or removed.
+        const char* inPath = argv[optind + 1];
+        const char* outPath = argv[optind + 2];
+        struct stat inSt, outSt;
+        int inFd = open(inPath, O_RDONLY);
+        bool inPlace = inFd >= 0 && fstat(inFd, &inSt) == 0 && stat(outPath, &outSt) == 0 &&
+                       inSt.st_dev == outSt.st_dev && inSt.st_ino == outSt.st_ino;
+        if (inPlace)
+        {
+            close(inFd);
+            inFd = open(inPath, O_RDWR);
+        }
+        unsigned long long count = 0;
+        const char* error = inFd < 0 ? strerror(errno) : sectorCount(inFd, sectorSize, &count);
+        if (error)
+        {
+            std::cerr << "Error: " << inPath << ": " << error << std::endl;
+            return 1;
+        }
+        // A separate output is opened without O_TRUNC and checked again
+        // before truncating, in case it was linked to the input meanwhile.
+        int outFd = inPlace ? inFd : open(outPath, O_WRONLY | O_CREAT, 0600);
+        if (outFd < 0)
+        {
+            std::cerr << "Error: Cannot open " << outPath << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        if (!inPlace && fstat(outFd, &outSt) != 0)
+        {
+            std::cerr << "Error: Cannot stat " << outPath << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        if (!inPlace && inSt.st_dev == outSt.st_dev && inSt.st_ino == outSt.st_ino)
+        {
+            std::cerr << "Error: " << outPath << " changed to the input file while opening it" << std::endl;
+            return 1;
+        }
+        // A block device output is written in place and must be large
+        // enough; only a regular file is truncated (or removed on failure).
+        bool outRegular = inPlace || S_ISREG(outSt.st_mode);
+        unsigned long long outBytes = 0;
+        if (!outRegular && ((error = imageBytes(outFd, &outBytes)) != NULL || outBytes / sectorSize < count))
+        {
+            std::cerr << "Error: " << outPath << ": " << (error ? error : "smaller than the input") << std::endl;
+            return 1;
+        }
+        if (!inPlace && outRegular && ftruncate(outFd, 0) != 0)
+        {
+            std::cerr << "Error: Cannot truncate " << outPath << ": " << strerror(errno) << std::endl;
+            return 1;
+        }
+        auto start = std::chrono::steady_clock::now();
+        bool ok = processSectors(cipher, key, mode == "encrypt", inFd, outFd, 0, count, sectorSize, threads);
+        ok = fsync(outFd) == 0 && ok;
+        double s = seconds(start);
+        if (!inPlace) close(inFd);
+        if (close(outFd) != 0) ok = false;
+        if (!ok)
+        {
+            std::cerr << "Error: " << (mode == "encrypt" ? "Encryption" : "Decryption") << " failed!" << std::endl;
+            if (!inPlace && outRegular) remove(outPath);
+            rc = 1;
+        }
+        else
+        {
+            std::cout << "AES-" << bits << "-XTS " << mode << ": " << count << " sectors of " << sectorSize
+                      << " bytes, " << threads << " threads, " << (s > 0 ? count * sectorSize / s / 1e9 : 0)
+                      << " GB/s" << std::endl;
+        }
+    }
+    else
+    {
+        // Random access: only the named sectors are read or rewritten.
+        bool isWrite = mode == "write";
+        const char* image = argv[optind + 1];
+        unsigned long long first = strtoull(argv[optind + 2], NULL, 10);
+        const char* data = argv[optind + (isWrite ? 3 : 4)];
+        int fd = open(image, isWrite ? O_RDWR : O_RDONLY);
+        unsigned long long total = 0;
+        const char* error = fd < 0 ? strerror(errno) : sectorCount(fd, sectorSize, &total);
+        if (error)
+        {
+            std::cerr << "Error: " << image << ": " << error << std::endl;
+            return 1;
+        }
+        std::vector<unsigned char> buf;
+        unsigned long long count = 0;
+        if (isWrite)
+        {
+            FILE* f = fopen(data, "rb");
+            if (f)
+            {
+                unsigned char chunk[65536];
+                size_t n;
+                while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0) buf.insert(buf.end(), chunk, chunk + n);
+                fclose(f);
+            }
+            if (!f || buf.empty() || buf.size() % sectorSize != 0)
+            {
+                std::cerr << "Error: " << data << " must hold a whole number of " << sectorSize << "-byte sectors"
+                          << std::endl;
+                return 1;
+            }
+            count = buf.size() / sectorSize;
+        }
+        else
+        {
+            count = strtoull(argv[optind + 3], NULL, 10);
+        }
+        if (count == 0 || first >= total || count > total - first)
+        {
+            std::cerr << "Error: sectors " << first << ".." << first + count << " are outside the image (" << total
+                      << " sectors)" << std::endl;
+            return 1;
+        }
+        bool ok;
+        if (isWrite)
+        {
+            ok = xtsParallel(cipher, key, true, first, buf.data(), count, sectorSize, threads) &&
+                 pwriteFull(fd, buf.data(), buf.size(), (off_t)(first * sectorSize)) && fsync(fd) == 0;
+        }
+        else
+        {
+            buf.resize(count * sectorSize);
+            FILE* out = NULL;
+            ok = preadFull(fd, buf.data(), buf.size(), (off_t)(first * sectorSize)) &&
+                 xtsParallel(cipher, key, false, first, buf.data(), count, sectorSize, threads) &&
+                 (out = fopen(data, "wb")) != NULL && fwrite(buf.data(), 1, buf.size(), out) == buf.size();
+            if (out && fclose(out) != 0) ok = false;
+        }
+        OPENSSL_cleanse(buf.data(), buf.size());
+        if (close(fd) != 0) ok = false;
+        if (!ok)
+        {
+            std::cerr << "Error: " << (isWrite ? "Write" : "Read") << " of sectors " << first << ".." << first + count
+                      << " failed!" << std::endl;
+            rc = 1;
+        }
+        else
+        {
+            std::cout << (isWrite ? "Wrote " : "Read ") << count << " sector" << (count == 1 ? "" : "s") << " at "
+                      << first << std::endl;
+        }
+    }
+    OPENSSL_cleanse(key, sizeof(key));
+    return rc;
+}
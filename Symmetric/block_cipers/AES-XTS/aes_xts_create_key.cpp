@@ -0,0 +1,40 @@
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+
+int main(int argc, char* argv[])
+{
+    // AES-128-XTS (default) or AES-256-XTS.  The XTS key is two AES keys
+    // back to back (data key, then tweak key), so it is twice as long.
+    int bits = argc > 1 ? atoi(argv[1]) : 128;
+    if (bits != 128 && bits != 256)
+    {
+        std::cerr << "Usage: " << argv[0] << " [128|256]" << std::endl;
+        return 1;
+    }
+    size_t half = (size_t)bits / 8;
+    unsigned char key[64];
+    // IEEE 1619 requires the two halves to differ; with random keys a
+    // collision is astronomically unlikely, but check anyway.
+    do
+    {
+        if (!RAND_bytes(key, (int)(2 * half)))
+        {
+            std::cerr << "Error generating AES-XTS key!" << std::endl;
+            return 1;
+        }
+    } while (CRYPTO_memcmp(key, key + half, half) == 0);
+    FILE* kf = fopen("aes_xts_key.bin", "wb");
+    if (!kf)
+    {
+        std::cerr << "Cannot open aes_xts_key.bin for writing!" << std::endl;
+        return 1;
+    }
+    fwrite(key, 1, 2 * half, kf);
+    fclose(kf);
+    OPENSSL_cleanse(key, sizeof(key));
+    std::cout << "AES-" << bits << "-XTS key (" << 2 * bits << " bits) saved to aes_xts_key.bin" << std::endl;
+    return 0;
+}
@@ -4,6 +4,9 @@
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -48,9 +51,7 @@ int main()
     // Data to encrypt
     const char* plaintext = "This is Blowfish encryption example!";
     int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
-    unsigned char decrypted[128];
-    int len = 0, ciphertext_len = 0, decrypted_len = 0;
+    size_t ciphertext_len = 0, decrypted_len = 0;
 
     std::cout << "=== Blowfish Encryption/Decryption Example ===" << std::endl;
     std::cout << "Original text: " << plaintext << std::endl;
@@ -61,12 +62,8 @@ int main()
     if (!ctx) handleErrors();
 
     if (1 != EVP_EncryptInit_ex(ctx, EVP_bf_cbc(), NULL, key, iv)) handleErrors();
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, 
-                              reinterpret_cast<const unsigned char*>(plaintext), 
-                              plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     EVP_CIPHER_CTX_free(ctx);
 
@@ -80,7 +77,7 @@ int main()
         std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)iv[i];
     
     std::cout << "\nCiphertext (hex): ";
-    for (int i = 0; i < ciphertext_len; ++i)
+    for (size_t i = 0; i < ciphertext_len; ++i)
         std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)ciphertext[i];
     
     std::cout << std::dec << "\nCiphertext length: " << ciphertext_len << " bytes" << std::endl;
@@ -90,18 +87,16 @@ int main()
     if (!ctx) handleErrors();
 
     if (1 != EVP_DecryptInit_ex(ctx, EVP_bf_cbc(), NULL, key, iv)) handleErrors();
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    decrypted_len = len;
-    if (1 != EVP_DecryptFinal_ex(ctx, decrypted + len, &len)) handleErrors();
-    decrypted_len += len;
+    std::vector<unsigned char> decrypted(CipherSpan::outputSize(ctx, ciphertext_len));
+    if (!CipherSpan::run(ctx, ConstByteSpan(ciphertext.data(), ciphertext_len), decrypted, &decrypted_len)) handleErrors();
+    std::string decrypted_text(reinterpret_cast<const char*>(decrypted.data()), decrypted_len);
 
-    // Null-terminate and print decrypted text
-    decrypted[decrypted_len] = '\0';
-    std::cout << "\nDecrypted text: " << decrypted << std::endl;
+    // Print decrypted text
+    std::cout << "\nDecrypted text: " << decrypted_text << std::endl;
     std::cout << "Decrypted length: " << decrypted_len << " bytes" << std::endl;
 
     // Verify decryption
-    if (strcmp(plaintext, reinterpret_cast<const char*>(decrypted)) == 0)
+    if (decrypted_text == plaintext)
         std::cout << "\n✓ Encryption/Decryption successful!" << std::endl;
     else
         std::cout << "\n✗ Encryption/Decryption failed!" << std::endl;
@@ -3,6 +3,9 @@
 #include <cstring>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -91,9 +94,7 @@ int main()
     for (int test = 0; test < 4; ++test) {
         const char* plaintext = texts[test];
         int plaintext_len = strlen(plaintext);
-        unsigned char ciphertext[1024];
-        unsigned char decrypted[1024];
-        int len = 0, ciphertext_len = 0, decrypted_len = 0;
+        size_t ciphertext_len = 0, decrypted_len = 0;
 
         std::cout << "\n" << std::string(80, '=') << std::endl;
         std::cout << "TEST " << (test + 1) << ": " << plaintext_len << "-byte text" << std::endl;
@@ -107,17 +108,13 @@ int main()
         if (!ctx) handleErrors();
 
         if (1 != EVP_EncryptInit_ex(ctx, EVP_camellia_128_cbc(), NULL, key, iv)) handleErrors();
-        if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, 
-                                  reinterpret_cast<const unsigned char*>(plaintext), 
-                                  plaintext_len)) handleErrors();
-        ciphertext_len = len;
-        if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-        ciphertext_len += len;
+        std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+        if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
         EVP_CIPHER_CTX_free(ctx);
 
         std::cout << "\nEncryption Results:" << std::endl;
-        printHex(ciphertext, ciphertext_len, "Ciphertext (hex)");
+        printHex(ciphertext.data(), (int)ciphertext_len, "Ciphertext (hex)");
         std::cout << "Ciphertext length: " << ciphertext_len << " bytes (" << (ciphertext_len * 8) << " bits)" << std::endl;
 
         // Decrypt
@@ -125,17 +122,15 @@ int main()
         if (!ctx) handleErrors();
 
         if (1 != EVP_DecryptInit_ex(ctx, EVP_camellia_128_cbc(), NULL, key, iv)) handleErrors();
-        if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-        decrypted_len = len;
-        if (1 != EVP_DecryptFinal_ex(ctx, decrypted + len, &len)) handleErrors();
-        decrypted_len += len;
+        std::vector<unsigned char> decrypted(CipherSpan::outputSize(ctx, ciphertext_len));
+        if (!CipherSpan::run(ctx, ConstByteSpan(ciphertext.data(), ciphertext_len), decrypted, &decrypted_len)) handleErrors();
+        std::string decrypted_text(reinterpret_cast<const char*>(decrypted.data()), decrypted_len);
 
-        // Null-terminate and verify
-        decrypted[decrypted_len] = '\0';
-        std::cout << "Decrypted text: \"" << decrypted << "\"" << std::endl;
+        // Verify
+        std::cout << "Decrypted text: \"" << decrypted_text << "\"" << std::endl;
         std::cout << "Decrypted length: " << decrypted_len << " bytes" << std::endl;
         
-        if (strcmp(plaintext, reinterpret_cast<const char*>(decrypted)) == 0)
+        if (decrypted_text == plaintext)
             std::cout << "✓ Encryption/Decryption successful!" << std::endl;
         else
             std::cout << "✗ Encryption/Decryption failed!" << std::endl;
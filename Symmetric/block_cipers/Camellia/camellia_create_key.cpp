@@ -1,13 +1,23 @@
 #include <openssl/rand.h>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
 
-int main()
+int main(int argc, char* argv[])
 {
-    unsigned char key[16]; // 128-bit key for Camellia-128
+    // Optional key size in bits (128, 192 or 256) for camellia_pipeline;
+    // the examples use the default 128-bit key.
+    int bits = argc > 1 ? atoi(argv[1]) : 128;
+    if (bits != 128 && bits != 192 && bits != 256)
+    {
+        std::cerr << "Usage: " << argv[0] << " [128|192|256]" << std::endl;
+        return 1;
+    }
+    size_t keyLen = (size_t)bits / 8;
+    unsigned char key[32]; // up to 256-bit key
     unsigned char iv[16];  // 128-bit IV for Camellia CBC mode
     
-    if (!RAND_bytes(key, sizeof(key)))
+    if (!RAND_bytes(key, (int)keyLen))
     {
         std::cerr << "Error generating Camellia key!" << std::endl;
         return 1;
@@ -26,7 +36,7 @@ int main()
         std::cerr << "Cannot open camellia_key.bin for writing!" << std::endl;
         return 1;
     }
-    fwrite(key, 1, sizeof(key), kf);
+    fwrite(key, 1, keyLen, kf);
     fclose(kf);
     
     // Save IV to file
@@ -40,7 +50,7 @@ int main()
     fclose(ivf);
     
     std::cout << "Camellia key and IV generated successfully!" << std::endl;
-    std::cout << "Key saved to: camellia_key.bin (128 bits)" << std::endl;
+    std::cout << "Key saved to: camellia_key.bin (" << bits << " bits)" << std::endl;
     std::cout << "IV saved to: camellia_iv.bin (128 bits)" << std::endl;
     
     return 0;
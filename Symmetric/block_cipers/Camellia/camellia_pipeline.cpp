@@ -0,0 +1,409 @@
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+// Three-stage file pipeline for Camellia-CBC: a reader thread fills chunks
+// from the input file, a cipher thread runs them through one CBC context
+// (CBC is serial, so one cipher thread is all the mode allows), and a
+// writer thread drains them to the output file.  The stages hand chunks
+// to each other through single-producer/single-consumer lock-free rings.
+// A fixed pool of chunks circulates free -> cipher -> writer -> free, so a
+// slow stage stalls the ones upstream of it instead of growing memory.
+
+static const size_t BLOCK = 16;
+static const size_t ALIGN = 4096;
+
+void handleErrors()
+{
+    std::cerr << "Error occurred!" << std::endl;
+    exit(1);
+}
+
+static const EVP_CIPHER* cbcCipher(int bits)
+{
+    if (bits == 128) return EVP_camellia_128_cbc();
+    if (bits == 192) return EVP_camellia_192_cbc();
+    if (bits == 256) return EVP_camellia_256_cbc();
+    return NULL;
+}
+
+// Lock-free ring for exactly one producer thread and one consumer thread.
+// head_ and tail_ sit on separate cache lines so the two sides do not
+// bounce one line between cores on every operation.
+template <typename T>
+class SpscRing
+{
+public:
+    explicit SpscRing(size_t capacity) : slots_(capacity + 1), head_(0), tail_(0) {}
+
+    bool push(T value)
+    {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == slots_.size() ? 0 : tail + 1;
+        if (next == head_.load(std::memory_order_acquire)) return false; // full
+        slots_[tail] = value;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T* value)
+    {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false; // empty
+        *value = slots_[head];
+        head_.store(head + 1 == slots_.size() ? 0 : head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots_;
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+struct Chunk
+{
+    unsigned char* in;  // chunkSize bytes read from the input
+    unsigned char* out; // chunkSize + BLOCK: CBC output lags or leads by a block
+    size_t len;
+    size_t outLen;
+    bool last;
+};
+
+struct Options
+{
+    int bits = 128;
+    size_t chunk = 1 << 20;
+    size_t depth = 8;
+    size_t mib = 256;
+};
+
+struct Stats
+{
+    unsigned long long bytes = 0;
+    double seconds = 0;
+    double cipherBusy = 0;          // time the cipher thread spent inside EVP
+    unsigned long long readerWaits = 0; // no free chunk: downstream is the bottleneck
+    unsigned long long cipherWaits = 0; // nothing to encrypt: the reader is behind
+};
+
+// Waits for ring.pop/push to succeed, counting how often it had to wait.
+// Yields rather than sleeping: chunks are large, so waits are short.
+template <typename F>
+static bool waitFor(F attempt, const std::atomic<bool>& failed, unsigned long long* waits)
+{
+    if (attempt()) return true;
+    if (waits) ++*waits;
+    while (!failed.load(std::memory_order_relaxed))
+    {
+        if (attempt()) return true;
+        std::this_thread::yield();
+    }
+    return false;
+}
+
+static bool runPipeline(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv, bool encrypt,
+                        const Options& o, FILE* in, FILE* out, Stats* st)
+{
+    std::vector<Chunk> pool(o.depth);
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        void* a = NULL;
+        void* b = NULL;
+        if (posix_memalign(&a, ALIGN, o.chunk) != 0 || posix_memalign(&b, ALIGN, o.chunk + BLOCK) != 0) handleErrors();
+        pool[i].in = (unsigned char*)a;
+        pool[i].out = (unsigned char*)b;
+    }
+    SpscRing<Chunk*> freeRing(o.depth), cipherRing(o.depth), writeRing(o.depth);
+    for (size_t i = 0; i < pool.size(); ++i) freeRing.push(&pool[i]);
+    std::atomic<bool> failed(false);
+    bool readOk = true, cipherOk = true, writeOk = true;
+
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, encrypt ? 1 : 0) != 1) handleErrors();
+
+    auto start = std::chrono::steady_clock::now();
+    std::thread reader([&] {
+        for (;;)
+        {
+            Chunk* c;
+            if (!waitFor([&] { return freeRing.pop(&c); }, failed, &st->readerWaits)) return;
+            c->len = fread(c->in, 1, o.chunk, in);
+            c->last = c->len < o.chunk;
+            if (c->last && ferror(in))
+            {
+                readOk = false;
+                failed = true;
+                return;
+            }
+            // Chunks are never held back, so the ring always has room.
+            cipherRing.push(c);
+            if (c->last) return;
+        }
+    });
+    std::thread cipherStage([&] {
+        for (;;)
+        {
+            Chunk* c;
+            if (!waitFor([&] { return cipherRing.pop(&c); }, failed, &st->cipherWaits)) return;
+            auto t0 = std::chrono::steady_clock::now();
+            int n = 0, tail = 0;
+            bool ok = c->len == 0 || EVP_CipherUpdate(ctx, c->out, &n, c->in, (int)c->len) == 1;
+            if (ok && c->last) ok = EVP_CipherFinal_ex(ctx, c->out + n, &tail) == 1;
+            st->cipherBusy += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+            if (!ok)
+            {
+                cipherOk = false;
+                failed = true;
+                return;
+            }
+            c->outLen = (size_t)n + (size_t)tail;
+            writeRing.push(c);
+            if (c->last) return;
+        }
+    });
+    std::thread writer([&] {
+        for (;;)
+        {
+            Chunk* c;
+            if (!waitFor([&] { return writeRing.pop(&c); }, failed, NULL)) return;
+            if (fwrite(c->out, 1, c->outLen, out) != c->outLen)
+            {
+                writeOk = false;
+                failed = true;
+                return;
+            }
+            st->bytes += c->len;
+            bool last = c->last;
+            freeRing.push(c);
+            if (last) return;
+        }
+    });
+    reader.join();
+    cipherStage.join();
+    writer.join();
+    st->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    EVP_CIPHER_CTX_free(ctx);
+    for (size_t i = 0; i < pool.size(); ++i)
+    {
+        OPENSSL_cleanse(pool[i].in, o.chunk);
+        OPENSSL_cleanse(pool[i].out, o.chunk + BLOCK);
+        free(pool[i].in);
+        free(pool[i].out);
+    }
+    if (!readOk) std::cerr << "Error: Read failed!" << std::endl;
+    if (!cipherOk) std::cerr << "Error: " << (encrypt ? "Encryption" : "Decryption (wrong key or corrupt input)")
+                             << " failed!" << std::endl;
+    if (!writeOk) std::cerr << "Error: Write failed!" << std::endl;
+    return readOk && cipherOk && writeOk;
+}
+
+// The same chunking on one thread: read, then encrypt, then write.
+static bool runSerial(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv, bool encrypt,
+                      const Options& o, FILE* in, FILE* out, Stats* st)
+{
+    std::vector<unsigned char> inBuf(o.chunk), outBuf(o.chunk + BLOCK);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || EVP_CipherInit_ex(ctx, cipher, NULL, key, iv, encrypt ? 1 : 0) != 1) handleErrors();
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    for (bool last = false; ok && !last;)
+    {
+        size_t len = fread(inBuf.data(), 1, o.chunk, in);
+        last = len < o.chunk;
+        int n = 0, tail = 0;
+        auto t0 = std::chrono::steady_clock::now();
+        ok = !ferror(in) && (len == 0 || EVP_CipherUpdate(ctx, outBuf.data(), &n, inBuf.data(), (int)len) == 1) &&
+             (!last || EVP_CipherFinal_ex(ctx, outBuf.data() + n, &tail) == 1);
+        st->cipherBusy += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        size_t outLen = (size_t)n + (size_t)tail;
+        ok = ok && fwrite(outBuf.data(), 1, outLen, out) == outLen;
+        st->bytes += len;
+    }
+    st->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    EVP_CIPHER_CTX_free(ctx);
+    return ok;
+}
+
+static double mbps(unsigned long long bytes, double s)
+{
+    return s > 0 ? bytes / s / 1e6 : 0;
+}
+
+static void report(const char* label, const Stats& st)
+{
+    double ceiling = mbps(st.bytes, st.cipherBusy);
+    double got = mbps(st.bytes, st.seconds);
+    printf("%-9s %9.1f MB/s  cipher-only %9.1f MB/s  (%5.1f%% of ceiling)  stalls: reader %llu, cipher %llu\n",
+           label, got, ceiling, ceiling > 0 ? 100 * got / ceiling : 0, st.readerWaits, st.cipherWaits);
+}
+
+static FILE* tempFile(std::string* path)
+{
+    const char* dir = getenv("TMPDIR");
+    std::string pattern = std::string(dir ? dir : "/tmp") + "/camellia_pipeline.XXXXXX";
+    std::vector<char> name(pattern.begin(), pattern.end());
+    name.push_back('\0');
+    int fd = mkstemp(name.data());
+    if (fd < 0) return NULL;
+    *path = name.data();
+    return fdopen(fd, "w+b");
+}
+
+static int bench(const EVP_CIPHER* cipher, const Options& o)
+{
+    unsigned char key[32], iv[BLOCK];
+    if (!RAND_bytes(key, sizeof(key)) || !RAND_bytes(iv, sizeof(iv))) handleErrors();
+    std::string inPath, outPath;
+    FILE* in = tempFile(&inPath);
+    FILE* out = in ? tempFile(&outPath) : NULL;
+    if (!in || !out)
+    {
+        std::cerr << "Error: Cannot create temporary files: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    std::vector<unsigned char> buf(1 << 20);
+    if (!RAND_bytes(buf.data(), (int)buf.size())) handleErrors();
+    for (size_t i = 0; i < o.mib; ++i)
+        if (fwrite(buf.data(), 1, buf.size(), in) != buf.size()) handleErrors();
+    fflush(in);
+
+    // Pure compute: the same chunks encrypted from memory, no I/O at all.
+    std::vector<unsigned char> chunk(o.chunk), outChunk(o.chunk + BLOCK);
+    EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
+    if (!ctx || EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv) != 1) handleErrors();
+    unsigned long long total = (unsigned long long)o.mib << 20;
+    auto t0 = std::chrono::steady_clock::now();
+    for (unsigned long long done = 0; done < total; done += o.chunk)
+    {
+        int n;
+        int len = (int)std::min<unsigned long long>(o.chunk, total - done);
+        if (EVP_EncryptUpdate(ctx, outChunk.data(), &n, chunk.data(), len) != 1) handleErrors();
+    }
+    double compute = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    EVP_CIPHER_CTX_free(ctx);
+
+    printf("Camellia-%d-CBC, %zu MiB file, %zu KiB chunks, %zu in flight\n", EVP_CIPHER_get_key_length(cipher) * 8,
+           o.mib, o.chunk >> 10, o.depth);
+    printf("%-9s %9.1f MB/s  (in-memory ceiling)\n", "compute", mbps(total, compute));
+    int rc = 0;
+    for (int pass = 0; pass < 2 && rc == 0; ++pass)
+    {
+        Stats st;
+        rewind(in);
+        if (ftruncate(fileno(out), 0) != 0) handleErrors();
+        rewind(out);
+        bool ok = pass == 0 ? runSerial(cipher, key, iv, true, o, in, out, &st)
+                            : runPipeline(cipher, key, iv, true, o, in, out, &st);
+        fflush(out);
+        if (!ok) rc = 1;
+        report(pass == 0 ? "serial" : "pipeline", st);
+        if (pass == 1)
+            printf("pipeline reaches %.1f%% of the in-memory ceiling\n", 100 * mbps(st.bytes, st.seconds) /
+                                                                         mbps(total, compute));
+    }
+    fclose(in);
+    fclose(out);
+    remove(inPath.c_str());
+    remove(outPath.c_str());
+    OPENSSL_cleanse(key, sizeof(key));
+    return rc;
+}
+
+static bool readFile(const char* path, unsigned char* buf, size_t len)
+{
+    FILE* f = fopen(path, "rb");
+    if (!f) return false;
+    bool ok = fread(buf, 1, len, f) == len;
+    fclose(f);
+    return ok;
+}
+
+int main(int argc, char* argv[])
+{
+    Options o;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:c:d:m:")) != -1)
+    {
+        if (opt == 'b')
+            o.bits = atoi(optarg);
+        else if (opt == 'c')
+            o.chunk = (size_t)strtoul(optarg, NULL, 10) << 10;
+        else if (opt == 'd')
+            o.depth = (size_t)strtoul(optarg, NULL, 10);
+        else if (opt == 'm')
+            o.mib = (size_t)strtoul(optarg, NULL, 10);
+        else
+        {
+            optind = argc + 1;
+            break;
+        }
+    }
+    const EVP_CIPHER* cipher = cbcCipher(o.bits);
+    std::string mode = optind < argc ? argv[optind] : "";
+    bool isBench = mode == "bench" && optind == argc - 1;
+    bool isFile = (mode == "encrypt" || mode == "decrypt") && optind == argc - 3;
+    // EVP lengths are int; chunks are block multiples so only the final
+    // chunk can be partial.
+    if (!cipher || o.chunk == 0 || o.chunk > (1u << 30) || o.chunk % BLOCK != 0 || o.depth < 2 ||
+        (!isBench && !isFile))
+    {
+        std::cerr << "Usage: " << argv[0] << " [-b 128|192|256] [-c chunk_kib] [-d chunks] encrypt|decrypt <in> <out>\n"
+                  << "       " << argv[0] << " [-b 128|192|256] [-c chunk_kib] [-d chunks] [-m mib] bench\n";
+        return 1;
+    }
+    if (isBench) return bench(cipher, o);
+
+    // Same key material as camellia_example: camellia_key.bin (bits / 8
+    // bytes, see camellia_create_key) and the 16-byte camellia_iv.bin.
+    unsigned char key[32], iv[BLOCK];
+    if (!readFile("camellia_key.bin", key, (size_t)o.bits / 8))
+    {
+        std::cerr << "Error: camellia_key.bin must hold a " << o.bits << "-bit key (./camellia_create_key " << o.bits
+                  << ")" << std::endl;
+        return 1;
+    }
+    if (!readFile("camellia_iv.bin", iv, sizeof(iv)))
+    {
+        std::cerr << "Error: Cannot read camellia_iv.bin!" << std::endl;
+        return 1;
+    }
+    const char* inPath = argv[optind + 1];
+    const char* outPath = argv[optind + 2];
+    FILE* in = fopen(inPath, "rb");
+    FILE* out = in ? fopen(outPath, "wb") : NULL;
+    if (!in || !out)
+    {
+        std::cerr << "Error: Cannot open " << (in ? outPath : inPath) << ": " << strerror(errno) << std::endl;
+        return 1;
+    }
+    Stats st;
+    bool ok = runPipeline(cipher, key, iv, mode == "encrypt", o, in, out, &st);
+    OPENSSL_cleanse(key, sizeof(key));
+    fclose(in);
+    if (fclose(out) != 0 && ok)
+    {
+        std::cerr << "Error: Write failed!" << std::endl;
+        ok = false;
+    }
+    if (!ok)
+    {
+        remove(outPath); // never leave a truncated output file behind
+        return 1;
+    }
+    report(mode == "encrypt" ? "encrypt" : "decrypt", st);
+    return 0;
+}
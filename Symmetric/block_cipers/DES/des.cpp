@@ -3,6 +3,9 @@
 #include <openssl/provider.h>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -43,20 +46,16 @@ int main()
 
     // Data
     const char* plaintext = "This is DES";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
-    unsigned char decrypted[128];
-    int len = 0, ciphertext_len = 0, decrypted_len = 0;
+    size_t plaintext_len = strlen(plaintext);
 
-    // Encrypt
+    // Encrypt straight from the caller's plaintext into a buffer sized up front
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
 
     if (1 != EVP_EncryptInit_ex(ctx, EVP_des_cbc(), NULL, key, iv)) handleErrors();
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, reinterpret_cast<const unsigned char*>(plaintext), plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    size_t ciphertext_len = 0;
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     EVP_CIPHER_CTX_free(ctx);
 
@@ -68,24 +67,21 @@ int main()
     for (unsigned char b : iv)
         std::cout << std::hex << (int)b;
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i)
+    for (size_t i = 0; i < ciphertext_len; ++i)
         std::cout << std::hex << (int)ciphertext[i];
     std::cout << "\nCiphertext length: " << ciphertext_len << std::endl;
     std::cout << "Plaintext length: " << plaintext_len << std::endl;
 
-    // Decrypt
+    // Decrypt in place over the ciphertext
     ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
 
     if (1 != EVP_DecryptInit_ex(ctx, EVP_des_cbc(), NULL, key, iv)) handleErrors();
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    decrypted_len = len;
-    if (1 != EVP_DecryptFinal_ex(ctx, decrypted + len, &len)) handleErrors();
-    decrypted_len += len;
+    size_t decrypted_len = 0;
+    if (!CipherSpan::inPlace(ctx, ciphertext, ciphertext_len, &decrypted_len)) handleErrors();
 
-    // Null-terminate and print decrypted text
-    decrypted[decrypted_len] = '\0';
-    std::cout << "Decrypted text: " << decrypted << std::endl;
+    std::cout << "Decrypted text: " << std::string(reinterpret_cast<const char*>(ciphertext.data()), decrypted_len)
+              << std::endl;
 
     EVP_CIPHER_CTX_free(ctx);
     OSSL_PROVIDER_unload(legacy);
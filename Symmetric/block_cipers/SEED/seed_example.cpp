@@ -7,6 +7,9 @@
 #include <iomanip>
 #include <algorithm>
 #include <cctype>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -122,9 +125,7 @@ int main()
                            "SEED was designed to replace DES in Korean applications, emphasizing security and efficiency. "
                            "It became ISO/IEC 18033-3 in 2005, demonstrating Korean cryptographic expertise!";
     int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[1024];  // Buffer for multi-block text
-    unsigned char decrypted[1024];   // Buffer for multi-block text
-    int len = 0, ciphertext_len = 0, decrypted_len = 0;
+    size_t ciphertext_len = 0, decrypted_len = 0;
 
     std::cout << "=== SEED-CBC Multi-Block Encryption Example ===" << std::endl;
     std::cout << "Original text: " << plaintext << std::endl;
@@ -156,12 +157,8 @@ int main()
     if (!ctx) handleErrors();
 
     if (1 != EVP_EncryptInit_ex(ctx, cipher, NULL, key, iv)) handleErrors();
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, 
-                              reinterpret_cast<const unsigned char*>(plaintext), 
-                              plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     EVP_CIPHER_CTX_free(ctx);
 
@@ -175,7 +172,7 @@ int main()
         std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)iv[i];
     
     std::cout << "\nCiphertext (hex): ";
-    for (int i = 0; i < ciphertext_len; ++i) {
+    for (size_t i = 0; i < ciphertext_len; ++i) {
         std::cout << std::hex << std::setfill('0') << std::setw(2) << (int)ciphertext[i];
         if ((i + 1) % 32 == 0) std::cout << "\n                  ";  // Line break every 32 bytes
     }
@@ -187,18 +184,16 @@ int main()
     if (!decrypt_ctx) handleErrors();
 
     if (1 != EVP_DecryptInit_ex(decrypt_ctx, cipher, NULL, key, iv)) handleErrors();
-    if (1 != EVP_DecryptUpdate(decrypt_ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    decrypted_len = len;
-    if (1 != EVP_DecryptFinal_ex(decrypt_ctx, decrypted + len, &len)) handleErrors();
-    decrypted_len += len;
+    std::vector<unsigned char> decrypted(CipherSpan::outputSize(decrypt_ctx, ciphertext_len));
+    if (!CipherSpan::run(decrypt_ctx, ConstByteSpan(ciphertext.data(), ciphertext_len), decrypted, &decrypted_len)) handleErrors();
+    std::string decrypted_text(reinterpret_cast<const char*>(decrypted.data()), decrypted_len);
 
-    // Null-terminate and print decrypted text
-    decrypted[decrypted_len] = '\0';
-    std::cout << "\nDecrypted text: " << decrypted << std::endl;
+    // Print decrypted text
+    std::cout << "\nDecrypted text: " << decrypted_text << std::endl;
     std::cout << "Decrypted length: " << decrypted_len << " bytes" << std::endl;
 
     // Verify decryption
-    if (strcmp(plaintext, reinterpret_cast<const char*>(decrypted)) == 0)
+    if (decrypted_text == plaintext)
         std::cout << "\n✓ Encryption/Decryption successful!" << std::endl;
     else
         std::cout << "\n✗ Encryption/Decryption failed!" << std::endl;
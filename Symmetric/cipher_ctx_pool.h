@@ -0,0 +1,102 @@
+// Per-thread pool of key-initialised cipher contexts.
+//
+// EVP_EncryptInit_ex with a key allocates nothing new on a reused context
+// but still runs the full key expansion; a fresh EVP_CIPHER_CTX_new per
+// message adds an allocation and a free on top.  CipherCtxPool keeps, per
+// thread, one context per (cipher, direction, key) already keyed, and each
+// message only re-arms the IV with EVP_CipherInit_ex(ctx, NULL, NULL, NULL,
+// iv, -1).  After the first message under a key the hot path allocates
+// nothing and expands no key.
+//
+// Contexts belong to the calling thread and stay valid until that thread
+// arms more than CAPACITY other keys; finish a message before arming the
+// next under a different key from the same thread.
+#ifndef CIPHER_CTX_POOL_H
+#define CIPHER_CTX_POOL_H
+
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <cstddef>
+#include <cstring>
+
+class CipherCtxPool
+{
+public:
+    static const size_t CAPACITY = 16;
+    static const size_t MAX_KEY = 64;
+
+    // Context for cipher/key/direction with its IV set, ready for
+    // Update/Final.  Returns NULL on failure.
+    static EVP_CIPHER_CTX* arm(const EVP_CIPHER* cipher, const unsigned char* key, const unsigned char* iv, bool encrypt)
+    {
+        Slots& slots = local();
+        size_t keyLen = (size_t)EVP_CIPHER_get_key_length(cipher);
+        if (keyLen > MAX_KEY) return NULL;
+        ++slots.clock;
+        Slot* victim = &slots.slot[0];
+        for (size_t i = 0; i < CAPACITY; ++i)
+        {
+            Slot& s = slots.slot[i];
+            if (s.ctx && s.cipher == cipher && s.encrypt == encrypt && CRYPTO_memcmp(s.key, key, keyLen) == 0)
+            {
+                s.used = slots.clock;
+                ++slots.hits;
+                return EVP_CipherInit_ex(s.ctx, NULL, NULL, NULL, iv, -1) == 1 ? s.ctx : NULL;
+            }
+            if (!s.ctx || s.used < victim->used) victim = &s;
+        }
+        // Miss: key a slot (reusing the least recently used one's context
+        // allocation when the pool is full).
+        ++slots.misses;
+        if (!victim->ctx) victim->ctx = EVP_CIPHER_CTX_new();
+        if (!victim->ctx || EVP_CipherInit_ex(victim->ctx, cipher, NULL, key, iv, encrypt ? 1 : 0) != 1)
+        {
+            victim->cipher = NULL;
+            return NULL;
+        }
+        OPENSSL_cleanse(victim->key, sizeof(victim->key));
+        memcpy(victim->key, key, keyLen);
+        victim->cipher = cipher;
+        victim->encrypt = encrypt;
+        victim->used = slots.clock;
+        return victim->ctx;
+    }
+
+    static unsigned long long hits() { return local().hits; }
+    static unsigned long long misses() { return local().misses; }
+
+private:
+    struct Slot
+    {
+        EVP_CIPHER_CTX* ctx;
+        const EVP_CIPHER* cipher;
+        bool encrypt;
+        unsigned long long used;
+        unsigned char key[MAX_KEY];
+    };
+
+    // Fixed array, so lookups never allocate; freed (and the key schedules
+    // wiped by EVP_CIPHER_CTX_free) when the thread exits.
+    struct Slots
+    {
+        Slot slot[CAPACITY];
+        unsigned long long clock;
+        unsigned long long hits;
+        unsigned long long misses;
+
+        Slots() : clock(0), hits(0), misses(0) { memset(slot, 0, sizeof(slot)); }
+        ~Slots()
+        {
+            for (size_t i = 0; i < CAPACITY; ++i) EVP_CIPHER_CTX_free(slot[i].ctx);
+            OPENSSL_cleanse(slot, sizeof(slot));
+        }
+    };
+
+    static Slots& local()
+    {
+        static thread_local Slots slots;
+        return slots;
+    }
+};
+
+#endif
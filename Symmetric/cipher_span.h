@@ -0,0 +1,172 @@
+// Span-based encryption for the symmetric examples.
+//
+// Callers own every buffer.  CipherSpan::outputSize says up front how many
+// bytes the output needs, and run/seal/open write straight into the
+// caller's span: no intermediate buffer, no allocation, no copy.  The
+// output may be the input itself (out.data == in.data), so a message can be
+// encrypted or decrypted in place; for padded block modes the buffer only
+// needs the extra block that outputSize reports.  Partially overlapping
+// spans are not allowed.
+//
+// Lengths are size_t; EVP takes int, so long messages are fed in 1 GiB
+// pieces (except CCM, which takes the whole message in one call).
+#ifndef CIPHER_SPAN_H
+#define CIPHER_SPAN_H
+
+#include <openssl/evp.h>
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+struct ConstByteSpan
+{
+    const unsigned char* data;
+    size_t size;
+
+    ConstByteSpan() : data(NULL), size(0) {}
+    ConstByteSpan(const void* p, size_t n) : data(static_cast<const unsigned char*>(p)), size(n) {}
+    ConstByteSpan(const std::vector<unsigned char>& v) : data(v.data()), size(v.size()) {}
+    ConstByteSpan(const std::string& s) : data(reinterpret_cast<const unsigned char*>(s.data())), size(s.size()) {}
+};
+
+struct ByteSpan
+{
+    unsigned char* data;
+    size_t size;
+
+    ByteSpan() : data(NULL), size(0) {}
+    ByteSpan(void* p, size_t n) : data(static_cast<unsigned char*>(p)), size(n) {}
+    ByteSpan(std::vector<unsigned char>& v) : data(v.data()), size(v.size()) {}
+    operator ConstByteSpan() const { return ConstByteSpan(data, size); }
+    ConstByteSpan first(size_t n) const { return ConstByteSpan(data, n); }
+};
+
+class CipherSpan
+{
+public:
+    // Output bytes needed to process inLen bytes.  Exact when encrypting;
+    // when decrypting a padded mode it is the upper bound (the padding is
+    // only known once the last block is decrypted).  0 on overflow.
+    static size_t outputSize(const EVP_CIPHER* cipher, size_t inLen, bool encrypt, bool padding = true)
+    {
+        size_t block = (size_t)EVP_CIPHER_get_block_size(cipher);
+        if (!encrypt || !padding || block <= 1) return inLen;
+        size_t padded = inLen + block - inLen % block;
+        return padded < inLen ? 0 : padded;
+    }
+
+    static size_t outputSize(const EVP_CIPHER_CTX* ctx, size_t inLen)
+    {
+        return outputSize(EVP_CIPHER_CTX_get0_cipher(ctx), inLen, EVP_CIPHER_CTX_is_encrypting(ctx) == 1,
+                          EVP_CIPHER_CTX_test_flags(ctx, EVP_CIPH_NO_PADDING) == 0);
+    }
+
+    // Update + Final over in on a context that already has its cipher,
+    // key, IV and direction.  Fails without touching out if out is smaller
+    // than outputSize(ctx, in.size).  *outLen is the exact length written.
+    static bool run(EVP_CIPHER_CTX* ctx, ConstByteSpan in, ByteSpan out, size_t* outLen)
+    {
+        size_t need = outputSize(ctx, in.size);
+        if ((need == 0 && in.size != 0) || out.size < need) return false;
+        size_t done = 0;
+        if (!update(ctx, in, out.data, &done)) return false;
+        int tail = 0;
+        if (EVP_CipherFinal_ex(ctx, out.data + done, &tail) != 1) return false;
+        *outLen = done + (size_t)tail;
+        return true;
+    }
+
+    // run() with the input already in buf.data[0, len).
+    static bool inPlace(EVP_CIPHER_CTX* ctx, ByteSpan buf, size_t len, size_t* outLen)
+    {
+        return len <= buf.size && run(ctx, buf.first(len), buf, outLen);
+    }
+
+    // AEAD seal (GCM, CCM, OCB, ChaCha20-Poly1305) on an encrypting context
+    // with key and nonce set.  out is in.size bytes and may be in.data;
+    // tag.size is the tag length to produce.  CCM fixes its tag length when
+    // keyed, so set EVP_CTRL_AEAD_SET_TAG (and the IV length) before the key.
+    static bool seal(EVP_CIPHER_CTX* ctx, ConstByteSpan aad, ConstByteSpan in, ByteSpan out, ByteSpan tag)
+    {
+        if (out.size < in.size) return false;
+        if (isCcm(ctx) && !ccmPrepare(ctx, in.size, NULL, 0)) return false;
+        size_t done = 0;
+        int tail = 0;
+        return addAad(ctx, aad) && update(ctx, in, out.data, &done) &&
+               EVP_EncryptFinal_ex(ctx, out.data + done, &tail) == 1 &&
+               EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, (int)tag.size, tag.data) == 1;
+    }
+
+    // AEAD open: false if the tag does not verify.  out may be in.data; on
+    // failure its contents must be discarded.
+    static bool open(EVP_CIPHER_CTX* ctx, ConstByteSpan aad, ConstByteSpan in, ByteSpan out, ConstByteSpan tag)
+    {
+        if (out.size < in.size) return false;
+        if (isCcm(ctx))
+        {
+            // CCM checks the tag inside the single update; Final is a no-op.
+            size_t done = 0;
+            return ccmPrepare(ctx, in.size, tag.data, tag.size) && addAad(ctx, aad) && update(ctx, in, out.data, &done);
+        }
+        size_t done = 0;
+        int tail = 0;
+        return addAad(ctx, aad) && update(ctx, in, out.data, &done) &&
+               EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, (int)tag.size, const_cast<unsigned char*>(tag.data)) == 1 &&
+               EVP_DecryptFinal_ex(ctx, out.data + done, &tail) == 1;
+    }
+
+private:
+    static const size_t PIECE = 1u << 30;
+
+    static bool update(EVP_CIPHER_CTX* ctx, ConstByteSpan in, unsigned char* out, size_t* written)
+    {
+        // A padded decrypt lags its input by one block, so in-place pieces
+        // after the first write just behind where they read; the cipher
+        // provider handles that like the single-call case.  CCM must see
+        // the whole message in one call.
+        *written = 0;
+        if (in.size == 0)
+        {
+            // Empty spans may carry NULL pointers, which EVP reads as "AAD"
+            // or "final"; only CCM needs the call, to compute its tag.
+            unsigned char none = 0;
+            int len;
+            return !isCcm(ctx) || EVP_CipherUpdate(ctx, &none, &len, &none, 0) == 1;
+        }
+        size_t piece = isCcm(ctx) ? (size_t)INT_MAX : PIECE;
+        size_t pos = 0;
+        do
+        {
+            size_t n = in.size - pos < piece ? in.size - pos : piece;
+            int len = 0;
+            if (EVP_CipherUpdate(ctx, out + *written, &len, in.data + pos, (int)n) != 1) return false;
+            *written += (size_t)len;
+            pos += n;
+        } while (pos < in.size);
+        return true;
+    }
+
+    static bool addAad(EVP_CIPHER_CTX* ctx, ConstByteSpan aad)
+    {
+        int len;
+        return aad.size == 0 || (aad.size <= (size_t)INT_MAX && EVP_CipherUpdate(ctx, NULL, &len, aad.data, (int)aad.size) == 1);
+    }
+
+    static bool isCcm(EVP_CIPHER_CTX* ctx)
+    {
+        return EVP_CIPHER_CTX_get_mode(ctx) == EVP_CIPH_CCM_MODE;
+    }
+
+    // CCM needs the expected tag (when decrypting) and the total message
+    // length before any AAD or data.
+    static bool ccmPrepare(EVP_CIPHER_CTX* ctx, size_t msgLen, const unsigned char* tag, size_t tagLen)
+    {
+        int len;
+        return msgLen <= (size_t)INT_MAX &&
+               (!tag || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, (int)tagLen, const_cast<unsigned char*>(tag)) == 1) &&
+               EVP_CipherUpdate(ctx, NULL, &len, NULL, (int)msgLen) == 1;
+    }
+};
+
+#endif
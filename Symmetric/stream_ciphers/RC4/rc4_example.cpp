@@ -3,6 +3,9 @@
 #include <cstring>
 #include <iostream>
 #include <cstdio>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -30,37 +33,30 @@ int main()
 
     // Data
     const char* plaintext = "This is RC4 example";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
-    unsigned char decrypted[128];
-    int len = 0, ciphertext_len = 0, decrypted_len = 0;
+    size_t plaintext_len = strlen(plaintext);
 
     // Encrypt
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
     if (1 != EVP_EncryptInit_ex(ctx, EVP_rc4(), NULL, key, NULL)) handleErrors();
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, reinterpret_cast<const unsigned char*>(plaintext), plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    size_t ciphertext_len = 0;
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
     EVP_CIPHER_CTX_free(ctx);
 
     std::cout << "Key: ";
     for (int i = 0; i < 16; ++i) std::cout << std::hex << (int)key[i];
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
+    for (size_t i = 0; i < ciphertext_len; ++i) std::cout << std::hex << (int)ciphertext[i];
     std::cout << std::endl;
 
-    // Decrypt
+    // Decrypt in place
     ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
     if (1 != EVP_DecryptInit_ex(ctx, EVP_rc4(), NULL, key, NULL)) handleErrors();
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    decrypted_len = len;
-    if (1 != EVP_DecryptFinal_ex(ctx, decrypted + len, &len)) handleErrors();
-    decrypted_len += len;
-    decrypted[decrypted_len] = '\0';
-    std::cout << "Decrypted: " << decrypted << std::endl;
+    size_t decrypted_len = 0;
+    if (!CipherSpan::inPlace(ctx, ciphertext, ciphertext_len, &decrypted_len)) handleErrors();
+    std::cout << "Decrypted: " << std::string(reinterpret_cast<const char*>(ciphertext.data()), decrypted_len) << std::endl;
     EVP_CIPHER_CTX_free(ctx);
     return 0;
 }
@@ -3,6 +3,9 @@
 #include <openssl/provider.h>
 #include <cstring>
 #include <iostream>
+#include <string>
+#include <vector>
+#include "cipher_span.h"
 
 void handleErrors()
 {
@@ -46,21 +49,16 @@ int main()
 
     // Data
     const char* plaintext = "This is ChaCha20";
-    int plaintext_len = strlen(plaintext);
-    unsigned char ciphertext[128];
-    unsigned char decrypted[128];
-    int len = 0, ciphertext_len = 0, decrypted_len = 0;
+    size_t plaintext_len = strlen(plaintext);
 
-    // Encrypt
+    // Encrypt: a stream cipher's output is exactly as long as its input
     EVP_CIPHER_CTX* ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
 
     if (1 != EVP_EncryptInit_ex(ctx, EVP_chacha20(), NULL, key, nonce)) handleErrors();
-    if (1 != EVP_EncryptUpdate(ctx, ciphertext, &len, reinterpret_cast<const unsigned char*>(plaintext), plaintext_len)) handleErrors();
-    ciphertext_len = len;
-    // ChaCha20 is a stream cipher, no padding, so EncryptFinal_ex is a no-op but should still be called
-    if (1 != EVP_EncryptFinal_ex(ctx, ciphertext + len, &len)) handleErrors();
-    ciphertext_len += len;
+    std::vector<unsigned char> ciphertext(CipherSpan::outputSize(ctx, plaintext_len));
+    size_t ciphertext_len = 0;
+    if (!CipherSpan::run(ctx, ConstByteSpan(plaintext, plaintext_len), ciphertext, &ciphertext_len)) handleErrors();
 
     EVP_CIPHER_CTX_free(ctx);
 
@@ -72,25 +70,21 @@ int main()
     for (int i = 0; i < 12; ++i)
         std::cout << std::hex << (int)nonce[i];
     std::cout << "\nCiphertext: ";
-    for (int i = 0; i < ciphertext_len; ++i)
+    for (size_t i = 0; i < ciphertext_len; ++i)
         std::cout << std::hex << (int)ciphertext[i];
     std::cout << "\nCiphertext length: " << ciphertext_len << std::endl;
     std::cout << "Plaintext length: " << plaintext_len << std::endl;
 
-    // Decrypt
+    // Decrypt in place over the ciphertext
     ctx = EVP_CIPHER_CTX_new();
     if (!ctx) handleErrors();
 
     if (1 != EVP_DecryptInit_ex(ctx, EVP_chacha20(), NULL, key, nonce)) handleErrors();
-    if (1 != EVP_DecryptUpdate(ctx, decrypted, &len, ciphertext, ciphertext_len)) handleErrors();
-    decrypted_len = len;
-    // ChaCha20 is a stream cipher, no padding, so DecryptFinal_ex is a no-op but should still be called
-    if (1 != EVP_DecryptFinal_ex(ctx, decrypted + len, &len)) handleErrors();
-    decrypted_len += len;
+    size_t decrypted_len = 0;
+    if (!CipherSpan::inPlace(ctx, ciphertext, ciphertext_len, &decrypted_len)) handleErrors();
 
-    // Null-terminate and print decrypted text
-    decrypted[decrypted_len] = '\0';
-    std::cout << "Decrypted text: " << decrypted << std::endl;
+    std::cout << "Decrypted text: " << std::string(reinterpret_cast<const char*>(ciphertext.data()), decrypted_len)
+              << std::endl;
 
     EVP_CIPHER_CTX_free(ctx);
     // No provider unload needed for ChaCha20